@@ -3,6 +3,9 @@
 #include "text-editor.h"
 #include "selection.h"
 
+static const Regex WORD_CHARACTER_REGEX = Regex(u"\\w");
+static const Regex QUOTE_REGEX = Regex(u"['\"`]");
+
 static bool endsWithEscapeCharacter(const std::u16string &);
 static bool endsWithEscapeSequence(const std::u16string &);
 
@@ -47,8 +50,8 @@ void BracketMatcher::insertText(const std::u16string &text, bool groupUndo) {
   const std::u16string nextCharacter = this->editor->getTextInBufferRange({cursorBufferPosition, cursorBufferPosition.traverse({0, 1})});
   const std::u16string previousCharacter = previousCharacters.substr(std::max(previousCharacters.size(), static_cast<size_t>(1)) - 1);
 
-  const bool hasWordAfterCursor = Regex(u"\\w").match(nextCharacter);
-  const bool hasWordBeforeCursor = Regex(u"\\w").match(previousCharacter);
+  const bool hasWordAfterCursor = WORD_CHARACTER_REGEX.match(nextCharacter);
+  const bool hasWordBeforeCursor = WORD_CHARACTER_REGEX.match(previousCharacter);
   const bool hasQuoteBeforeCursor = this->isQuote(previousCharacter) && (previousCharacter == text);
   const bool hasEscapeCharacterBeforeCursor = endsWithEscapeCharacter(previousCharacters);
   const bool hasEscapeSequenceBeforeCursor = endsWithEscapeSequence(previousCharacters);
@@ -190,7 +193,7 @@ bool BracketMatcher::wrapSelectionInBrackets(const std::u16string &bracket) {
 }
 
 bool BracketMatcher::isQuote(const std::u16string &string) {
-  return Regex(u"['\"`]").match(string);
+  return QUOTE_REGEX.match(string);
 }
 
 bool BracketMatcher::isOpeningBracket(const std::u16string &string) {
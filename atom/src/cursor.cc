@@ -4,9 +4,14 @@
 #include <display-marker.h>
 #include <text-buffer.h>
 #include <helpers.h>
+#include <regex-cache.h>
 #include <cmath>
 
 static const Regex EmptyLineRegExp = Regex(u"(\r\n[\t ]*\r\n)|(\n[\t ]*\n)");
+static const Regex WhitespaceRegExp = Regex(u"\\s");
+static const Regex NonWhitespaceRegExp = Regex(u"\\S");
+static const Regex AllWhitespaceRegExp = Regex(u"^\\s+$");
+static const Regex LeadingWhitespaceRegExp = Regex(u"^[ \t]*");
 
 Cursor::Cursor(TextEditor *editor, DisplayMarker *marker) {
   this->editor = editor;
@@ -86,7 +91,7 @@ bool Cursor::isSurroundedByWhitespace() {
   const Point bufferPosition = this->getBufferPosition();
   const double row = bufferPosition.row, column = bufferPosition.column;
   const Range range = {{row, column - 1}, {row, column + 1}};
-  return Regex(u"^\\s+$").match(this->editor->getTextInBufferRange(range));
+  return AllWhitespaceRegExp.match(this->editor->getTextInBufferRange(range));
 }
 
 bool Cursor::isBetweenWordAndNonWord() {
@@ -96,7 +101,7 @@ bool Cursor::isBetweenWordAndNonWord() {
   const double row = bufferPosition.row, column = bufferPosition.column;
   const Range range = {{row, column - 1}, {row, column + 1}};
   const std::u16string text = this->editor->getTextInBufferRange(range);
-  if (Regex(u"\\s").match(text[0]) || Regex(u"\\s").match(text[1])) return false;
+  if (WhitespaceRegExp.match(text[0]) || WhitespaceRegExp.match(text[1])) return false;
 
   const std::u16string nonWordCharacters = this->getNonWordCharacters();
   return (
@@ -110,8 +115,8 @@ bool Cursor::isInsideWord(/* options */) {
   const double row = bufferPosition.row, column = bufferPosition.column;
   const Range range = {{row, column}, {row, INFINITY}};
   const std::u16string text = this->editor->getTextInBufferRange(range);
-  const Regex wordRegex = /* (options && options.wordRegex) || */ this->wordRegExp();
-  const auto match = wordRegex.match(text);
+  const auto wordRegex = /* (options && options.wordRegex) || */ this->wordRegExp();
+  const auto match = wordRegex->match(text);
   return match && match.start_offset == 0;
 }
 
@@ -126,7 +131,7 @@ double Cursor::getIndentLevel() {
 bool Cursor::hasPrecedingCharactersOnLine() {
   const Point bufferPosition = this->getBufferPosition();
   const std::u16string line = this->editor->lineTextForBufferRow(bufferPosition.row);
-  const double firstCharacterColumn = Regex(u"\\S").search(line);
+  const double firstCharacterColumn = NonWhitespaceRegExp.search(line);
 
   if (firstCharacterColumn == -1) {
     return false;
@@ -259,7 +264,7 @@ void Cursor::moveToFirstCharacterOfLine() {
 
   optional<double> firstCharacterColumn;
   this->editor->scanInBufferRange(
-    Regex(u"\\S"),
+    NonWhitespaceRegExp,
     screenLineBufferRange,
     [&](TextBuffer::SearchCallbackArgument &argument) {
       firstCharacterColumn = argument.range.start.column;
@@ -315,14 +320,14 @@ void Cursor::moveToNextWordBoundary() {
 }
 
 void Cursor::moveToPreviousSubwordBoundary() {
-  const Regex wordRegex = this->subwordRegExp(true);
-  const Point position = this->getPreviousWordBoundaryBufferPosition(&wordRegex);
+  const auto wordRegex = this->subwordRegExp(true);
+  const Point position = this->getPreviousWordBoundaryBufferPosition(wordRegex.get());
   this->setBufferPosition(position);
 }
 
 void Cursor::moveToNextSubwordBoundary() {
-  const Regex wordRegex = this->subwordRegExp();
-  const Point position = this->getNextWordBoundaryBufferPosition(&wordRegex);
+  const auto wordRegex = this->subwordRegExp();
+  const Point position = this->getNextWordBoundaryBufferPosition(wordRegex.get());
   this->setBufferPosition(position);
 }
 
@@ -330,7 +335,7 @@ void Cursor::skipLeadingWhitespace() {
   const Point position = this->getBufferPosition();
   const Range scanRange = this->getCurrentLineBufferRange();
   Point endOfLeadingWhitespace;
-  this->editor->scanInBufferRange(Regex(u"^[ \t]*"), scanRange, [&](TextBuffer::SearchCallbackArgument &argument) {
+  this->editor->scanInBufferRange(LeadingWhitespaceRegExp, scanRange, [&](TextBuffer::SearchCallbackArgument &argument) {
     endOfLeadingWhitespace = argument.range.end;
   });
 
@@ -363,7 +368,7 @@ Point Cursor::getPreviousWordBoundaryBufferPosition(const Regex *wordRegex) {
   );
 
   const auto ranges = this->editor->buffer->findAllInRangeSync(
-    wordRegex ? *wordRegex : static_cast<const Regex &>(this->wordRegExp()),
+    wordRegex ? *wordRegex : *this->wordRegExp(),
     scanRange
   );
 
@@ -392,7 +397,7 @@ Point Cursor::getNextWordBoundaryBufferPosition(const Regex *wordRegex) {
   );
 
   const auto range = this->editor->buffer->findInRangeSync(
-    wordRegex ? *wordRegex : static_cast<const Regex &>(this->wordRegExp()),
+    wordRegex ? *wordRegex : *this->wordRegExp(),
     scanRange
   );
 
@@ -418,7 +423,7 @@ Point Cursor::getBeginningOfCurrentWordBufferPosition(/* options = {} */) {
     : Range(Point(position.row, 0), position);
 
   const auto ranges = this->editor->buffer->findAllInRangeSync(
-    /* options.wordRegex || */ this->wordRegExp( /* options */ ),
+    /* options.wordRegex || */ *this->wordRegExp( /* options */ ),
     scanRange
   );
 
@@ -441,7 +446,7 @@ Point Cursor::getEndOfCurrentWordBufferPosition(/* options = {} */) {
     : Range(position, Point(position.row, INFINITY));
 
   const auto ranges = this->editor->buffer->findAllInRangeSync(
-    /* options.wordRegex || */ this->wordRegExp(/* options */),
+    /* options.wordRegex || */ *this->wordRegExp(/* options */),
     scanRange
   );
 
@@ -462,7 +467,7 @@ Point Cursor::getBeginningOfNextWordBufferPosition(/* options = {} */) {
 
   optional<Point> beginningOfNextWordPosition;
   this->editor->scanInBufferRange(
-    /* options.wordRegex || */ this->wordRegExp(),
+    /* options.wordRegex || */ *this->wordRegExp(),
     scanRange,
     [&](TextBuffer::SearchCallbackArgument &argument) {
       beginningOfNextWordPosition = argument.range.start;
@@ -476,7 +481,7 @@ Point Cursor::getBeginningOfNextWordBufferPosition(/* options = {} */) {
 Range Cursor::getCurrentWordBufferRange(const Regex *wordRegex, bool includeNonWordCharacters) {
   const Point position = this->getBufferPosition();
   const auto ranges = this->editor->buffer->findAllInRangeSync(
-    wordRegex ? *wordRegex : static_cast<const Regex &>(this->wordRegExp(includeNonWordCharacters)),
+    wordRegex ? *wordRegex : *this->wordRegExp(includeNonWordCharacters),
     Range(Point(position.row, 0), Point(position.row, INFINITY))
   );
   auto range = std::find_if(ranges.begin(), ranges.end(), [&](const Range &range) {
@@ -510,16 +515,16 @@ void Cursor::clearSelection(bool autoscroll) {
   if (this->selection) this->selection->clear(autoscroll);
 }
 
-Regex Cursor::wordRegExp(bool includeNonWordCharacters) {
+std::shared_ptr<const Regex> Cursor::wordRegExp(bool includeNonWordCharacters) {
   const std::u16string nonWordCharacters = escapeRegExp(this->getNonWordCharacters());
   std::u16string source = u"^[\t ]*$|[^\\s" + nonWordCharacters + u"]+";
   if (includeNonWordCharacters) {
     source += u"|[" + nonWordCharacters + u"]+";
   }
-  return Regex(source);
+  return RegexCache::shared().get(source);
 }
 
-Regex Cursor::subwordRegExp(bool backwards) {
+std::shared_ptr<const Regex> Cursor::subwordRegExp(bool backwards) {
   const std::u16string nonWordCharacters = this->getNonWordCharacters();
   const std::u16string lowercaseLetters = u"a-z\\u00DF-\\u00F6\\u00F8-\\u00FF";
   const std::u16string uppercaseLetters = u"A-Z\\u00C0-\\u00D6\\u00D8-\\u00DE";
@@ -538,7 +543,7 @@ Regex Cursor::subwordRegExp(bool backwards) {
     segments.push_back(u"\\s*[" + escapeRegExp(nonWordCharacters) + u"]+");
   }
   segments.push_back(u"_+");
-  return Regex(join(segments, u"|"));
+  return RegexCache::shared().get(join(segments, u"|"));
 }
 
 /*
@@ -6,6 +6,7 @@
 #include <optional.h>
 #include <regex.h>
 #include <functional>
+#include <memory>
 
 struct TextEditor;
 struct DisplayMarker;
@@ -70,8 +71,8 @@ struct Cursor {
   Range getCurrentLineBufferRange(bool = false);
   int compare(Cursor *);
   void clearSelection(bool);
-  Regex wordRegExp(bool = true);
-  Regex subwordRegExp(bool = false);
+  std::shared_ptr<const Regex> wordRegExp(bool = true);
+  std::shared_ptr<const Regex> subwordRegExp(bool = false);
   std::u16string getNonWordCharacters();
   void changePosition(optional<bool>, std::function<void()>);
   Range getScreenRange();
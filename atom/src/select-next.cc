@@ -2,6 +2,7 @@
 #include "text-editor.h"
 #include "selection.h"
 #include <helpers.h>
+#include <regex-cache.h>
 
 SelectNext::SelectNext(TextEditor *editor) {
   this->editor = editor;
@@ -66,7 +67,7 @@ void SelectNext::scanForNextOccurrence(const Range &range, TextBuffer::ScanItera
     const std::u16string nonWordCharacters = this->editor->getNonWordCharacters(Point());
     text = u"(^|[ \t" + escapeRegExp(nonWordCharacters) + u"]+)" + text + u"(?=$|[\\s" + escapeRegExp(nonWordCharacters) + u"]+)";
   }
-  return this->editor->scanInBufferRange(Regex(text), range, [&](TextBuffer::SearchCallbackArgument &result) {
+  return this->editor->scanInBufferRange(*RegexCache::shared().get(text), range, [&](TextBuffer::SearchCallbackArgument &result) {
     const std::u16string matchText = result.getMatchText();
     Regex::MatchData matchData(result.regex);
     const auto match = result.regex.match(matchText, matchData);
@@ -81,7 +82,7 @@ void SelectNext::scanForNextOccurrence(const Range &range, TextBuffer::ScanItera
 bool SelectNext::isNonWordCharacter(const std::u16string &character) {
   //nonWordCharacters = atom.config.get('editor.nonWordCharacters');
   const std::u16string nonWordCharacters = this->editor->getNonWordCharacters(Point());
-  return Regex(u"[ \t" + escapeRegExp(nonWordCharacters) + u"]").match(character);
+  return RegexCache::shared().get(u"[ \t" + escapeRegExp(nonWordCharacters) + u"]")->match(character);
 }
 
 bool SelectNext::isNonWordCharacterToTheLeft(Selection *selection) {
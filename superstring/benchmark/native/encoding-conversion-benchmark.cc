@@ -0,0 +1,103 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+#include "encoding-conversion.h"
+
+using namespace std::chrono;
+using std::string;
+using std::u16string;
+using std::vector;
+
+// Source code: mostly ASCII lines, with an occasional non-ASCII character.
+static string get_utf8_source(size_t size) {
+  string content;
+  content.reserve(size + 128);
+  while (content.size() < size) {
+    content.append(rand() % 80, 'x');
+    if (rand() % 10 == 0) content += "γ";
+    content += '\n';
+  }
+  return content;
+}
+
+static void report(const char *description, size_t bytes, milliseconds start, milliseconds end) {
+  double megabytes = bytes / (1024.0 * 1024.0);
+  std::cout << description << " " << megabytes << " MB: " << (end - start).count()
+            << "ms (" << megabytes / ((end - start).count() / 1000.0) << " MB/s)\n";
+}
+
+static void benchmark_decoding(const char *description, const char *encoding_name, const string &input) {
+  auto conversion = transcoding_from(encoding_name);
+  REQUIRE(conversion);
+
+  // Decode in the blocks that files are read in.
+  const size_t block_size = 10 * 1024;
+  u16string output;
+  output.reserve(input.size());
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  size_t offset = 0;
+  while (offset < input.size()) {
+    size_t length = std::min(block_size, input.size() - offset);
+    offset += conversion->decode(output, input.data() + offset, length, offset + length == input.size());
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  report(description, input.size(), start, end);
+}
+
+static void benchmark_encoding(const char *description, const char *encoding_name, const u16string &input) {
+  auto conversion = transcoding_to(encoding_name);
+  REQUIRE(conversion);
+
+  vector<char> output(10 * 1024);
+  size_t total_bytes = 0;
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  size_t offset = 0;
+  while (offset < input.size()) {
+    total_bytes += conversion->encode(input, &offset, input.size(), output.data(), output.size(), true);
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  report(description, total_bytes, start, end);
+}
+
+// "UTF8" and "ISO_8859-1" are aliases that go through iconv.
+TEST_CASE("EncodingConversion - UTF-8 throughput") {
+  srand(0);
+  string input = get_utf8_source(64 * 1024 * 1024);
+  benchmark_decoding("Decoding UTF-8 natively:", "UTF-8", input);
+  benchmark_decoding("Decoding UTF-8 with iconv:", "UTF8", input);
+
+  u16string text;
+  transcoding_from("UTF-8")->decode(text, input.data(), input.size(), true);
+  benchmark_encoding("Encoding UTF-8 natively:", "UTF-8", text);
+  benchmark_encoding("Encoding UTF-8 with iconv:", "UTF8", text);
+}
+
+TEST_CASE("EncodingConversion - ISO-8859-1 throughput") {
+  srand(0);
+  string input = get_utf8_source(64 * 1024 * 1024);
+  for (char &byte : input) {
+    if (byte & 0x80) byte = '\xfc';
+  }
+  benchmark_decoding("Decoding ISO-8859-1 natively:", "ISO-8859-1", input);
+  benchmark_decoding("Decoding ISO-8859-1 with iconv:", "ISO_8859-1", input);
+
+  u16string text;
+  transcoding_from("ISO-8859-1")->decode(text, input.data(), input.size(), true);
+  benchmark_encoding("Encoding ISO-8859-1 natively:", "ISO-8859-1", text);
+  benchmark_encoding("Encoding ISO-8859-1 with iconv:", "ISO_8859-1", text);
+}
+
+TEST_CASE("detect_encoding - large files") {
+  string content = get_utf8_source(256 * 1024 * 1024);
+
+  // Detection only reads a bounded sample, so its cost should not grow with
+  // the size of the file.
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (unsigned i = 0; i < 100; i++) {
+    REQUIRE(std::string(detect_encoding(content.data(), content.size())) == "UTF-8");
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Detecting the encoding of 256 MB 100 times: " << (end - start).count() << "ms\n";
+}
@@ -1,29 +1,31 @@
 #include <chrono>
 #include <iostream>
+#include <utility>
 #include <vector>
 #include <stdlib.h>
 #include "catch.hpp"
-#include "point.h"
-#include "range.h"
+#include "native-point.h"
+#include "native-range.h"
 #include "marker-index.h"
 
 using namespace std::chrono;
+using std::pair;
 using std::vector;
 
-Range get_random_range() {
-  Point start(rand() % 100, rand() % 100);
-  Point end = start;
+NativeRange get_random_range() {
+  NativePoint start(rand() % 100, rand() % 100);
+  NativePoint end = start;
   if (rand() % 10 < 5) {
-    end = end.traverse(Point(rand() % 10, rand() % 10));
+    end = end.traverse(NativePoint(rand() % 10, rand() % 10));
   }
-  return Range{start, end};
+  return NativeRange{start, end};
 }
 
 
 TEST_CASE("MarkerIndex::insert") {
   srand(0);
   MarkerIndex marker_index;
-  vector<Range> ranges;
+  vector<NativeRange> ranges;
   unsigned int count = 20000;
 
   for (unsigned int i = 0; i < count; i++) {
@@ -37,3 +39,172 @@ TEST_CASE("MarkerIndex::insert") {
   milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
   std::cout << "Inserting " << (end - start).count();
 }
+
+TEST_CASE("MarkerIndex::insert_batch") {
+  // One marker per search result, as when highlighting every match in a
+  // large file.
+  unsigned int count = 100000;
+  vector<pair<MarkerIndex::MarkerId, NativeRange>> markers;
+  for (unsigned int i = 0; i < count; i++) {
+    NativePoint start(i, 4 + i % 20);
+    markers.push_back({i, NativeRange{start, start.traverse(NativePoint(0, 5))}});
+  }
+
+  MarkerIndex individual;
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (const auto &marker : markers) {
+    individual.insert(marker.first, marker.second.start, marker.second.end);
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Inserting " << count << " markers one at a time: " << (end - start).count() << "ms\n";
+
+  MarkerIndex batched;
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  batched.insert_batch(markers);
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Inserting " << count << " markers in a batch: " << (end - start).count() << "ms\n";
+
+  // A second batch of the same size merges with the existing markers.
+  for (auto &marker : markers) marker.first += count;
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  batched.insert_batch(markers);
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Merging a batch of " << count << " markers: " << (end - start).count() << "ms\n";
+
+  REQUIRE(batched.find_intersecting(NativePoint(10, 0), NativePoint(10, 100)).size() == 2);
+
+  // Snapshots list their markers in no particular order.
+  srand(0);
+  for (unsigned int i = 0; i < count; i++) {
+    NativeRange range = get_random_range();
+    markers[i] = {i, NativeRange{NativePoint(range.start.row * 1000 + i % 1000, range.start.column), range.end}};
+    markers[i].second.end.row += markers[i].second.start.row - range.start.row;
+  }
+
+  MarkerIndex shuffled_individual;
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (const auto &marker : markers) {
+    shuffled_individual.insert(marker.first, marker.second.start, marker.second.end);
+  }
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Inserting " << count << " unordered markers one at a time: " << (end - start).count() << "ms\n";
+
+  MarkerIndex shuffled_batched;
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  shuffled_batched.insert_batch(markers);
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Inserting " << count << " unordered markers in a batch: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("MarkerIndex::find_intersecting and MarkerIndex::splice - many markers") {
+  srand(0);
+  unsigned int count = 500000;
+  MarkerIndex marker_index;
+  for (unsigned int i = 0; i < count; i++) {
+    NativePoint start(rand() % 50000, rand() % 80);
+    marker_index.insert(i, start, start.traverse(NativePoint(rand() % 3, rand() % 20)));
+  }
+
+  size_t found = 0;
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (unsigned int i = 0; i < 20000; i++) {
+    NativePoint position(rand() % 50000, rand() % 80);
+    found += marker_index.find_intersecting(position, position.traverse(NativePoint(1, 0))).size();
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Finding markers intersecting 20000 ranges among " << count << ": " << (end - start).count() << "ms\n";
+
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (unsigned int i = 0; i < 20000; i++) {
+    NativePoint position(rand() % 50000, rand() % 80);
+    marker_index.splice(position, NativePoint(0, rand() % 2), NativePoint(0, rand() % 2));
+  }
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Splicing 20000 times among " << count << " markers: " << (end - start).count() << "ms\n";
+
+  REQUIRE(found > 0);
+}
+
+TEST_CASE("MarkerIndex::BoundaryCursor - scrolling") {
+  srand(0);
+  unsigned int count = 500000;
+  MarkerIndex marker_index;
+  for (unsigned int i = 0; i < count; i++) {
+    NativePoint start(rand() % 50000, rand() % 80);
+    marker_index.insert(i, start, start.traverse(NativePoint(0, rand() % 20)));
+  }
+
+  // Visit the boundaries of each 50-row screen, as a renderer would while
+  // scrolling through the whole buffer. Each screen holds about 1000
+  // boundaries.
+  size_t visited = 0;
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (uint32_t row = 0; row < 50000; row += 50) {
+    auto result = marker_index.find_boundaries_after(NativePoint(row, 0), 2000);
+    for (const auto &boundary : result.boundaries) {
+      if (boundary.position.row >= row + 50) break;
+      visited += boundary.starting.size();
+    }
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Querying boundaries for 1000 screens: " << (end - start).count() << "ms\n";
+
+  size_t cursor_visited = 0;
+  vector<MarkerIndex::MarkerId> containing;
+  MarkerIndex::BoundaryCursor cursor(&marker_index);
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (uint32_t row = 0; row < 50000; row += 50) {
+    containing.clear();
+    cursor.seek(NativePoint(row, 0), &containing);
+    for (; !cursor.at_end() && cursor.position().row < row + 50; cursor.advance()) {
+      cursor_visited += cursor.starting().size();
+    }
+  }
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Walking boundaries for 1000 screens with a cursor: " << (end - start).count() << "ms\n";
+
+  REQUIRE(cursor_visited == visited);
+}
+
+TEST_CASE("MarkerIndex::create_snapshot - typing among many markers") {
+  srand(0);
+  unsigned int count = 500000;
+  MarkerIndex marker_index;
+  for (unsigned int i = 0; i < count; i++) {
+    NativePoint start(rand() % 50000, rand() % 80);
+    marker_index.insert(i, start, start.traverse(NativePoint(0, rand() % 20)));
+  }
+
+  // Each transaction records the markers before and after one keystroke, as
+  // the undo history does.
+  unsigned int keystrokes = 20;
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  size_t dumped = 0;
+  for (unsigned int i = 0; i < keystrokes; i++) {
+    dumped += marker_index.dump().size();
+    marker_index.splice(NativePoint(rand() % 50000, rand() % 80), NativePoint(), NativePoint(0, 1));
+    dumped += marker_index.dump().size();
+  }
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Dumping around " << keystrokes << " keystrokes among " << count << " markers: " << (end - start).count() << "ms\n";
+
+  vector<MarkerIndex::Snapshot> snapshots;
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (unsigned int i = 0; i < keystrokes; i++) {
+    snapshots.push_back(marker_index.create_snapshot());
+    marker_index.splice(NativePoint(rand() % 50000, rand() % 80), NativePoint(), NativePoint(0, 1));
+    snapshots.push_back(marker_index.create_snapshot());
+  }
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Snapshotting around " << keystrokes << " keystrokes among " << count << " markers: " << (end - start).count() << "ms\n";
+
+  start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  for (unsigned int i = 0; i < 10; i++) {
+    marker_index.restore_snapshot(snapshots[rand() % snapshots.size()]);
+  }
+  end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << "Restoring 10 snapshots among " << count << " markers: " << (end - start).count() << "ms\n";
+
+  REQUIRE(dumped == 2 * keystrokes * count);
+  REQUIRE(snapshots.front().size() == count);
+}
@@ -0,0 +1,172 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+#include "native-text-buffer.h"
+#include "regex.h"
+
+using namespace std::chrono;
+using std::move;
+using std::pair;
+using std::u16string;
+using std::vector;
+
+static milliseconds now() {
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+}
+
+TEST_CASE("NativeTextBuffer::find_words_with_subsequence_in_range - typing") {
+  const char16_t *identifiers[] = {
+    u"buffer", u"getText", u"setTextInRange", u"position", u"marker_index", u"row", u"column", u"options"
+  };
+
+  u16string content;
+  while (content.size() < 8 * 1024 * 1024) {
+    content += identifiers[rand() % 8];
+    if (rand() % 4 == 0) content += std::to_string(rand() % 1000).c_str()[0];
+    content += rand() % 6 ? u" " : u"\n";
+  }
+
+  NativeTextBuffer buffer{move(content)};
+  auto snapshot = buffer.create_snapshot();
+  NativeRange all = NativeRange::all_inclusive();
+
+  milliseconds start = now();
+  for (unsigned i = 0; i < 10; i++) snapshot->find_words_with_subsequence_in_range(u"gtx", u"_", all, 0, 1);
+  milliseconds end = now();
+  std::cout << "Scanning 8 MB for each of 10 queries: " << (end - start).count() << "ms\n";
+  delete snapshot;
+
+  // Type a word on one line, then complete it, as an editor would on each
+  // keystroke.
+  start = now();
+  NativePoint cursor{1000, 0};
+  const char16_t *keystrokes[] = {u"g", u"e", u"t", u"T", u"x", u" "};
+  for (unsigned i = 0; i < 60; i++) {
+    buffer.set_text_in_range({cursor, cursor}, keystrokes[i % 6]);
+    cursor.column++;
+    REQUIRE(!buffer.find_words_with_subsequence_in_range(u"gtx", u"_", all, 10).empty());
+  }
+  end = now();
+  std::cout << "Typing 60 characters with a query after each, using the word index: "
+            << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("NativeTextBuffer - reads above layers held by snapshots") {
+  u16string content;
+  while (content.size() < 1024 * 1024) {
+    content += u"abcdefghijklmnopqrstuvwxyz";
+    content += rand() % 4 ? u" " : u"\n";
+  }
+
+  uint32_t default_min_flattening_cost = NativeTextBuffer::MIN_FLATTENING_COST;
+  for (uint32_t min_flattening_cost : {UINT32_MAX, default_min_flattening_cost}) {
+    NativeTextBuffer::MIN_FLATTENING_COST = min_flattening_cost;
+
+    // Each edit made while an earlier snapshot is still held adds a layer
+    // that reads from the buffer have to search.
+    NativeTextBuffer buffer{u16string(content)};
+    std::vector<NativeTextBuffer::Snapshot *> snapshots;
+    for (unsigned i = 0; i < 200; i++) {
+      NativePoint position{static_cast<uint32_t>(rand() % 1000), 3};
+      buffer.set_text_in_range({position, position}, u"x");
+      snapshots.push_back(buffer.create_snapshot());
+    }
+
+    milliseconds start = now();
+    size_t total_length = 0;
+    for (uint32_t i = 0; i < 200000; i++) {
+      total_length += *buffer.line_length_for_row(rand() % 1000);
+    }
+    milliseconds end = now();
+    REQUIRE(total_length > 0);
+    std::cout << "Reading 200000 line lengths above 200 held layers, "
+              << (min_flattening_cost == UINT32_MAX ? "without" : "with") << " flattening: "
+              << (end - start).count() << "ms\n";
+
+    for (auto snapshot : snapshots) delete snapshot;
+  }
+  NativeTextBuffer::MIN_FLATTENING_COST = default_min_flattening_cost;
+}
+
+TEST_CASE("NativeTextBuffer::line_slice_for_row - reading every line") {
+  u16string content;
+  while (content.size() < 4 * 1024 * 1024) {
+    content += u"abcdefghijklmnopqrstuvwxyz";
+    content += rand() % 3 ? u" " : u"\n";
+  }
+
+  NativeTextBuffer buffer{move(content)};
+  uint32_t row_count = buffer.extent().row + 1;
+  for (unsigned i = 0; i < 5000; i++) {
+    NativePoint position{static_cast<uint32_t>(rand() % row_count), 3};
+    buffer.set_text_in_range({position, position}, u"x");
+  }
+
+  // Reflowing reads each line a few times, as the display layer wraps it,
+  // expands its tabs and builds its screen lines.
+  size_t total_length = 0;
+  milliseconds start = now();
+  for (uint32_t row = 0; row < row_count; row++) {
+    for (unsigned i = 0; i < 3; i++) total_length += buffer.text_in_range({{row, 0}, {row, UINT32_MAX}}).size();
+  }
+  milliseconds end = now();
+  std::cout << "Copying each of " << row_count << " lines 3 times: " << (end - start).count() << "ms\n";
+
+  size_t slice_total_length = 0;
+  start = now();
+  for (uint32_t row = 0; row < row_count; row++) {
+    for (unsigned i = 0; i < 3; i++) slice_total_length += buffer.line_slice_for_row(row).size();
+  }
+  end = now();
+  REQUIRE(slice_total_length == total_length);
+  std::cout << "Slicing each of " << row_count << " lines 3 times: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("NativeTextBuffer::set_text_in_ranges - replacing every match") {
+  u16string content;
+  for (unsigned i = 0; i < 100000; i++) {
+    content += u"let value = 1;";
+    content += i % 4 ? u" " : u"\n";
+  }
+
+  NativeTextBuffer buffer{u16string(content)};
+  vector<pair<NativeRange, u16string>> edits;
+  for (NativeRange range : buffer.find_all(Regex(u"value", nullptr))) edits.push_back({range, u"v"});
+  size_t edit_count = edits.size();
+
+  NativeTextBuffer expected_buffer{move(content)};
+  milliseconds start = now();
+  for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+    expected_buffer.set_text_in_range(edit->first, u16string(edit->second));
+  }
+  milliseconds end = now();
+  std::cout << "Replacing " << edit_count << " matches one at a time: " << (end - start).count() << "ms\n";
+
+  start = now();
+  buffer.set_text_in_ranges(move(edits));
+  end = now();
+  REQUIRE(buffer.text() == expected_buffer.text());
+  std::cout << "Replacing " << edit_count << " matches in one batch: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("NativeTextBuffer::flush_changes - saving a large file after each edit") {
+  u16string content;
+  while (content.size() < 16 * 1024 * 1024) {
+    content += u"abcdefghijklmnopqrstuvwxyz";
+    content += rand() % 3 ? u" " : u"\n";
+  }
+
+  NativeTextBuffer buffer{move(content)};
+  uint32_t row_count = buffer.extent().row + 1;
+  milliseconds start = now();
+  for (unsigned i = 0; i < 1000; i++) {
+    NativePoint position{static_cast<uint32_t>(rand() % row_count), 3};
+    buffer.set_text_in_range({position, {position.row, position.column + 1}}, u"xy");
+    buffer.flush_changes();
+  }
+  milliseconds end = now();
+  REQUIRE(!buffer.is_modified());
+  std::cout << "Flushing 1000 edits to 16 MB one at a time: " << (end - start).count() << "ms\n";
+}
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include "catch.hpp"
+#include "patch.h"
+
+using namespace std::chrono;
+using std::u16string;
+using std::vector;
+
+static milliseconds now() {
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+}
+
+static void splice_randomly(Patch &patch, unsigned count) {
+  for (unsigned i = 0; i < count; i++) {
+    NativePoint start(rand() % 1000, rand() % 80);
+    NativePoint deletion_extent(0, rand() % 3);
+    NativePoint insertion_extent(0, rand() % 3);
+    patch.splice(
+      start,
+      deletion_extent,
+      insertion_extent,
+      Text{u16string(deletion_extent.column, 'a')},
+      Text{u16string(insertion_extent.column, 'b')}
+    );
+  }
+}
+
+TEST_CASE("Patch::splice") {
+  srand(0);
+  const unsigned count = 200000;
+  Patch patch;
+
+  milliseconds start = now();
+  splice_randomly(patch, count);
+  milliseconds end = now();
+  std::cout << "Splicing " << count << " times: " << (end - start).count() << "ms\n";
+
+  start = now();
+  patch.clear();
+  end = now();
+  std::cout << "Clearing " << count << " changes: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("Patch - one patch per edit") {
+  srand(0);
+  const unsigned count = 200000;
+  vector<Patch *> patches;
+
+  milliseconds start = now();
+  for (unsigned i = 0; i < count; i++) {
+    Patch *patch = new Patch();
+    splice_randomly(*patch, 1);
+    patches.push_back(patch);
+  }
+  for (Patch *patch : patches) delete patch;
+  milliseconds end = now();
+  std::cout << "Creating and destroying " << count << " single-change patches: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("Patch::compose") {
+  srand(0);
+  const unsigned count = 2000;
+  vector<const Patch *> patches;
+  for (unsigned i = 0; i < count; i++) {
+    Patch *patch = new Patch();
+    splice_randomly(*patch, 5);
+    patches.push_back(patch);
+  }
+
+  milliseconds start = now();
+  Patch composition = Patch::compose(patches);
+  milliseconds end = now();
+  std::cout << "Composing " << count << " patches into " << composition.get_change_count()
+            << " changes: " << (end - start).count() << "ms\n";
+
+  for (const Patch *patch : patches) delete patch;
+}
+
+TEST_CASE("Patch::compose - refactor across many locations") {
+  const unsigned count = 50000;
+  vector<const Patch *> patches;
+  for (unsigned i = 0; i < count; i++) {
+    Patch *patch = new Patch();
+    patch->splice(
+      NativePoint(i, 4),
+      NativePoint(0, 3),
+      NativePoint(0, 7),
+      Text{u"foo"},
+      Text{u"fooBar1"}
+    );
+    patches.push_back(patch);
+  }
+
+  milliseconds start = now();
+  Patch composition = Patch::compose(patches);
+  milliseconds end = now();
+  std::cout << "Composing " << count << " single-location patches: "
+            << (end - start).count() << "ms\n";
+
+  start = now();
+  Patch combination;
+  bool left_to_right = true;
+  for (const Patch *patch : patches) {
+    combination.combine(*patch, left_to_right);
+    left_to_right = !left_to_right;
+  }
+  end = now();
+  std::cout << "Combining " << count << " single-location patches one by one: "
+            << (end - start).count() << "ms\n";
+
+  start = now();
+  composition.rebalance();
+  end = now();
+  std::cout << "Rebalancing " << count << " changes: " << (end - start).count() << "ms\n";
+
+  for (const Patch *patch : patches) delete patch;
+}
@@ -0,0 +1,39 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "catch.hpp"
+#include "native-text-buffer.h"
+#include "regex.h"
+
+using namespace std::chrono;
+using std::u16string;
+
+static void benchmark_find_all(const NativeTextBuffer &buffer, const char16_t *description, const Regex &regex) {
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  auto matches = buffer.find_all(regex);
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  std::cout << u16string(description).size() << "-character pattern, "
+            << (regex.is_literal_pattern() ? "literal" : regex.get_literal_prefix().empty() ? "PCRE2" : "literal prefix")
+            << ": " << matches.size() << " matches in " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("Regex - searching for literals") {
+  u16string content;
+  const size_t size = 64 * 1024 * 1024;
+  content.reserve(size);
+  while (content.size() < size) {
+    for (uint32_t i = rand() % 80; i > 0; i--) content += u"abcdefghij klmnop_"[rand() % 18];
+    if (rand() % 100 == 0) content += u"needle.haystack(42)";
+    content += u'\n';
+  }
+  NativeTextBuffer buffer{std::move(content)};
+
+  // Grouping the first character hides the literal from Regex, leaving the
+  // whole search to PCRE2.
+  benchmark_find_all(buffer, u"needle.haystack", Regex(u"needle\\.haystack", nullptr));
+  benchmark_find_all(buffer, u"needle.haystack", Regex(u"(?:n)eedle\\.haystack", nullptr));
+  benchmark_find_all(buffer, u"needle.haystack(\\d+)", Regex(u"needle\\.haystack\\(\\d+\\)", nullptr));
+  benchmark_find_all(buffer, u"needle.haystack(\\d+)", Regex(u"(?:n)eedle\\.haystack\\(\\d+\\)", nullptr));
+  benchmark_find_all(buffer, u"k", Regex(u"k", nullptr));
+  benchmark_find_all(buffer, u"k", Regex(u"(?:k)", nullptr));
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include "catch.hpp"
+#include "patch.h"
+#include "text.h"
+
+using namespace std::chrono;
+using std::u16string;
+using std::vector;
+
+static milliseconds now() {
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+}
+
+TEST_CASE("Text::serialize") {
+  for (char16_t wide_character : {u'a', u'γ'}) {
+    u16string content;
+    for (unsigned i = 0; i < 200000; i++) {
+      content.append(u"abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxy");
+      content.push_back(wide_character);
+      content.push_back('\n');
+    }
+    Text text{content};
+
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    milliseconds start = now();
+    text.serialize(serializer);
+    milliseconds end = now();
+    std::cout << "Serializing " << (text.is_compact() ? "compact" : "wide") << " text of "
+              << bytes.size() / 1024 << "KB: " << (end - start).count() << "ms\n";
+
+    Deserializer deserializer(bytes.data(), bytes.size());
+    start = now();
+    Text deserialized_text(deserializer);
+    end = now();
+    std::cout << "Deserializing it: " << (end - start).count() << "ms\n";
+    REQUIRE(deserialized_text == text);
+  }
+}
+
+TEST_CASE("Patch::serialize") {
+  srand(0);
+  const unsigned count = 100000;
+  Patch patch;
+  for (unsigned i = 0; i < count; i++) {
+    NativePoint start(rand() % 100000, rand() % 80);
+    NativePoint deletion_extent(0, rand() % 3);
+    u16string inserted(rand() % 40, 'b');
+    patch.splice(start, deletion_extent, NativePoint(0, inserted.size()),
+                 optional<Text>{}, Text{inserted}, deletion_extent.column);
+  }
+
+  vector<uint8_t> bytes;
+  Serializer serializer(bytes);
+  milliseconds start = now();
+  patch.serialize(serializer);
+  milliseconds end = now();
+  std::cout << "Serializing " << patch.get_change_count() << " changes into "
+            << bytes.size() / 1024 << "KB: " << (end - start).count() << "ms\n";
+
+  Deserializer deserializer(bytes.data(), bytes.size());
+  start = now();
+  Patch deserialized_patch(deserializer);
+  end = now();
+  std::cout << "Deserializing them: " << (end - start).count() << "ms\n";
+  REQUIRE(deserialized_patch.get_change_count() == patch.get_change_count());
+}
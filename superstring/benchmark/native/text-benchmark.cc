@@ -0,0 +1,26 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "catch.hpp"
+#include "text.h"
+
+using namespace std::chrono;
+using std::u16string;
+
+TEST_CASE("Text::Text - indexing line offsets") {
+  u16string content;
+  const size_t size = 256 * 1024 * 1024;
+  content.reserve(size);
+  while (content.size() < size) {
+    content.append(rand() % 120, 'x');
+    content += rand() % 2 ? u"\n" : u"\r\n";
+  }
+
+  milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+  Text text{move(content)};
+  milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+
+  double megabytes = text.size() * sizeof(char16_t) / (1024.0 * 1024.0);
+  std::cout << "Indexing " << text.line_offsets.size() << " lines in " << megabytes << " MB: "
+            << (end - start).count() << "ms (" << megabytes / ((end - start).count() / 1000.0) << " MB/s)\n";
+}
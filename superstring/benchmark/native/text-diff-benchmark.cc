@@ -0,0 +1,64 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include "catch.hpp"
+#include "text.h"
+#include "text-diff.h"
+
+using namespace std::chrono;
+using std::u16string;
+
+static milliseconds now() {
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+}
+
+static u16string get_line(unsigned i) {
+  std::string line = "  const value" + std::to_string(i) + " = compute(" + std::to_string(i % 97) + ");\n";
+  return u16string(line.begin(), line.end());
+}
+
+TEST_CASE("text_diff - reformatted file") {
+  srand(0);
+  const unsigned line_count = 100000;
+  u16string old_content, new_content;
+  for (unsigned i = 0; i < line_count; i++) {
+    u16string line = get_line(i);
+    old_content += line;
+    if (i % 10 == 0) {
+      line.insert(0, u"  ");
+    } else if (i % 50 == 1) {
+      new_content += u"\n";
+    } else if (i % 25 == 3) {
+      continue;
+    }
+    new_content += line;
+  }
+
+  Text old_text{old_content};
+  Text new_text{new_content};
+
+  milliseconds start = now();
+  Patch patch = text_diff(old_text, new_text);
+  milliseconds end = now();
+  std::cout << "Diffing " << line_count << " lines into " << patch.get_change_count()
+            << " changes: " << (end - start).count() << "ms\n";
+}
+
+TEST_CASE("text_diff - rewritten file") {
+  const unsigned line_count = 100000;
+  u16string old_content, new_content;
+  for (unsigned i = 0; i < line_count; i++) {
+    old_content += get_line(i);
+    new_content += get_line(line_count - i);
+  }
+
+  Text old_text{old_content};
+  Text new_text{new_content};
+
+  milliseconds start = now();
+  Patch patch = text_diff(old_text, new_text);
+  milliseconds end = now();
+  std::cout << "Diffing " << line_count << " rewritten lines into " << patch.get_change_count()
+            << " changes: " << (end - start).count() << "ms\n";
+}
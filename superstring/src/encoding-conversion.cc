@@ -1,8 +1,13 @@
 #include "encoding-conversion.h"
 #include "utf8-conversions.h"
+#include <algorithm>
 #include <iconv.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using std::function;
 using std::u16string;
 using std::vector;
@@ -16,6 +21,8 @@ enum Mode {
   GENERAL,
   UTF16_TO_UTF8,
   UTF8_TO_UTF16,
+  UTF16_TO_LATIN1,
+  LATIN1_TO_UTF16,
 };
 
 enum ConversionResult {
@@ -26,9 +33,112 @@ enum ConversionResult {
   Error,
 };
 
+static bool is_latin1(const char *name) {
+  return strcmp(name, "ISO-8859-1") == 0 || strcmp(name, "LATIN1") == 0;
+}
+
+// Copies bytes into UTF-16 code units until reaching one that is not ASCII,
+// or until the end when `ascii_only` is false. Returns the number copied.
+static size_t widen(const uint8_t *input, size_t length, uint16_t *output, bool ascii_only) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+    if (ascii_only && _mm_movemask_epi8(bytes) != 0) break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i + 8), _mm_unpackhi_epi8(bytes, zero));
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (ascii_only && input[i] >= 0x80) break;
+    output[i] = input[i];
+  }
+  return i;
+}
+
+// Copies UTF-16 code units into bytes until reaching one above `max_unit`,
+// which is either 0x7F or 0xFF. Returns the number copied.
+static size_t narrow(const uint16_t *input, size_t length, uint8_t *output, uint16_t max_unit) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i high_bits = _mm_set1_epi16(static_cast<short>(~max_unit));
+  for (; i + 16 <= length; i += 16) {
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i + 8));
+    __m128i out_of_range = _mm_and_si128(_mm_or_si128(low, high), high_bits);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(out_of_range, zero)) != 0xFFFF) break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), _mm_packus_epi16(low, high));
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (input[i] > max_unit) break;
+    output[i] = static_cast<uint8_t>(input[i]);
+  }
+  return i;
+}
+
+// These wrap the libc++ transcoders, which handle one code point at a time,
+// so that runs of ASCII are copied in bulk. Every byte of a multi-byte UTF-8
+// sequence and every unit of a surrogate pair is outside of ASCII, so the
+// runs in between end on character boundaries unless a character is cut
+// short. The results match those of transcoding the whole input at once.
+static transcode_result utf8_to_utf16_in_runs(
+  const uint8_t *from, const uint8_t *from_end, const uint8_t *&from_next,
+  uint16_t *to, uint16_t *to_end, uint16_t *&to_next) {
+  from_next = from;
+  to_next = to;
+  for (;;) {
+    size_t ascii_count = widen(from_next, std::min<size_t>(from_end - from_next, to_end - to_next), to_next, true);
+    from_next += ascii_count;
+    to_next += ascii_count;
+    if (from_next == from_end) return transcode_result::ok;
+    if (to_next == to_end) return transcode_result::partial;
+
+    const uint8_t *run_end = from_next;
+    while (run_end < from_end && *run_end >= 0x80) run_end++;
+    transcode_result result = utf8_to_utf16(from_next, run_end, from_next, to_next, to_end, to_next);
+    if (result == transcode_result::error) return result;
+    if (result == transcode_result::partial) {
+      if (run_end == from_end || to_end - to_next < 2) return result;
+      return transcode_result::error;
+    }
+  }
+}
+
+static transcode_result utf16_to_utf8_in_runs(
+  const uint16_t *from, const uint16_t *from_end, const uint16_t *&from_next,
+  uint8_t *to, uint8_t *to_end, uint8_t *&to_next) {
+  from_next = from;
+  to_next = to;
+  for (;;) {
+    size_t ascii_count = narrow(from_next, std::min<size_t>(from_end - from_next, to_end - to_next), to_next, 0x7F);
+    from_next += ascii_count;
+    to_next += ascii_count;
+    if (from_next == from_end) return transcode_result::ok;
+    if (to_next == to_end) return transcode_result::partial;
+
+    const uint16_t *run_end = from_next;
+    while (run_end < from_end && *run_end >= 0x80) run_end++;
+    transcode_result result = utf16_to_utf8(from_next, run_end, from_next, to_next, to_end, to_next);
+    if (result == transcode_result::error) return result;
+    if (result == transcode_result::partial) {
+      if (run_end == from_end || to_end - to_next < 4) return result;
+      return transcode_result::error;
+    }
+  }
+}
+
 optional<EncodingConversion> transcoding_to(const char *name) {
   if (strcmp(name, "UTF-8") == 0) {
     return EncodingConversion{UTF16_TO_UTF8, nullptr};
+  } else if (is_latin1(name)) {
+    return EncodingConversion{UTF16_TO_LATIN1, nullptr};
   } else {
     iconv_t conversion = iconv_open(name, "UTF-16LE");
     return conversion == reinterpret_cast<iconv_t>(-1) ?
@@ -40,6 +150,8 @@ optional<EncodingConversion> transcoding_to(const char *name) {
 optional<EncodingConversion> transcoding_from(const char *name) {
   if (strcmp(name, "UTF-8") == 0) {
     return EncodingConversion{UTF8_TO_UTF16, nullptr};
+  } else if (is_latin1(name)) {
+    return EncodingConversion{LATIN1_TO_UTF16, nullptr};
   } else {
     iconv_t conversion = iconv_open("UTF-16LE", name);
     return conversion == reinterpret_cast<iconv_t>(-1) ?
@@ -64,13 +176,24 @@ EncodingConversion::~EncodingConversion() {
   if (data) iconv_close(data);
 }
 
+EncodingConversion &EncodingConversion::operator=(EncodingConversion &&other) {
+  if (this != &other) {
+    if (data) iconv_close(data);
+    data = other.data;
+    mode = other.mode;
+    other.mode = GENERAL;
+    other.data = nullptr;
+  }
+  return *this;
+}
+
 int EncodingConversion::convert(
   const char **input, const char *input_end, char **output, char *output_end) const {
   switch (mode) {
     case UTF8_TO_UTF16: {
       const uint8_t *next_input;
       uint16_t *next_output;
-      int result = utf8_to_utf16(
+      int result = utf8_to_utf16_in_runs(
         reinterpret_cast<const uint8_t *>(*input),
         reinterpret_cast<const uint8_t *>(input_end),
         next_input,
@@ -93,7 +216,7 @@ int EncodingConversion::convert(
     case UTF16_TO_UTF8: {
       const uint16_t *next_input;
       uint8_t *next_output;
-      int result = utf16_to_utf8(
+      int result = utf16_to_utf8_in_runs(
         reinterpret_cast<const uint16_t *>(*input),
         reinterpret_cast<const uint16_t *>(input_end),
         next_input,
@@ -113,6 +236,39 @@ int EncodingConversion::convert(
       }
     }
 
+    // Latin-1 bytes are the first 256 code points, so they are always valid
+    // to decode, and only the code units above 0xFF are invalid to encode.
+    case LATIN1_TO_UTF16: {
+      auto next_input = reinterpret_cast<const uint8_t *>(*input);
+      auto next_output = reinterpret_cast<uint16_t *>(*output);
+      size_t count = widen(
+        next_input,
+        std::min<size_t>(input_end - *input, (output_end - *output) / bytes_per_character),
+        next_output,
+        false
+      );
+      *input += count;
+      *output += count * bytes_per_character;
+      return (*input == input_end) ? Ok : Partial;
+    }
+
+    case UTF16_TO_LATIN1: {
+      auto next_input = reinterpret_cast<const uint16_t *>(*input);
+      auto next_output = reinterpret_cast<uint8_t *>(*output);
+      size_t input_units = (input_end - *input) / bytes_per_character;
+      size_t count = narrow(
+        next_input,
+        std::min<size_t>(input_units, output_end - *output),
+        next_output,
+        0xFF
+      );
+      *input += count * bytes_per_character;
+      *output += count;
+      if (count == input_units) return Ok;
+      if (*output == output_end) return Partial;
+      return Invalid;
+    }
+
     default: {
       auto converter = static_cast<iconv_t *>(data);
       size_t input_length = input_end - *input;
@@ -142,8 +298,21 @@ int EncodingConversion::convert(
 bool EncodingConversion::decode(u16string &string, FILE *stream,
                                 vector<char> &input_vector,
                                 function<void(size_t)> progress_callback) {
+  return decode(string, stream, input_vector, 0, [&progress_callback](size_t bytes_read) {
+    progress_callback(bytes_read);
+    return true;
+  });
+}
+
+// Like the above, for when the first `bytes_already_read` bytes of the
+// stream were already read into the start of the buffer. Decoding stops
+// early, without an error, once the progress callback returns false.
+bool EncodingConversion::decode(u16string &string, FILE *stream,
+                                vector<char> &input_vector,
+                                size_t bytes_already_read,
+                                function<bool(size_t)> progress_callback) {
   char *input_buffer = input_vector.data();
-  size_t bytes_left_over = 0;
+  size_t bytes_left_over = bytes_already_read;
   size_t total_bytes_read = 0;
 
   for (;;) {
@@ -153,15 +322,17 @@ bool EncodingConversion::decode(u16string &string, FILE *stream,
     size_t bytes_to_append = bytes_left_over + bytes_read;
     if (bytes_to_append == 0) break;
 
+    // A short read means the stream has ended. A full buffer of bytes that
+    // were already read is not the end, even though nothing more was read.
     size_t bytes_appended = decode(
       string,
       input_buffer,
       bytes_to_append,
-      bytes_read == 0
+      bytes_read < bytes_to_read
     );
 
     total_bytes_read += bytes_appended;
-    progress_callback(total_bytes_read);
+    if (!progress_callback(total_bytes_read)) break;
 
     if (bytes_appended < bytes_to_append) {
       std::copy(input_buffer + bytes_appended, input_buffer + bytes_to_append, input_buffer);
@@ -313,3 +484,167 @@ size_t EncodingConversion::encode(const u16string &string, size_t *start_offset,
   *start_offset += (input_pointer - input_start) / bytes_per_character;
   return output_pointer - output_buffer;
 }
+
+static const size_t detection_prefix_size = 64 * 1024;
+static const size_t detection_block_size = 4 * 1024;
+static const size_t detection_block_count = 16;
+
+bool is_auto_encoding(const std::string &name) {
+  return name == "auto" || name == "AUTO";
+}
+
+// Checks the bytes with the same rules as `utf8_to_utf16`, skipping runs of
+// ASCII 16 bytes at a time where SSE2 is available.
+static bool is_valid_utf8(const uint8_t *data, size_t length, bool allow_truncated_end) {
+  size_t i = 0;
+  while (i < length) {
+#if defined(__SSE2__)
+    while (i + 16 <= length &&
+           _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i))) == 0) {
+      i += 16;
+    }
+    if (i == length) break;
+#endif
+
+    uint8_t lead = data[i];
+    if (lead < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t sequence_length;
+    uint8_t min_second = 0x80, max_second = 0xBF;
+    if (lead < 0xC2) {
+      return false;
+    } else if (lead < 0xE0) {
+      sequence_length = 2;
+    } else if (lead < 0xF0) {
+      sequence_length = 3;
+      if (lead == 0xE0) min_second = 0xA0;
+      if (lead == 0xED) max_second = 0x9F;
+    } else if (lead < 0xF5) {
+      sequence_length = 4;
+      if (lead == 0xF0) min_second = 0x90;
+      if (lead == 0xF4) max_second = 0x8F;
+    } else {
+      return false;
+    }
+
+    size_t available = std::min(sequence_length, length - i);
+    if (available > 1 && (data[i + 1] < min_second || data[i + 1] > max_second)) return false;
+    for (size_t j = 2; j < available; j++) {
+      if ((data[i + j] & 0xC0) != 0x80) return false;
+    }
+    if (available < sequence_length) return allow_truncated_end;
+    i += sequence_length;
+  }
+  return true;
+}
+
+// Text in UTF-16 without a byte order mark still has a zero byte in most
+// pairs, since most characters are ASCII: the second byte in little-endian
+// order, and the first in big-endian order.
+static const char *detect_utf16(const uint8_t *data, size_t length) {
+  size_t pair_count = length / 2;
+  if (pair_count < 2) return nullptr;
+  size_t zero_first_count = 0, zero_second_count = 0;
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    if (data[i] == 0) zero_first_count++;
+    if (data[i + 1] == 0) zero_second_count++;
+  }
+  if (zero_second_count > pair_count / 4 && zero_first_count <= pair_count / 32) return "UTF-16LE";
+  if (zero_first_count > pair_count / 4 && zero_second_count <= pair_count / 32) return "UTF-16BE";
+  return nullptr;
+}
+
+vector<std::pair<size_t, size_t>> encoding_detection_ranges(size_t size) {
+  // The start of the file, then blocks spread evenly through the rest, or all
+  // of it if that is no larger.
+  vector<std::pair<size_t, size_t>> ranges;
+  size_t prefix_size = std::min(size, detection_prefix_size);
+  size_t remaining_size = size - prefix_size;
+  if (remaining_size <= detection_block_size * detection_block_count) {
+    ranges.push_back({0, size});
+  } else {
+    ranges.push_back({0, prefix_size});
+    size_t stride = remaining_size / detection_block_count;
+    for (size_t i = 0; i < detection_block_count; i++) {
+      ranges.push_back({prefix_size + i * stride, detection_block_size});
+    }
+  }
+  return ranges;
+}
+
+namespace {
+
+struct Sample {
+  const uint8_t *bytes;
+  size_t offset;
+  size_t length;
+};
+
+}  // namespace
+
+static const char *detect_encoding_in_samples(const vector<Sample> &samples, size_t size, bool is_complete) {
+  const uint8_t *bytes = samples.front().bytes;
+  size_t prefix_size = samples.front().length;
+
+  if (prefix_size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) return "UTF-8";
+  if (prefix_size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) return "UTF-16LE";
+  if (prefix_size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) return "UTF-16BE";
+
+  const char *utf16_encoding = detect_utf16(bytes, std::min(prefix_size, detection_block_size));
+  if (utf16_encoding) return utf16_encoding;
+
+  bool is_utf8 = true;
+  for (const auto &sample : samples) {
+    size_t start = 0, end = sample.length;
+
+    // A block may begin in the middle of a character.
+    if (sample.offset > 0) {
+      for (size_t i = 0; i < 3 && start < end && (sample.bytes[start] & 0xC0) == 0x80; i++) start++;
+    }
+
+    if (!is_valid_utf8(sample.bytes + start, end - start, sample.offset + end < size || !is_complete)) {
+      is_utf8 = false;
+      break;
+    }
+  }
+  if (is_utf8) return "UTF-8";
+
+  // Among the single-byte Western encodings, Windows-1252 puts printable
+  // characters such as curly quotes and dashes where ISO-8859-1 has control
+  // characters that text rarely contains. Bytes that Windows-1252 leaves
+  // undefined are kept as ISO-8859-1 control characters instead.
+  size_t windows_1252_score = 0;
+  for (const auto &sample : samples) {
+    for (size_t i = 0; i < sample.length; i++) {
+      uint8_t byte = sample.bytes[i];
+      if (byte < 0x80 || byte > 0x9F) continue;
+      if (byte == 0x81 || byte == 0x8D || byte == 0x8F || byte == 0x90 || byte == 0x9D) {
+        return "ISO-8859-1";
+      }
+      windows_1252_score++;
+    }
+  }
+  return windows_1252_score > 0 ? "WINDOWS-1252" : "ISO-8859-1";
+}
+
+const char *detect_encoding(const char *data, size_t size, bool is_complete) {
+  auto bytes = reinterpret_cast<const uint8_t *>(data);
+  vector<Sample> samples;
+  for (const auto &range : encoding_detection_ranges(size)) {
+    samples.push_back({bytes + range.first, range.first, range.second});
+  }
+  return detect_encoding_in_samples(samples, size, is_complete);
+}
+
+const char *detect_encoding_from_ranges(const char *data, size_t size) {
+  auto bytes = reinterpret_cast<const uint8_t *>(data);
+  vector<Sample> samples;
+  for (const auto &range : encoding_detection_ranges(size)) {
+    samples.push_back({bytes, range.first, range.second});
+    bytes += range.second;
+  }
+  return detect_encoding_in_samples(samples, size, true);
+}
@@ -4,6 +4,8 @@
 #include "optional.h"
 #include "text.h"
 #include <stdio.h>
+#include <utility>
+#include <vector>
 
 class EncodingConversion {
   void *data;
@@ -16,6 +18,7 @@ class EncodingConversion {
   EncodingConversion(EncodingConversion &&);
   EncodingConversion();
   ~EncodingConversion();
+  EncodingConversion &operator=(EncodingConversion &&);
 
   bool encode(const std::u16string &, size_t start_offset, size_t end_offset,
               FILE *stream, std::vector<char> &buffer);
@@ -25,6 +28,8 @@ class EncodingConversion {
               std::function<void(size_t)> progress_callback);
   size_t decode(std::u16string &, const char *buffer, size_t buffer_size,
                 bool is_last = false);
+  bool decode(std::u16string &, FILE *stream, std::vector<char> &buffer,
+              size_t bytes_already_read, std::function<bool(size_t)> progress_callback);
 
   friend optional<EncodingConversion> transcoding_to(const char *);
   friend optional<EncodingConversion> transcoding_from(const char *);
@@ -33,4 +38,21 @@ class EncodingConversion {
 optional<EncodingConversion> transcoding_to(const char *);
 optional<EncodingConversion> transcoding_from(const char *);
 
+// Whether the encoding name asks for the encoding to be detected, which
+// `load` and `load_async` do with `detect_encoding`.
+bool is_auto_encoding(const std::string &);
+
+// Guesses the encoding of a file from its contents. Besides a byte order
+// mark, it only examines the start of the data and blocks spread evenly
+// through the rest, so the cost is bounded for large files. `is_complete` is
+// false when the data is just a prefix of the file, so that a character cut
+// off at its end doesn't count against UTF-8.
+const char *detect_encoding(const char *data, size_t size, bool is_complete = true);
+
+// The parts of a file of `size` bytes that `detect_encoding` examines, as
+// offsets and lengths, so that a file can be sampled without reading all of
+// it. `detect_encoding_from_ranges` takes those parts read one after another.
+std::vector<std::pair<size_t, size_t>> encoding_detection_ranges(size_t size);
+const char *detect_encoding_from_ranges(const char *data, size_t size);
+
 #endif // SUPERSTRING_ENCODING_CONVERSION_H_
@@ -3,6 +3,10 @@
 
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
 
 template <typename T> class flat_set {
   typedef std::vector<T> contents_type;
@@ -19,7 +23,8 @@ public:
     }
   }
 
-  void insert(const_iterator start, const_iterator end) {
+  template <typename Iterator>
+  void insert(Iterator start, Iterator end) {
     for (auto i = start; i != end; i++) {
       insert(*i);
     }
@@ -66,4 +71,93 @@ public:
   }
 };
 
+// A sorted set that stores up to `InlineCapacity` values within itself and
+// only allocates once it grows past them. It can be copied but not assigned,
+// since it points at its own inline storage.
+template <typename T, uint32_t InlineCapacity> class small_flat_set {
+  static_assert(std::is_trivially_copyable<T>::value, "small_flat_set values are copied bytewise");
+
+  T *contents;
+  uint32_t length;
+  uint32_t capacity;
+  T inline_contents[InlineCapacity];
+
+  void grow() {
+    uint32_t new_capacity = capacity > 0 ? capacity * 2 : 4;
+    T *new_contents = static_cast<T *>(std::malloc(new_capacity * sizeof(T)));
+    std::memcpy(new_contents, contents, length * sizeof(T));
+    if (contents != inline_contents) std::free(contents);
+    contents = new_contents;
+    capacity = new_capacity;
+  }
+
+public:
+  typedef T *iterator;
+  typedef const T *const_iterator;
+
+  small_flat_set() : contents{inline_contents}, length{0}, capacity{InlineCapacity} {}
+  small_flat_set(const small_flat_set &other) : small_flat_set() {
+    if (other.length > capacity) {
+      contents = static_cast<T *>(std::malloc(other.length * sizeof(T)));
+      capacity = other.length;
+    }
+    if (other.length > 0) std::memcpy(contents, other.contents, other.length * sizeof(T));
+    length = other.length;
+  }
+
+  small_flat_set &operator=(const small_flat_set &) = delete;
+
+  ~small_flat_set() {
+    if (contents != inline_contents) std::free(contents);
+  }
+
+  void insert(T value) {
+    T *iter = std::lower_bound(begin(), end(), value);
+    if (iter == end() || *iter != value) {
+      size_t index = iter - contents;
+      if (length == capacity) grow();
+      std::memmove(contents + index + 1, contents + index, (length - index) * sizeof(T));
+      contents[index] = value;
+      length++;
+    }
+  }
+
+  template <typename Iterator>
+  void insert(Iterator start, Iterator end) {
+    for (auto i = start; i != end; i++) {
+      insert(*i);
+    }
+  }
+
+  iterator erase(iterator iter) {
+    std::memmove(iter, iter + 1, (end() - iter - 1) * sizeof(T));
+    length--;
+    return iter;
+  }
+
+  void erase(T value) {
+    T *iter = std::lower_bound(begin(), end(), value);
+    if (iter != end() && *iter == value) {
+      erase(iter);
+    }
+  }
+
+  iterator begin() { return contents; }
+  const_iterator begin() const { return contents; }
+  iterator end() { return contents + length; }
+  const_iterator end() const { return contents + length; }
+
+  size_t count(T value) const {
+    return std::binary_search(begin(), end(), value) ? 1 : 0;
+  }
+
+  size_t size() const {
+    return length;
+  }
+
+  void clear() {
+    length = 0;
+  }
+};
+
 #endif // SUPERSTRING_FLAT_SET_H
@@ -1,9 +1,12 @@
 #include "marker-index.h"
+#include <algorithm>
 #include <climits>
 #include <iterator>
+#include <new>
 #include <random>
 #include <stdlib.h>
 #include "native-range.h"
+#include "slab-allocator.h"
 
 using std::default_random_engine;
 using std::unordered_map;
@@ -13,7 +16,11 @@ MarkerIndex::Node::Node(Node *parent, NativePoint left_extent) :
   left{nullptr},
   right{nullptr},
   left_extent{left_extent},
-  priority{0} {}
+  priority{0},
+  position_generation{0},
+  epoch{0},
+  gc_mark{0},
+  retired{false} {}
 
 bool MarkerIndex::Node::is_marker_endpoint() {
   return (start_marker_ids.size() + end_marker_ids.size()) > 0;
@@ -38,14 +45,14 @@ MarkerIndex::Node *MarkerIndex::Iterator::insert_marker_start(const MarkerId &id
   reset();
 
   if (!current_node) {
-    return marker_index->root = new Node(nullptr, start_position);
+    return marker_index->root = marker_index->allocate_node(nullptr, start_position);
   }
 
   while (true) {
     switch (start_position.compare(current_node_position)) {
       case 0:
         mark_right(id, start_position, end_position);
-        return current_node;
+        return current_node = marker_index->own(current_node);
       case -1:
         mark_right(id, start_position, end_position);
         if (current_node->left) {
@@ -75,14 +82,14 @@ MarkerIndex::Node *MarkerIndex::Iterator::insert_marker_end(const MarkerId &id,
   reset();
 
   if (!current_node) {
-    return marker_index->root = new Node(nullptr, end_position);
+    return marker_index->root = marker_index->allocate_node(nullptr, end_position);
   }
 
   while (true) {
     switch (end_position.compare(current_node_position)) {
       case 0:
         mark_left(id, start_position, end_position);
-        return current_node;
+        return current_node = marker_index->own(current_node);
       case -1:
         if (current_node->left) {
           descend_left();
@@ -114,7 +121,7 @@ MarkerIndex::Node *MarkerIndex::Iterator::insert_splice_boundary(const NativePoi
   while (true) {
     int comparison = position.compare(current_node_position);
     if (comparison == 0 && !is_insertion_end) {
-      return current_node;
+      return current_node = marker_index->own(current_node);
     } else if (comparison < 0) {
       if (current_node->left) {
         descend_left();
@@ -210,65 +217,6 @@ void MarkerIndex::Iterator::find_ending_in(const NativePoint &start, const Nativ
   }
 }
 
-void MarkerIndex::Iterator::find_boundaries_after(NativePoint start, size_t max_count, MarkerIndex::BoundaryQueryResult *result) {
-  reset();
-  if (!current_node) return;
-
-  while (true) {
-    cache_node_position();
-
-    if (start <= current_node_position) {
-      if (left_ancestor_position < start) {
-        result->containing_start.insert(
-          result->containing_start.end(),
-          current_node->left_marker_ids.begin(),
-          current_node->left_marker_ids.end()
-        );
-      }
-
-      if (current_node->left) {
-        descend_left();
-      } else {
-        break;
-      }
-    } else {
-      if (right_ancestor_position >= start) {
-        result->containing_start.insert(
-          result->containing_start.end(),
-          current_node->right_marker_ids.begin(),
-          current_node->right_marker_ids.end()
-        );
-      }
-
-      if (current_node->right) {
-        descend_right();
-      } else {
-        break;
-      }
-    }
-  }
-  std::sort(
-    result->containing_start.begin(),
-    result->containing_start.end(),
-    [this](MarkerId a, MarkerId b) {
-      int comparison = marker_index->compare(a, b);
-      return comparison == 0 ? a < b : comparison == -1;
-    }
-  );
-
-  if (current_node_position < start) move_to_successor();
-  while (current_node && max_count > 0) {
-    cache_node_position();
-    result->boundaries.push_back({
-      current_node_position,
-      current_node->start_marker_ids,
-      current_node->end_marker_ids
-    });
-    move_to_successor();
-    max_count--;
-  }
-}
-
 unordered_map<MarkerIndex::MarkerId, NativeRange> MarkerIndex::Iterator::dump() {
   reset();
 
@@ -380,22 +328,26 @@ void MarkerIndex::Iterator::mark_right(const MarkerId &id, const NativePoint &st
   if (left_ancestor_position < start_position
     && start_position <= current_node_position
     && right_ancestor_position <= end_position) {
+    current_node = marker_index->own(current_node);
     current_node->right_marker_ids.insert(id);
   }
 }
 
 void MarkerIndex::Iterator::mark_left(const MarkerId &id, const NativePoint &start_position, const NativePoint &end_position) {
   if (!current_node_position.is_zero() && start_position <= left_ancestor_position && current_node_position <= end_position) {
+    current_node = marker_index->own(current_node);
     current_node->left_marker_ids.insert(id);
   }
 }
 
 MarkerIndex::Node *MarkerIndex::Iterator::insert_left_child(const NativePoint &position) {
-  return current_node->left = new Node(current_node, position.traversal(left_ancestor_position));
+  current_node = marker_index->own(current_node);
+  return current_node->left = marker_index->allocate_node(current_node, position.traversal(left_ancestor_position));
 }
 
 MarkerIndex::Node *MarkerIndex::Iterator::insert_right_child(const NativePoint &position) {
-  return current_node->right = new Node(current_node, position.traversal(current_node_position));
+  current_node = marker_index->own(current_node);
+  return current_node->right = marker_index->allocate_node(current_node, position.traversal(current_node_position));
 }
 
 void MarkerIndex::Iterator::check_intersection(const NativePoint &start, const NativePoint &end, MarkerIdSet *result) {
@@ -414,17 +366,253 @@ void MarkerIndex::Iterator::check_intersection(const NativePoint &start, const N
 }
 
 void MarkerIndex::Iterator::cache_node_position() const {
-  marker_index->node_position_cache.insert({current_node, current_node_position});
+  if (current_node) marker_index->cache_node_position(current_node, current_node_position);
+}
+
+MarkerIndex::BoundaryCursor::BoundaryCursor(const MarkerIndex *marker_index) :
+  marker_index{marker_index},
+  node{nullptr} {}
+
+// Descends from the root like `Iterator`, but tracks only the nearest
+// ancestors' positions, so that no stack is needed.
+void MarkerIndex::BoundaryCursor::seek(NativePoint position, std::vector<MarkerId> *containing) {
+  size_t containing_begin = containing ? containing->size() : 0;
+  NativePoint left_ancestor_position;
+  NativePoint right_ancestor_position(UINT32_MAX, UINT32_MAX);
+  const Node *current_node = marker_index->root;
+  node = nullptr;
+
+  while (current_node) {
+    NativePoint current_node_position = left_ancestor_position.traverse(current_node->left_extent);
+    marker_index->cache_node_position(current_node, current_node_position);
+
+    if (position <= current_node_position) {
+      if (containing && left_ancestor_position < position) {
+        containing->insert(containing->end(), current_node->left_marker_ids.begin(), current_node->left_marker_ids.end());
+      }
+      node = current_node;
+      node_position = current_node_position;
+      right_ancestor_position = current_node_position;
+      current_node = current_node->left;
+    } else {
+      if (containing && right_ancestor_position >= position) {
+        containing->insert(containing->end(), current_node->right_marker_ids.begin(), current_node->right_marker_ids.end());
+      }
+      left_ancestor_position = current_node_position;
+      current_node = current_node->right;
+    }
+  }
+
+  if (containing) {
+    const MarkerIndex *index = marker_index;
+    std::sort(
+      containing->begin() + containing_begin,
+      containing->end(),
+      [index](MarkerId a, MarkerId b) {
+        int comparison = index->compare(a, b);
+        return comparison == 0 ? a < b : comparison == -1;
+      }
+    );
+  }
+}
+
+// Every node on the way down to the successor has the current node as its
+// left ancestor, so its position follows from the current position. Going
+// up, positions come from the cache, which the way down has filled.
+void MarkerIndex::BoundaryCursor::advance() {
+  if (!node) return;
+
+  if (node->right) {
+    NativePoint left_ancestor_position = node_position;
+    node = node->right;
+    while (true) {
+      node_position = left_ancestor_position.traverse(node->left_extent);
+      marker_index->cache_node_position(node, node_position);
+      if (!node->left) break;
+      node = node->left;
+    }
+  } else {
+    while (node->parent && node->parent->right == node) {
+      node = node->parent;
+    }
+    node = node->parent;
+    if (node) node_position = marker_index->get_node_position(node);
+  }
+}
+
+MarkerIndex::MarkerIdSpan MarkerIndex::BoundaryCursor::starting() const {
+  return MarkerIdSpan{node->start_marker_ids.begin(), node->start_marker_ids.end()};
+}
+
+MarkerIndex::MarkerIdSpan MarkerIndex::BoundaryCursor::ending() const {
+  return MarkerIdSpan{node->end_marker_ids.begin(), node->end_marker_ids.end()};
+}
+
+// Nodes are never returned to the heap until the node store is destroyed.
+struct MarkerIndex::NodeAllocator : slab_allocator<MarkerIndex::Node, 2, 16, 4096> {};
+
+// Owns the nodes of an index and of its snapshots, which keep it alive
+// after the index is destroyed. Nodes that leave the index's tree while
+// snapshots may still share them are retired, and freed by `collect_garbage`
+// once no snapshot reaches them.
+struct MarkerIndex::NodeStore {
+  NodeAllocator allocator;
+  std::vector<Node *> retired_nodes;
+  std::vector<std::weak_ptr<SnapshotState>> snapshots;
+  uint32_t epoch = 1;
+  uint32_t gc_mark = 0;
+  size_t gc_threshold = 1024;
+  size_t snapshot_prune_threshold = 64;
+
+  ~NodeStore() {
+    for (Node *node : retired_nodes) node->~Node();
+  }
+
+  void free_node(Node *node) {
+    node->~Node();
+    allocator.free(node);
+  }
+
+  void retire(Node *node) {
+    if (!node->retired) {
+      node->retired = true;
+      retired_nodes.push_back(node);
+    }
+  }
+
+  void prune_snapshots() {
+    auto live_end = std::remove_if(snapshots.begin(), snapshots.end(), [](const std::weak_ptr<SnapshotState> &snapshot) {
+      return snapshot.expired();
+    });
+    snapshots.erase(live_end, snapshots.end());
+    snapshot_prune_threshold = std::max<size_t>(64, 2 * snapshots.size());
+  }
+};
+
+struct MarkerIndex::SnapshotState {
+  std::shared_ptr<NodeStore> node_store;
+  Node *root;
+  size_t marker_count;
+  flat_set<MarkerId> exclusive_marker_ids;
+};
+
+MarkerIndex::Node *MarkerIndex::allocate_node(Node *parent, NativePoint left_extent) {
+  Node *node = new (node_store->allocator.allocate()) Node(parent, left_extent);
+  node->epoch = node_store->epoch;
+  return node;
+}
+
+// Returns a version of the node that may be changed in place, copying it and
+// its ancestors if a snapshot may share them. The ancestors of a node that
+// belongs to the current epoch always do too.
+MarkerIndex::Node *MarkerIndex::own(Node *node) {
+  if (node->epoch == node_store->epoch) return node;
+
+  Node *parent = node->parent ? own(node->parent) : nullptr;
+  Node *copy = new (node_store->allocator.allocate()) Node(*node);
+  copy->epoch = node_store->epoch;
+  copy->retired = false;
+
+  if (parent) {
+    if (parent->left == node) {
+      parent->left = copy;
+    } else {
+      parent->right = copy;
+    }
+  } else {
+    root = copy;
+  }
+  if (copy->left) copy->left->parent = copy;
+  if (copy->right) copy->right->parent = copy;
+  for (MarkerId id : copy->start_marker_ids) start_nodes_by_id[id] = copy;
+  for (MarkerId id : copy->end_marker_ids) end_nodes_by_id[id] = copy;
+
+  node_store->retire(node);
+  return copy;
+}
+
+void MarkerIndex::discard_node(Node *node) {
+  if (node->epoch == node_store->epoch) {
+    node_store->free_node(node);
+  } else {
+    node_store->retire(node);
+  }
+}
+
+void MarkerIndex::discard_subtree(Node *node) {
+  if (node->left) discard_subtree(node->left);
+  if (node->right) discard_subtree(node->right);
+  discard_node(node);
+}
+
+void MarkerIndex::mark_subtree(Node *node, uint32_t mark) {
+  while (node && node->gc_mark != mark) {
+    node->gc_mark = mark;
+    mark_subtree(node->left, mark);
+    node = node->right;
+  }
+}
+
+// Frees the retired nodes that neither the tree nor any live snapshot
+// reaches. It runs once as many nodes have been retired as the tree and the
+// surviving retired nodes hold, so its cost is amortized over the copies.
+void MarkerIndex::collect_garbage() {
+  NodeStore &store = *node_store;
+  if (++store.gc_mark == 0) {
+    for (Node *node : store.retired_nodes) node->gc_mark = 0;
+    if (root) reset_node_stamps(root);
+    store.gc_mark = 1;
+  }
+
+  mark_subtree(root, store.gc_mark);
+  store.prune_snapshots();
+  for (const auto &snapshot : store.snapshots) {
+    if (auto state = snapshot.lock()) mark_subtree(state->root, store.gc_mark);
+  }
+
+  auto retained_end = std::remove_if(store.retired_nodes.begin(), store.retired_nodes.end(), [&store](Node *node) {
+    if (node->gc_mark == store.gc_mark) return false;
+    store.free_node(node);
+    return true;
+  });
+  store.retired_nodes.erase(retained_end, store.retired_nodes.end());
+
+  store.gc_threshold = std::max<size_t>(1024, 2 * store.retired_nodes.size() + 2 * start_nodes_by_id.size());
+}
+
+// Gives the nodes of a snapshot's tree to the index, which must copy them
+// before changing them since other snapshots may still share them.
+void MarkerIndex::adopt_subtree(Node *node, Node *parent) {
+  node->parent = parent;
+  node->epoch = 0;
+  node->position_generation = 0;
+  for (MarkerId id : node->start_marker_ids) start_nodes_by_id[id] = node;
+  for (MarkerId id : node->end_marker_ids) end_nodes_by_id[id] = node;
+  if (node->left) adopt_subtree(node->left, node);
+  if (node->right) adopt_subtree(node->right, node);
+}
+
+void MarkerIndex::dump_subtree(const Node *node, NativePoint left_ancestor_position, unordered_map<MarkerId, NativeRange> *result) {
+  while (node) {
+    NativePoint position = left_ancestor_position.traverse(node->left_extent);
+    for (MarkerId id : node->start_marker_ids) (*result)[id].start = position;
+    for (MarkerId id : node->end_marker_ids) (*result)[id].end = position;
+    dump_subtree(node->left, left_ancestor_position, result);
+    left_ancestor_position = position;
+    node = node->right;
+  }
 }
 
 MarkerIndex::MarkerIndex(unsigned seed)
   : random_engine{static_cast<default_random_engine::result_type>(seed)},
     random_distribution{1, INT_MAX - 1},
     root{nullptr},
-    iterator{this} {}
+    iterator{this},
+    node_store{new NodeStore()},
+    position_generation{1} {}
 
 MarkerIndex::~MarkerIndex() {
-  if (root) delete_subtree(root);
+  if (root) discard_subtree(root);
 }
 
 int MarkerIndex::generate_random_number() {
@@ -435,8 +623,8 @@ void MarkerIndex::insert(MarkerId id, NativePoint start, NativePoint end) {
   Node *start_node = iterator.insert_marker_start(id, start, end);
   Node *end_node = iterator.insert_marker_end(id, start, end);
 
-  node_position_cache.insert({start_node, start});
-  node_position_cache.insert({end_node, end});
+  cache_node_position(start_node, start);
+  cache_node_position(end_node, end);
 
   start_node->start_marker_ids.insert(id);
   end_node->end_marker_ids.insert(id);
@@ -455,6 +643,114 @@ void MarkerIndex::insert(MarkerId id, NativePoint start, NativePoint end) {
   end_nodes_by_id.insert({id, end_node});
 }
 
+// Inserts many markers at once. When the batch is at least as large as the
+// index, the tree is rebuilt balanced from the sorted endpoints of the old and
+// new markers, so that no marker needs rotations or new nodes of its own.
+// Smaller batches are not merged into the existing tree as a subtree; they
+// are inserted one at a time, at the cost of a search and rotations each.
+// The markers may be given in any order.
+void MarkerIndex::insert_batch(const std::vector<std::pair<MarkerId, NativeRange>> &markers) {
+  if (markers.empty()) return;
+
+  if (root && markers.size() < start_nodes_by_id.size()) {
+    for (const auto &marker : markers) {
+      insert(marker.first, marker.second.start, marker.second.end);
+    }
+    return;
+  }
+
+  std::vector<std::pair<MarkerId, NativeRange>> all_markers;
+  all_markers.reserve(start_nodes_by_id.size() + markers.size());
+  if (root) {
+    for (const auto &entry : iterator.dump()) all_markers.push_back(entry);
+    discard_subtree(root);
+    root = nullptr;
+    start_nodes_by_id.clear();
+    end_nodes_by_id.clear();
+  }
+  all_markers.insert(all_markers.end(), markers.begin(), markers.end());
+
+  // Visiting markers in id order keeps every insertion into the nodes' id
+  // sets an append.
+  auto compare_ids = [](
+    const std::pair<MarkerId, NativeRange> &a,
+    const std::pair<MarkerId, NativeRange> &b
+  ) {
+    return a.first < b.first;
+  };
+  if (!std::is_sorted(all_markers.begin(), all_markers.end(), compare_ids)) {
+    std::sort(all_markers.begin(), all_markers.end(), compare_ids);
+  }
+
+  // Markers usually arrive ordered, as search results do, in which case the
+  // endpoints only need merging.
+  std::vector<NativePoint> starts, ends, positions;
+  starts.reserve(all_markers.size());
+  ends.reserve(all_markers.size());
+  for (const auto &marker : all_markers) {
+    starts.push_back(marker.second.start);
+    ends.push_back(marker.second.end);
+  }
+  if (!std::is_sorted(starts.begin(), starts.end())) std::sort(starts.begin(), starts.end());
+  if (!std::is_sorted(ends.begin(), ends.end())) std::sort(ends.begin(), ends.end());
+  positions.resize(all_markers.size() * 2);
+  std::merge(starts.begin(), starts.end(), ends.begin(), ends.end(), positions.begin());
+  positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+  // Nodes get random priorities from bands that rise with depth, so that the
+  // balanced tree is already a valid treap.
+  int height = 1;
+  while ((size_t(1) << height) <= positions.size()) height++;
+  int priority_band = (INT_MAX - 2) / height;
+
+  std::vector<Node *> nodes(positions.size());
+  root = build_subtree(positions, 0, positions.size(), 0, priority_band, &nodes);
+
+  start_nodes_by_id.reserve(all_markers.size());
+  end_nodes_by_id.reserve(all_markers.size());
+
+  // In a tree built by halving ranges of `positions`, the subtree holding
+  // positions[begin, end) has positions[begin - 1] as its left ancestor and
+  // positions[end] as its right ancestor. This lets us mark the same nodes as
+  // `Iterator::mark_right` and `Iterator::mark_left` without a full descent.
+  const NativePoint max_position(UINT32_MAX, UINT32_MAX);
+  for (const auto &marker : all_markers) {
+    MarkerId id = marker.first;
+    const NativePoint &start = marker.second.start;
+    const NativePoint &end = marker.second.end;
+    size_t start_index = std::lower_bound(positions.begin(), positions.end(), start) - positions.begin();
+    size_t end_index = std::lower_bound(positions.begin() + start_index, positions.end(), end) - positions.begin();
+
+    size_t begin_index = 0, end_bound = positions.size();
+    while (true) {
+      size_t middle = begin_index + (end_bound - begin_index) / 2;
+      const NativePoint &left_ancestor = begin_index > 0 ? positions[begin_index - 1] : NativePoint();
+      const NativePoint &right_ancestor = end_bound < positions.size() ? positions[end_bound] : max_position;
+      if (left_ancestor < start && start <= positions[middle] && right_ancestor <= end) {
+        nodes[middle]->right_marker_ids.insert(id);
+      }
+      if (middle == start_index) break;
+      if (start_index < middle) end_bound = middle; else begin_index = middle + 1;
+    }
+
+    begin_index = 0, end_bound = positions.size();
+    while (true) {
+      size_t middle = begin_index + (end_bound - begin_index) / 2;
+      const NativePoint &left_ancestor = begin_index > 0 ? positions[begin_index - 1] : NativePoint();
+      if (!positions[middle].is_zero() && start <= left_ancestor && positions[middle] <= end) {
+        nodes[middle]->left_marker_ids.insert(id);
+      }
+      if (middle == end_index) break;
+      if (end_index < middle) end_bound = middle; else begin_index = middle + 1;
+    }
+
+    nodes[start_index]->start_marker_ids.insert(id);
+    nodes[end_index]->end_marker_ids.insert(id);
+    start_nodes_by_id.insert({id, nodes[start_index]});
+    end_nodes_by_id.insert({id, nodes[end_index]});
+  }
+}
+
 void MarkerIndex::set_exclusive(MarkerId id, bool exclusive) {
   if (exclusive) {
     exclusive_marker_ids.insert(id);
@@ -464,8 +760,9 @@ void MarkerIndex::set_exclusive(MarkerId id, bool exclusive) {
 }
 
 void MarkerIndex::remove(MarkerId id) {
-  Node *start_node = start_nodes_by_id.find(id)->second;
-  Node *end_node = end_nodes_by_id.find(id)->second;
+  // Owning the start node may copy the end node, so it is looked up after.
+  Node *start_node = own(start_nodes_by_id.find(id)->second);
+  Node *end_node = own(end_nodes_by_id.find(id)->second);
 
   Node *node = start_node;
   while (node) {
@@ -499,7 +796,7 @@ bool MarkerIndex::has(MarkerId id) {
 }
 
 MarkerIndex::SpliceResult MarkerIndex::splice(NativePoint start, NativePoint old_extent, NativePoint new_extent) {
-  node_position_cache.clear();
+  invalidate_node_positions();
 
   SpliceResult invalidated;
 
@@ -581,7 +878,7 @@ MarkerIndex::SpliceResult MarkerIndex::splice(NativePoint start, NativePoint old
   populate_splice_invalidation_sets(&invalidated, start_node, end_node, starting_inside_splice, ending_inside_splice);
 
   if (start_node->right) {
-    delete_subtree(start_node->right);
+    discard_subtree(start_node->right);
     start_node->right = nullptr;
   }
 
@@ -620,6 +917,118 @@ MarkerIndex::SpliceResult MarkerIndex::splice(NativePoint start, NativePoint old
   return invalidated;
 }
 
+bool MarkerIndex::splice_batch(const std::vector<Splice> &all_splices) {
+  for (size_t i = 1; i < all_splices.size(); i++) {
+    const Splice &previous = all_splices[i - 1];
+    if (all_splices[i].start < previous.start.traverse(previous.old_extent)) return false;
+  }
+
+  std::vector<Splice> splices;
+  splices.reserve(all_splices.size());
+  for (const Splice &splice : all_splices) {
+    if (!splice.old_extent.is_zero() || !splice.new_extent.is_zero()) splices.push_back(splice);
+  }
+  if (!root || splices.empty()) return true;
+
+  // A few splices are cheaper to make one at a time than rebuilding the tree.
+  if (splices.size() * 32 < start_nodes_by_id.size()) {
+    for (auto splice = splices.rbegin(); splice != splices.rend(); ++splice) {
+      this->splice(splice->start, splice->old_extent, splice->new_extent);
+    }
+    return true;
+  }
+
+  // Where the start and end of each splice end up once all of them are made.
+  size_t splice_count = splices.size();
+  std::vector<NativePoint> old_ends(splice_count), new_starts(splice_count), new_ends(splice_count);
+  NativePoint previous_old_end, previous_new_end;
+  for (size_t i = 0; i < splice_count; i++) {
+    old_ends[i] = splices[i].start.traverse(splices[i].old_extent);
+    new_starts[i] = previous_new_end.traverse(splices[i].start.traversal(previous_old_end));
+    new_ends[i] = new_starts[i].traverse(splices[i].new_extent);
+    previous_old_end = old_ends[i];
+    previous_new_end = new_ends[i];
+  }
+
+  // An endpoint is either still at its original position, or was left at the
+  // start of a splice or moved to its end. Once moved past a splice that
+  // inserted text, it is out of reach of the splices before it.
+  struct Endpoint {
+    NativePoint position;
+    int64_t splice;
+    bool at_end;
+  };
+  auto position_before = [&](const Endpoint &endpoint) {
+    return endpoint.splice < 0 ? endpoint.position : splices[endpoint.splice].start;
+  };
+  auto is_touched_by = [&](const Endpoint &endpoint, size_t i) {
+    if (endpoint.splice >= 0 && endpoint.at_end && !splices[endpoint.splice].new_extent.is_zero()) return false;
+    NativePoint position = position_before(endpoint);
+    return splices[i].start <= position && position <= old_ends[i];
+  };
+  auto last_splice_starting_at_or_before = [&](NativePoint position) -> int64_t {
+    auto splice = std::upper_bound(splices.begin(), splices.end(), position, [](NativePoint position, const Splice &splice) {
+      return position < splice.start;
+    });
+    return static_cast<int64_t>(splice - splices.begin()) - 1;
+  };
+  auto final_position = [&](const Endpoint &endpoint) {
+    if (endpoint.splice >= 0) return endpoint.at_end ? new_ends[endpoint.splice] : new_starts[endpoint.splice];
+    auto old_end = std::lower_bound(old_ends.begin(), old_ends.end(), endpoint.position);
+    if (old_end == old_ends.begin()) return endpoint.position;
+    size_t i = old_end - old_ends.begin() - 1;
+    return new_ends[i].traverse(endpoint.position.traversal(old_ends[i]));
+  };
+
+  std::vector<std::pair<MarkerId, NativeRange>> markers;
+  markers.reserve(start_nodes_by_id.size());
+  for (const auto &marker : iterator.dump()) {
+    bool exclusive = exclusive_marker_ids.count(marker.first) > 0;
+    Endpoint start{marker.second.start, -1, false};
+    Endpoint end{marker.second.end, -1, false};
+
+    // These are the rules of `splice`, for the splices that reach either
+    // endpoint. Splices strictly between the endpoints only shift the end.
+    int64_t i = last_splice_starting_at_or_before(end.position);
+    while (i >= 0) {
+      bool start_is_touched = is_touched_by(start, i);
+      bool end_is_touched = is_touched_by(end, i);
+      if (!start_is_touched && !end_is_touched) {
+        if (start.splice >= 0 || old_ends[i] < start.position) break;
+        i = std::min(i - 1, last_splice_starting_at_or_before(start.position));
+        continue;
+      }
+
+      const Splice &splice = splices[i];
+      bool start_is_at_splice_start = start_is_touched && position_before(start) == splice.start;
+      bool end_is_at_splice_start = end_is_touched && position_before(end) == splice.start;
+      Endpoint new_start = start, new_end = end;
+      if (splice.old_extent.is_zero()) {
+        if (start_is_touched) new_start = Endpoint{splice.start, i, exclusive};
+        if (end_is_touched) new_end = Endpoint{splice.start, i, !exclusive || start_is_at_splice_start};
+      } else {
+        if (start_is_touched) {
+          new_start = Endpoint{splice.start, i, !start_is_at_splice_start || (exclusive && !end_is_at_splice_start)};
+        }
+        if (end_is_touched) new_end = Endpoint{splice.start, i, !end_is_at_splice_start};
+      }
+      start = new_start;
+      end = new_end;
+      i--;
+    }
+
+    markers.push_back({marker.first, NativeRange{final_position(start), final_position(end)}});
+  }
+
+  discard_subtree(root);
+  root = nullptr;
+  start_nodes_by_id.clear();
+  end_nodes_by_id.clear();
+  invalidate_node_positions();
+  insert_batch(markers);
+  return true;
+}
+
 NativePoint MarkerIndex::get_start(MarkerId id) const {
   auto result = start_nodes_by_id.find(id);
   if (result == start_nodes_by_id.end())
@@ -703,35 +1112,159 @@ flat_set<MarkerIndex::MarkerId> MarkerIndex::find_ending_at(NativePoint position
 
 MarkerIndex::BoundaryQueryResult MarkerIndex::find_boundaries_after(NativePoint start, size_t max_count) {
   BoundaryQueryResult result;
-  iterator.find_boundaries_after(start, max_count, &result);
+  BoundaryCursor cursor(this);
+  cursor.seek(start, &result.containing_start);
+  for (; !cursor.at_end() && max_count > 0; cursor.advance(), max_count--) {
+    result.boundaries.push_back({cursor.position(), {}, {}});
+    Boundary &boundary = result.boundaries.back();
+    MarkerIdSpan starting = cursor.starting(), ending = cursor.ending();
+    boundary.starting.insert(starting.begin(), starting.end());
+    boundary.ending.insert(ending.begin(), ending.end());
+  }
   return result;
 }
 
+MarkerIndex::BoundaryCursor MarkerIndex::boundary_cursor(NativePoint start) {
+  BoundaryCursor cursor(this);
+  cursor.seek(start);
+  return cursor;
+}
+
 unordered_map<MarkerIndex::MarkerId, NativeRange> MarkerIndex::dump() {
   return iterator.dump();
 }
 
-NativePoint MarkerIndex::get_node_position(const Node *node) const {
-  auto cache_entry = node_position_cache.find(node);
-  if (cache_entry == node_position_cache.end()) {
-    NativePoint position = node->left_extent;
-    const Node *current_node = node;
-    while (current_node->parent) {
-      if (current_node->parent->right == current_node) {
-        position = current_node->parent->left_extent.traverse(position);
-      }
+MarkerIndex::Snapshot MarkerIndex::create_snapshot() {
+  NodeStore &store = *node_store;
+  if (store.retired_nodes.size() >= store.gc_threshold) {
+    collect_garbage();
+  } else if (store.snapshots.size() >= store.snapshot_prune_threshold) {
+    store.prune_snapshots();
+  }
 
-      current_node = current_node->parent;
+  auto state = std::make_shared<SnapshotState>();
+  state->node_store = node_store;
+  state->root = root;
+  state->marker_count = start_nodes_by_id.size();
+  state->exclusive_marker_ids = exclusive_marker_ids;
+  store.snapshots.push_back(state);
+
+  // Every node now belongs to an earlier epoch, so it is copied before it
+  // is next changed.
+  if (++store.epoch == 0) {
+    if (root) adopt_subtree(root, nullptr);
+    store.epoch = 1;
+  }
+
+  Snapshot snapshot;
+  snapshot.state = std::move(state);
+  return snapshot;
+}
+
+// Makes the index hold the markers of the given snapshot. The snapshot's
+// tree is reused when it came from this index, and rebuilt otherwise; either
+// way this takes time linear in the number of markers.
+void MarkerIndex::restore_snapshot(const Snapshot &snapshot) {
+  const SnapshotState *state = snapshot.state.get();
+  bool shares_nodes = state && state->node_store == node_store;
+
+  std::vector<std::pair<MarkerId, NativeRange>> markers;
+  if (state && !shares_nodes) {
+    auto ranges = snapshot.dump();
+    markers.assign(ranges.begin(), ranges.end());
+  }
+
+  if (root) discard_subtree(root);
+  root = nullptr;
+  start_nodes_by_id.clear();
+  end_nodes_by_id.clear();
+  exclusive_marker_ids = state ? state->exclusive_marker_ids : flat_set<MarkerId>();
+  invalidate_node_positions();
+
+  if (shares_nodes) {
+    root = state->root;
+    if (root) {
+      start_nodes_by_id.reserve(state->marker_count);
+      end_nodes_by_id.reserve(state->marker_count);
+      adopt_subtree(root, nullptr);
     }
-    node_position_cache.insert({node, position});
-    return position;
   } else {
-    return cache_entry->second;
+    insert_batch(markers);
+  }
+}
+
+size_t MarkerIndex::Snapshot::size() const {
+  return state ? state->marker_count : 0;
+}
+
+unordered_map<MarkerIndex::MarkerId, NativeRange> MarkerIndex::Snapshot::dump() const {
+  unordered_map<MarkerId, NativeRange> result;
+  if (state) {
+    result.reserve(state->marker_count);
+    dump_subtree(state->root, NativePoint(), &result);
+  }
+  return result;
+}
+
+NativePoint MarkerIndex::get_node_position(const Node *node) const {
+  if (node->position_generation == position_generation) {
+    return node->cached_position;
+  }
+
+  NativePoint position = node->left_extent;
+  const Node *current_node = node;
+  while (current_node->parent) {
+    if (current_node->parent->right == current_node) {
+      position = current_node->parent->left_extent.traverse(position);
+    }
+
+    current_node = current_node->parent;
   }
+  cache_node_position(node, position);
+  return position;
+}
+
+void MarkerIndex::invalidate_node_positions() {
+  if (++position_generation == 0) {
+    // Nodes stamped before the counter wrapped must not look current.
+    if (root) reset_node_stamps(root);
+    position_generation = 1;
+  }
+}
+
+void MarkerIndex::cache_node_position(const Node *node, NativePoint position) const {
+  node->cached_position = position;
+  node->position_generation = position_generation;
+}
+
+// Clears the stamps that would look current once their counter wraps.
+void MarkerIndex::reset_node_stamps(Node *node) {
+  node->gc_mark = 0;
+  node->position_generation = 0;
+  if (node->left) reset_node_stamps(node->left);
+  if (node->right) reset_node_stamps(node->right);
+}
+
+// Builds a balanced subtree over positions[begin, end), allocating its nodes
+// in position order so that neighbors stay close in memory.
+MarkerIndex::Node *MarkerIndex::build_subtree(const std::vector<NativePoint> &positions, size_t begin, size_t end, int depth, int priority_band, std::vector<Node *> *nodes) {
+  if (begin == end) return nullptr;
+  size_t middle = begin + (end - begin) / 2;
+  NativePoint left_ancestor_position = begin > 0 ? positions[begin - 1] : NativePoint();
+  Node *left = build_subtree(positions, begin, middle, depth + 1, priority_band, nodes);
+  Node *node = allocate_node(nullptr, positions[middle].traversal(left_ancestor_position));
+  Node *right = build_subtree(positions, middle + 1, end, depth + 1, priority_band, nodes);
+  node->priority = 1 + depth * priority_band + generate_random_number() % priority_band;
+  node->left = left;
+  node->right = right;
+  if (left) left->parent = node;
+  if (right) right->parent = node;
+  cache_node_position(node, positions[middle]);
+  (*nodes)[middle] = node;
+  return node;
 }
 
 void MarkerIndex::delete_node(Node *node) {
-  node_position_cache.erase(node);
   node->priority = INT_MAX;
 
   bubble_node_down(node);
@@ -746,13 +1279,7 @@ void MarkerIndex::delete_node(Node *node) {
     root = nullptr;
   }
 
-  delete node;
-}
-
-void MarkerIndex::delete_subtree(Node *node) {
-  if (node->left) delete_subtree(node->left);
-  if (node->right) delete_subtree(node->right);
-  delete node;
+  discard_node(node);
 }
 
 void MarkerIndex::bubble_node_up(Node *node) {
@@ -771,9 +1298,9 @@ void MarkerIndex::bubble_node_down(Node *node) {
     int right_child_priority = (node->right) ? node->right->priority : INT_MAX;
 
     if (left_child_priority < right_child_priority && left_child_priority < node->priority) {
-      rotate_node_right(node->left);
+      rotate_node_right(own(node->left));
     } else if (right_child_priority < node->priority) {
-      rotate_node_left(node->right);
+      rotate_node_left(own(node->right));
     } else {
       break;
     }
@@ -1,8 +1,11 @@
 #ifndef MARKER_INDEX_H_
 #define MARKER_INDEX_H_
 
+#include <memory>
 #include <random>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "flat_set.h"
 #include "native-point.h"
 #include "native-range.h"
@@ -19,6 +22,12 @@ public:
     flat_set<MarkerId> surround;
   };
 
+  struct Splice {
+    NativePoint start;
+    NativePoint old_extent;
+    NativePoint new_extent;
+  };
+
   struct Boundary {
     NativePoint position;
     flat_set<MarkerId> starting;
@@ -30,14 +39,34 @@ public:
     std::vector<Boundary> boundaries;
   };
 
+  // A view of the ids stored in the index, valid until the index changes.
+  struct MarkerIdSpan {
+    const MarkerId *first;
+    const MarkerId *last;
+
+    const MarkerId *begin() const { return first; }
+    const MarkerId *end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+  };
+
+  class BoundaryCursor;
+  class Snapshot;
+
   MarkerIndex(unsigned seed = 0u);
   ~MarkerIndex();
   int generate_random_number();
   void insert(MarkerId id, NativePoint start, NativePoint end);
+  void insert_batch(const std::vector<std::pair<MarkerId, NativeRange>> &markers);
   void set_exclusive(MarkerId id, bool exclusive);
   void remove(MarkerId id);
   bool has(MarkerId id);
   SpliceResult splice(NativePoint start, NativePoint old_extent, NativePoint new_extent);
+  // Moves the markers as if the splices were applied one at a time from last
+  // to first. The splices must be sorted, must not overlap, and must all
+  // refer to positions from before any of them; otherwise no marker is moved
+  // and false is returned.
+  bool splice_batch(const std::vector<Splice> &splices);
   NativePoint get_start(MarkerId id) const;
   NativePoint get_end(MarkerId id) const;
   NativeRange get_range(MarkerId id) const;
@@ -51,23 +80,43 @@ public:
   flat_set<MarkerId> find_ending_in(NativePoint start, NativePoint end);
   flat_set<MarkerId> find_ending_at(NativePoint position);
   BoundaryQueryResult find_boundaries_after(NativePoint start, size_t max_count);
+  BoundaryCursor boundary_cursor(NativePoint start);
 
   std::unordered_map<MarkerId, NativeRange> dump();
 
+  Snapshot create_snapshot();
+  void restore_snapshot(const Snapshot &snapshot);
+
 private:
   friend class Iterator;
+  friend class BoundaryCursor;
+  friend class Snapshot;
+
+  using NodeMarkerIdSet = small_flat_set<MarkerId, 2>;
 
   struct Node {
     Node *parent;
     Node *left;
     Node *right;
     NativePoint left_extent;
-    flat_set<MarkerId> left_marker_ids;
-    flat_set<MarkerId> right_marker_ids;
-    flat_set<MarkerId> start_marker_ids;
-    flat_set<MarkerId> end_marker_ids;
     int priority;
 
+    // The node's absolute position, valid while `position_generation`
+    // matches the index's.
+    mutable NativePoint cached_position;
+    mutable uint32_t position_generation;
+
+    // Nodes from an earlier epoch may be shared with snapshots, and are
+    // copied before being changed.
+    uint32_t epoch;
+    uint32_t gc_mark;
+    bool retired;
+
+    NodeMarkerIdSet left_marker_ids;
+    NodeMarkerIdSet right_marker_ids;
+    NodeMarkerIdSet start_marker_ids;
+    NodeMarkerIdSet end_marker_ids;
+
     Node(Node *parent, NativePoint left_extent);
     bool is_marker_endpoint();
   };
@@ -83,7 +132,6 @@ private:
     void find_contained_in(const NativePoint &start, const NativePoint &end, flat_set<MarkerId> *result);
     void find_starting_in(const NativePoint &start, const NativePoint &end, flat_set<MarkerId> *result);
     void find_ending_in(const NativePoint &start, const NativePoint &end, flat_set<MarkerId> *result);
-    void find_boundaries_after(NativePoint start, size_t max_count, BoundaryQueryResult *result);
     std::unordered_map<MarkerId, NativeRange> dump();
 
   private:
@@ -108,9 +156,24 @@ private:
     std::vector<NativePoint> right_ancestor_position_stack;
   };
 
+  struct NodeAllocator;
+  struct NodeStore;
+  struct SnapshotState;
+
+  Node *allocate_node(Node *parent, NativePoint left_extent);
+  Node *own(Node *node);
+  void discard_node(Node *node);
+  void discard_subtree(Node *node);
+  void adopt_subtree(Node *node, Node *parent);
+  void collect_garbage();
+  static void mark_subtree(Node *node, uint32_t mark);
+  static void dump_subtree(const Node *node, NativePoint left_ancestor_position, std::unordered_map<MarkerId, NativeRange> *result);
+  void cache_node_position(const Node *node, NativePoint position) const;
+  void invalidate_node_positions();
+  void reset_node_stamps(Node *node);
+  Node *build_subtree(const std::vector<NativePoint> &positions, size_t begin, size_t end, int depth, int priority_band, std::vector<Node *> *nodes);
   NativePoint get_node_position(const Node *node) const;
   void delete_node(Node *node);
-  void delete_subtree(Node *node);
   void bubble_node_up(Node *node);
   void bubble_node_down(Node *node);
   void rotate_node_left(Node *pivot);
@@ -125,7 +188,45 @@ private:
   std::unordered_map<MarkerId, Node*> end_nodes_by_id;
   Iterator iterator;
   flat_set<MarkerId> exclusive_marker_ids;
-  mutable std::unordered_map<const Node*, NativePoint> node_position_cache;
+  std::shared_ptr<NodeStore> node_store;
+  uint32_t position_generation;
+};
+
+// Walks the marker boundaries in order without allocating, for callers such
+// as renderers that repeatedly visit the boundaries within a range. A cursor
+// is invalidated by any change to its index.
+class MarkerIndex::BoundaryCursor {
+public:
+  BoundaryCursor(const MarkerIndex *marker_index);
+
+  // Moves to the first boundary at or after `position`, optionally appending
+  // the markers that contain it to `containing`, ordered as by `compare`.
+  void seek(NativePoint position, std::vector<MarkerId> *containing = nullptr);
+  void advance();
+  bool at_end() const { return node == nullptr; }
+
+  NativePoint position() const { return node_position; }
+  MarkerIdSpan starting() const;
+  MarkerIdSpan ending() const;
+
+private:
+  const MarkerIndex *marker_index;
+  const Node *node;
+  NativePoint node_position;
+};
+
+// The markers of an index at some moment. Taking a snapshot is O(1): it
+// shares the index's nodes, and the index copies any node it later changes
+// along with the node's ancestors. A snapshot stays valid after its index is
+// destroyed.
+class MarkerIndex::Snapshot {
+public:
+  size_t size() const;
+  std::unordered_map<MarkerId, NativeRange> dump() const;
+
+private:
+  friend class MarkerIndex;
+  std::shared_ptr<const SnapshotState> state;
 };
 
 #endif // MARKER_INDEX_H_
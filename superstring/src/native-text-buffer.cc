@@ -1,9 +1,13 @@
 #include "text-slice.h"
 #include "native-text-buffer.h"
 #include "regex.h"
+#include "rope.h"
+#include "word-index.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cwctype>
+#include <iterator>
 #include <sstream>
 #include <unordered_map>
 #include <vector>
@@ -19,22 +23,217 @@ using MatchResult = Regex::MatchResult;
 using SubsequenceMatch = NativeTextBuffer::SubsequenceMatch;
 
 uint32_t NativeTextBuffer::MAX_CHUNK_SIZE_TO_COPY = 1024;
+uint32_t NativeTextBuffer::CHARACTERS_PER_PATCH_SEARCH_STEP = 64;
+uint32_t NativeTextBuffer::MIN_FLATTENING_COST = 4096;
 
 static Text EMPTY_TEXT;
 
+struct SubsequenceMatchVariant {
+  size_t query_index = 0;
+  uint8_t match_indices[WordIndex::MAX_WORD_LENGTH];
+  uint8_t match_index_count = 0;
+  int16_t score = 0;
+
+  bool operator<(const SubsequenceMatchVariant &other) const {
+    return query_index < other.query_index;
+  }
+};
+
+static bool is_subsequence(const u16string &lowercase_query, const u16string &word) {
+  size_t query_index = 0;
+  for (char16_t c : word) {
+    if (query_index < lowercase_query.size() && towlower(c) == lowercase_query[query_index]) {
+      query_index++;
+    }
+  }
+  return query_index == lowercase_query.size();
+}
+
+// Finds the best way to match the query against a word that contains it as
+// a subsequence. `match_variants` and `new_match_variants` are only scratch
+// space, passed in so that they can be reused from one word to the next.
+static void score_subsequence_match(const u16string &word, const u16string &query, const u16string &raw_query,
+                                    vector<SubsequenceMatchVariant> &match_variants,
+                                    vector<SubsequenceMatchVariant> &new_match_variants,
+                                    SubsequenceMatch *result) {
+  static const unsigned consecutive_bonus = 5;
+  static const unsigned subword_start_with_case_match_bonus = 10;
+  static const unsigned subword_start_with_case_mismatch_bonus = 9;
+  static const unsigned mismatch_penalty = 1;
+  static const unsigned leading_mismatch_penalty = 3;
+
+  match_variants.assign(1, SubsequenceMatchVariant{});
+  new_match_variants.clear();
+
+  for (size_t i = 0; i < word.size(); i++) {
+    uint16_t c = towlower(word[i]);
+
+    for (auto match_variant = match_variants.begin(); match_variant != match_variants.end();) {
+      if (match_variant->query_index < query.size()) {
+        // If the current word character matches the next character of
+        // the query for this match variant, create a *new* match variant
+        // that consumes the matching character.
+        if (c == query[match_variant->query_index]) {
+          SubsequenceMatchVariant new_match = *match_variant;
+          new_match.query_index++;
+
+          if (i == 0 ||
+              !std::iswalnum(word[i - 1]) ||
+              (std::iswlower(word[i - 1]) && std::iswupper(word[i]))) {
+            new_match.score += word[i] == raw_query[match_variant->query_index]
+              ? subword_start_with_case_match_bonus
+              : subword_start_with_case_mismatch_bonus;
+          }
+
+          if (new_match.match_index_count > 0 && new_match.match_indices[new_match.match_index_count - 1] == i - 1) {
+            new_match.score += consecutive_bonus;
+          }
+
+          new_match.match_indices[new_match.match_index_count++] = i;
+          new_match_variants.push_back(new_match);
+        }
+
+        // For the current match variant, treat the current character as
+        // a mismatch regardless of whether it matched above. This
+        // reserves the chance for the next character to be consumed by a
+        // match with higher overall value.
+        if (i < 3) {
+          match_variant->score -= leading_mismatch_penalty;
+        } else {
+          match_variant->score -= mismatch_penalty;
+        }
+
+        // If a match variant does *not* match the current character (and is therefore
+        // ineligible for the consecutive match bonus on the next character), its
+        // potential for future scoring is determined entirely by its `query_index`.
+        //
+        // These match variants are ordered by ascending `query_index`. If multiple
+        // match variants have the same `query_index`, they are ordered by ascending
+        // `score`.
+        //
+        // If there is another match variant with the same `query_index` and a greater
+        // or equal `score`, discard the current match variant.
+        auto next_match_variant = match_variant + 1;
+        if (next_match_variant != match_variants.end() && next_match_variant->query_index == match_variant->query_index) {
+          match_variant = match_variants.erase(match_variant);
+        } else {
+          ++match_variant;
+        }
+      } else {
+        ++match_variant;
+      }
+    }
+
+    // Add all of the newly-computed match variants to the list. Avoid creating duplicate
+    // match variants with the same query index unless the new variant (which is
+    // by definition eligible for the consecutive match bonus on the next character) has
+    // a lower score than an existing variant. Maintain the invariant that match variants
+    // are ordered by ascending `query_index` and ascending `score`.
+    for (const SubsequenceMatchVariant &new_variant : new_match_variants) {
+      auto existing_match_iter = std::lower_bound(match_variants.begin(), match_variants.end(), new_variant);
+      if (existing_match_iter != match_variants.end() && new_variant.query_index == existing_match_iter->query_index) {
+        if (new_variant.score >= existing_match_iter->score) {
+          *existing_match_iter = new_variant;
+          continue;
+        }
+      }
+      match_variants.insert(existing_match_iter, new_variant);
+    }
+    new_match_variants.clear();
+  }
+
+  SubsequenceMatchVariant *best_match = nullptr;
+  for (auto &match_variant : match_variants) {
+    if (match_variant.query_index == query.size()) {
+      if (!best_match || best_match->score < match_variant.score) {
+        best_match = &match_variant;
+      }
+    }
+  }
+
+  result->word = word;
+  result->match_indices.assign(best_match->match_indices, best_match->match_indices + best_match->match_index_count);
+  result->score = best_match->score;
+}
+
+static bool ranks_before(const SubsequenceMatch &a, const SubsequenceMatch &b) {
+  // Doing it this way helps us avoid sorting ambiguity keeping the ordering the same across platforms.
+  if (a.score > b.score) return true;
+  if (b.score > a.score) return false;
+  return a.word < b.word;
+}
+
+// Scores the words that contain the query as a subsequence and returns them
+// best first, without their positions. The words are split into shards that
+// are scored on separate threads; when `max_count` is non-zero, each shard
+// only keeps its best `max_count` matches in a heap whose top is the worst of
+// them. Since `ranks_before` orders any two distinct words, the result is
+// the same prefix of the ranking however the words are sharded.
+static vector<SubsequenceMatch> rank_subsequence_matches(const vector<const u16string *> &words,
+                                                         const u16string &query, const u16string &raw_query,
+                                                         size_t max_count, unsigned thread_count) {
+  static const size_t MIN_SHARD_SIZE = 1024;
+
+  size_t shard_count = std::max<size_t>(1, std::min<size_t>(thread_count, words.size() / MIN_SHARD_SIZE));
+  vector<vector<SubsequenceMatch>> shard_matches(shard_count);
+  std::atomic<size_t> next_shard{0};
+  auto score_shards = [&]() {
+    vector<SubsequenceMatchVariant> match_variants, new_match_variants;
+    for (;;) {
+      size_t i = next_shard++;
+      if (i >= shard_count) break;
+      auto &matches = shard_matches[i];
+      for (size_t j = words.size() * i / shard_count, end = words.size() * (i + 1) / shard_count; j < end; j++) {
+        const u16string &word = *words[j];
+        if (!is_subsequence(query, word)) continue;
+        matches.emplace_back();
+        score_subsequence_match(word, query, raw_query, match_variants, new_match_variants, &matches.back());
+        if (max_count > 0) {
+          std::push_heap(matches.begin(), matches.end(), ranks_before);
+          if (matches.size() > max_count) {
+            std::pop_heap(matches.begin(), matches.end(), ranks_before);
+            matches.pop_back();
+          }
+        }
+      }
+    }
+  };
+
+  vector<std::thread> threads;
+  for (size_t i = 1; i < shard_count; i++) {
+    threads.push_back(std::thread(score_shards));
+  }
+  score_shards();
+  for (auto &thread : threads) thread.join();
+
+  vector<SubsequenceMatch> matches = move(shard_matches[0]);
+  for (size_t i = 1; i < shard_count; i++) {
+    std::move(shard_matches[i].begin(), shard_matches[i].end(), std::back_inserter(matches));
+  }
+  std::sort(matches.begin(), matches.end(), ranks_before);
+  if (max_count > 0 && matches.size() > max_count) matches.resize(max_count);
+  return matches;
+}
+
+// Once a snapshot holds a layer, nothing that the snapshot reads from it or
+// from the layers below it changes until the snapshot is released, so that
+// snapshots can be read on other threads while the buffer is edited. The
+// buffer may still give such a layer a `text`, but readers only look at it
+// once `uses_patch` is false, which is only set for layers without
+// snapshots.
 struct NativeTextBuffer::Layer {
   Layer *previous_layer;
   Patch patch;
-  optional<Text> text;
+  optional<Rope> text;
   bool uses_patch;
 
   NativePoint extent_;
   uint32_t size_;
-  uint32_t snapshot_count;
+  std::atomic<uint32_t> snapshot_count;
 
   Layer(Text &&text) :
     previous_layer{nullptr},
-    text{move(text)},
+    text{Rope{move(text)}},
     uses_patch{false},
     extent_{this->text->extent()},
     size_{this->text->size()},
@@ -153,8 +352,7 @@ struct NativeTextBuffer::Layer {
     NativePoint current_position = start;
 
     if (!uses_patch) {
-      TextSlice slice = TextSlice(*text).slice({current_position, goal_position});
-      return !slice.empty() && callback(slice);
+      return text->for_each_chunk_in_range(current_position, goal_position, callback);
     }
 
     if (snapshot_count > 0) splay = false;
@@ -207,7 +405,7 @@ struct NativeTextBuffer::Layer {
   }
 
   NativePoint position_for_offset(uint32_t goal_offset) const {
-    if (text) {
+    if (!uses_patch) {
       return text->position_for_offset(goal_offset);
     } else {
       return patch.new_position_for_new_offset(
@@ -265,8 +463,12 @@ struct NativeTextBuffer::Layer {
 
   }
 
+  // Calls `callback` with each match of `regex` in `range`, in order, until
+  // it returns true. Matches starting at or after `search_limit` are not
+  // reported, and the scan stops as soon as it can't find any other match.
   template <typename Callback>
-  void scan_in_range(const Regex &regex, NativeRange range, const Callback &callback, bool splay = false) {
+  void scan_in_range(const Regex &regex, NativeRange range, const Callback &callback,
+                     bool splay = false, NativePoint search_limit = NativePoint::max()) {
     Regex::MatchData match_data(regex);
     range.start = clip_position(range.start).position;
     range.end = clip_position(range.end).position;
@@ -316,6 +518,11 @@ struct NativeTextBuffer::Layer {
           slice_to_search = TextSlice(chunk_continuation);
         }
 
+        if (slice_to_search_start_position >= search_limit) {
+          done = true;
+          return true;
+        }
+
         NativePoint slice_to_search_end_position =
           slice_to_search_start_position.traverse(slice_to_search.extent());
 
@@ -372,6 +579,10 @@ struct NativeTextBuffer::Layer {
               slice_to_search_start_position.traverse(match_start_position),
               slice_to_search_start_position.traverse(match_end_position)
             };
+            if (last_match.start >= search_limit) {
+              done = true;
+              return true;
+            }
 
             last_search_end_position = last_match.end;
             if (match_end_position == match_start_position) {
@@ -410,7 +621,7 @@ struct NativeTextBuffer::Layer {
 
     if (last_match_is_pending) {
       callback(last_match);
-    } else if (!done && last_match.end != range.end) {
+    } else if (!done && last_match.end != range.end && range.end < search_limit) {
       static char16_t EMPTY[] = {0};
       unsigned options = MatchOptions::IsEndSearch;
       if (range.end.column == 0) options |= MatchOptions::IsBeginningOfLine;
@@ -442,197 +653,280 @@ struct NativeTextBuffer::Layer {
     return result;
   }
 
+  NativePoint search_end_after_match(NativeRange match) {
+    NativePoint result = match.end;
+    if (match.start == match.end) {
+      result.column++;
+      if (clip_position(result).position == match.end) {
+        result.column = 0;
+        result.row++;
+      }
+    }
+    return result;
+  }
+
+  // Finds the same matches as `find_all_in_range`, but searches row-aligned
+  // partitions of the range on separate threads. Each partition's search runs
+  // past the end of the partition to complete a match that spans it, and the
+  // partitions' results are then stitched together in order. Where a match
+  // from one partition overlaps the next, the next partition's results are
+  // only kept from the first match that a serial search would also have
+  // found there; if there is no such match, that partition is searched again
+  // from the end of the overlapping match.
+  vector<NativeRange> find_all_in_range_in_parallel(const Regex &regex, NativeRange range, unsigned thread_count) {
+    static const uint32_t MIN_PARTITION_SIZE = 256 * 1024;
+
+    ClipResult start = clip_position(range.start);
+    ClipResult end = clip_position(range.end);
+    range = NativeRange{start.position, end.position};
+
+    // Lookbehinds could see past the start of a partition, which the serial
+    // search never does at the beginning of a line, so leave those to it.
+    uint32_t partition_count = std::min<uint32_t>(
+      thread_count * 4,
+      (end.offset - std::min(start.offset, end.offset)) / MIN_PARTITION_SIZE
+    );
+    if (thread_count < 2 || partition_count < 2 || regex.max_lookbehind() > 0) {
+      return find_all_in_range(regex, range);
+    }
+
+    vector<NativePoint> boundaries{range.start};
+    for (uint32_t i = 1; i < partition_count; i++) {
+      uint32_t offset = start.offset + static_cast<uint64_t>(end.offset - start.offset) * i / partition_count;
+      NativePoint boundary = position_for_offset(offset);
+      if (boundary.column > 0) boundary = NativePoint(boundary.row + 1, 0);
+      if (boundary > boundaries.back() && boundary < range.end) boundaries.push_back(boundary);
+    }
+    boundaries.push_back(range.end);
+    partition_count = boundaries.size() - 1;
+
+    vector<vector<NativeRange>> partition_matches(partition_count);
+    std::atomic<uint32_t> next_partition{0};
+    auto search_partitions = [&]() {
+      for (;;) {
+        uint32_t i = next_partition++;
+        if (i >= partition_count) break;
+        auto &matches = partition_matches[i];
+        scan_in_range(regex, {boundaries[i], range.end}, [&matches](NativeRange match) {
+          matches.push_back(match);
+          return false;
+        }, false, i + 1 < partition_count ? boundaries[i + 1] : NativePoint::max());
+      }
+    };
+
+    vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min(thread_count, partition_count); i++) {
+      threads.push_back(std::thread(search_partitions));
+    }
+    search_partitions();
+    for (auto &thread : threads) thread.join();
+
+    vector<NativeRange> result;
+    NativePoint resume_position = range.start;
+    for (uint32_t i = 0; i < partition_count; i++) {
+      auto &matches = partition_matches[i];
+      auto first_match = matches.begin();
+      if (resume_position > boundaries[i]) {
+        NativePoint previous_search_end = boundaries[i];
+        while (first_match != matches.end() && first_match->start < resume_position) {
+          previous_search_end = search_end_after_match(*first_match);
+          ++first_match;
+        }
+
+        if (previous_search_end > resume_position) {
+          matches.clear();
+          scan_in_range(regex, {resume_position, range.end}, [&matches](NativeRange match) {
+            matches.push_back(match);
+            return false;
+          }, false, i + 1 < partition_count ? boundaries[i + 1] : NativePoint::max());
+          first_match = matches.begin();
+        }
+      }
+
+      if (first_match != matches.end()) {
+        result.insert(result.end(), first_match, matches.end());
+        resume_position = search_end_after_match(result.back());
+      }
+    }
+
+    return result;
+  }
+
   unsigned find_and_mark_all_in_range(MarkerIndex &index, MarkerIndex::MarkerId first_id,
                                       bool exclusive, const Regex &regex, NativeRange range, bool splay = false) {
-    unsigned id = first_id;
-    scan_in_range(regex, range, [&index, &id, exclusive](NativeRange match_range) -> bool {
-      index.insert(id, match_range.start, match_range.end);
-      index.set_exclusive(id, exclusive);
-      id++;
+    vector<pair<MarkerIndex::MarkerId, NativeRange>> markers;
+    scan_in_range(regex, range, [&markers, first_id](NativeRange match_range) -> bool {
+      markers.push_back({first_id + static_cast<unsigned>(markers.size()), match_range});
       return false;
     }, splay);
-    return id - first_id;
-  }
-
-  struct SubsequenceMatchVariant {
-    size_t query_index = 0;
-    std::vector<uint32_t> match_indices;
-    int16_t score = 0;
 
-    bool operator<(const SubsequenceMatchVariant &other) const {
-      return query_index < other.query_index;
-    }
-  };
+    index.insert_batch(markers);
+    for (const auto &marker : markers) index.set_exclusive(marker.first, exclusive);
+    return markers.size();
+  }
 
-  vector<SubsequenceMatch> find_words_with_subsequence_in_range(u16string query, const u16string &extra_word_characters, NativeRange range) {
-    const size_t MAX_WORD_LENGTH = 80;
-    size_t query_index = 0;
-    NativePoint position;
+  // Calls the callback with each word between the two positions and its
+  // position, counting from `origin` at `start`.
+  template <typename Callback>
+  void for_each_word_in_range(NativePoint start, NativePoint end, NativePoint origin,
+                              const u16string &extra_word_characters, const Callback &callback) {
+    NativePoint position = origin;
     NativePoint current_word_start;
     u16string current_word;
-    u16string raw_query = query;
 
-    if (query.size() > MAX_WORD_LENGTH) return vector<SubsequenceMatch>{};
+    for_each_chunk_in_range(start, end, [&] (TextSlice chunk) -> bool {
+      for (uint16_t c : chunk) {
+        bool is_word_character =
+          std::iswalnum(c) ||
+          std::find(extra_word_characters.begin(), extra_word_characters.end(), c) != extra_word_characters.end();
+
+        if (is_word_character) {
+          if (current_word.empty()) current_word_start = position;
+          current_word += c;
+        } else if (!current_word.empty()) {
+          callback(current_word, current_word_start);
+          current_word.clear();
+        }
 
+        if (c == '\n') {
+          position.row++;
+          position.column = 0;
+        } else {
+          position.column++;
+        }
+      }
+
+      return false;
+    });
+
+    if (!current_word.empty()) callback(current_word, current_word_start);
+  }
+
+  // Positions are reported relative to the start of the range.
+  vector<SubsequenceMatch> find_words_with_subsequence_in_range(u16string query, const u16string &extra_word_characters,
+                                                                NativeRange range, size_t max_count, unsigned thread_count) {
+    u16string raw_query = query;
+    if (query.size() > WordIndex::MAX_WORD_LENGTH) return vector<SubsequenceMatch>{};
     std::transform(query.begin(), query.end(), query.begin(), std::towlower);
 
     // First, find the start position of all words matching the given
     // subsequence.
     std::unordered_map<u16string, vector<NativePoint>> substring_matches;
-
-    for_each_chunk_in_range(
+    for_each_word_in_range(
       clip_position(range.start).position,
       clip_position(range.end).position,
-      [&] (TextSlice chunk) -> bool {
-        for (uint16_t c : chunk) {
-          bool is_word_character =
-            std::iswalnum(c) ||
-            std::find(extra_word_characters.begin(), extra_word_characters.end(), c) != extra_word_characters.end();
-
-          if (is_word_character) {
-            if (current_word.empty()) current_word_start = position;
-            current_word += c;
-            if (query_index < query.size() && towlower(c) == query[query_index]) {
-              query_index++;
-            }
-          } else {
-            if (!current_word.empty()) {
-              if (query_index == query.size() && current_word.size() <= MAX_WORD_LENGTH) {
-                substring_matches[current_word].push_back(current_word_start);
-              }
-              query_index = 0;
-              current_word.clear();
-            }
-          }
-
-          if (c == '\n') {
-            position.row++;
-            position.column = 0;
-          } else {
-            position.column++;
-          }
+      NativePoint(),
+      extra_word_characters,
+      [&](const u16string &word, NativePoint position) {
+        if (word.size() <= WordIndex::MAX_WORD_LENGTH && is_subsequence(query, word)) {
+          substring_matches[word].push_back(position);
         }
-
-        return false;
       });
 
-    if (!current_word.empty() && query_index == query.size() && current_word.size() <= MAX_WORD_LENGTH) {
-      substring_matches[current_word].push_back(current_word_start);
-    }
-
-    // Next, calculate a score for each word indicating the quality of the
-    // match against the query.
-
-    static const unsigned consecutive_bonus = 5;
-    static const unsigned subword_start_with_case_match_bonus = 10;
-    static const unsigned subword_start_with_case_mismatch_bonus = 9;
-    static const unsigned mismatch_penalty = 1;
-    static const unsigned leading_mismatch_penalty = 3;
-
-    vector<SubsequenceMatch> matches;
-
-    for (auto entry : substring_matches) {
-      const u16string &word = entry.first;
-      const vector<NativePoint> &start_positions = entry.second;
-
-      vector<SubsequenceMatchVariant> match_variants {{}};
-      vector<SubsequenceMatchVariant> new_match_variants;
-
-      for (size_t i = 0; i < word.size(); i++) {
-        uint16_t c = towlower(word[i]);
-
-        for (auto match_variant = match_variants.begin(); match_variant != match_variants.end();) {
-          if (match_variant->query_index < query.size()) {
-            // If the current word character matches the next character of
-            // the query for this match variant, create a *new* match variant
-            // that consumes the matching character.
-            if (c == query[match_variant->query_index]) {
-              SubsequenceMatchVariant new_match = *match_variant;
-              new_match.query_index++;
-
-              if (i == 0 ||
-                  !std::iswalnum(word[i - 1]) ||
-                  (std::iswlower(word[i - 1]) && std::iswupper(word[i]))) {
-                new_match.score += word[i] == raw_query[match_variant->query_index]
-                  ? subword_start_with_case_match_bonus
-                  : subword_start_with_case_mismatch_bonus;
-              }
-
-              if (!new_match.match_indices.empty() && new_match.match_indices.back() == i - 1) {
-                new_match.score += consecutive_bonus;
-              }
-
-              new_match.match_indices.push_back(i);
-              new_match_variants.push_back(new_match);
-            }
+    // Next, score and rank the matching words.
+    vector<const u16string *> words;
+    words.reserve(substring_matches.size());
+    for (const auto &entry : substring_matches) words.push_back(&entry.first);
+    vector<SubsequenceMatch> matches = rank_subsequence_matches(words, query, raw_query, max_count, thread_count);
+    for (auto &match : matches) match.positions = move(substring_matches[match.word]);
+    return matches;
+  }
 
-            // For the current match variant, treat the current character as
-            // a mismatch regardless of whether it matched above. This
-            // reserves the chance for the next character to be consumed by a
-            // match with higher overall value.
-            if (i < 3) {
-              match_variant->score -= leading_mismatch_penalty;
-            } else {
-              match_variant->score -= mismatch_penalty;
-            }
+  // Finds the same matches as `find_words_with_subsequence_in_range`, taking
+  // the words on the rows inside the range from an index that is up to date
+  // with this layer. The range's first and last rows are still scanned, since
+  // the range may cut words in two there.
+  vector<SubsequenceMatch> find_words_with_subsequence_in_index(const WordIndex &index, u16string query,
+                                                                NativeRange range, size_t max_count,
+                                                                unsigned thread_count) {
+    u16string raw_query = query;
+    if (query.size() > WordIndex::MAX_WORD_LENGTH) return vector<SubsequenceMatch>{};
+    std::transform(query.begin(), query.end(), query.begin(), std::towlower);
 
-            // If a match variant does *not* match the current character (and is therefore
-            // ineligible for the consecutive match bonus on the next character), its
-            // potential for future scoring is determined entirely by its `query_index`.
-            //
-            // These match variants are ordered by ascending `query_index`. If multiple
-            // match variants have the same `query_index`, they are ordered by ascending
-            // `score`.
-            //
-            // If there is another match variant with the same `query_index` and a greater
-            // or equal `score`, discard the current match variant.
-            auto next_match_variant = match_variant + 1;
-            if (next_match_variant != match_variants.end() && next_match_variant->query_index == match_variant->query_index) {
-              match_variant = match_variants.erase(match_variant);
-            } else {
-              ++match_variant;
-            }
-          } else {
-            ++match_variant;
-          }
+    NativePoint start = clip_position(range.start).position;
+    NativePoint end = clip_position(range.end).position;
+    if (end < start) end = start;
+
+    std::unordered_map<u16string, vector<NativePoint>> first_row_matches, last_row_matches;
+    auto scan_row = [&](NativePoint scan_start, NativePoint scan_end, NativePoint origin,
+                        std::unordered_map<u16string, vector<NativePoint>> &matches) {
+      for_each_word_in_range(scan_start, scan_end, origin, index.extra_word_characters(),
+                             [&](const u16string &word, NativePoint position) {
+        if (word.size() <= WordIndex::MAX_WORD_LENGTH && is_subsequence(query, word)) {
+          matches[word].push_back(position);
         }
+      });
+    };
 
-        // Add all of the newly-computed match variants to the list. Avoid creating duplicate
-        // match variants with the same query index unless the new variant (which is
-        // by definition eligible for the consecutive match bonus on the next character) has
-        // a lower score than an existing variant. Maintain the invariant that match variants
-        // are ordered by ascending `query_index` and ascending `score`.
-        for (const SubsequenceMatchVariant &new_variant : new_match_variants) {
-          auto existing_match_iter = std::lower_bound(match_variants.begin(), match_variants.end(), new_variant);
-          if (existing_match_iter != match_variants.end() && new_variant.query_index == existing_match_iter->query_index) {
-            if (new_variant.score >= existing_match_iter->score) {
-              *existing_match_iter = new_variant;
-              continue;
-            }
-          }
-          match_variants.insert(existing_match_iter, new_variant);
+    uint32_t middle_start_row = start.row + 1;
+    uint32_t middle_end_row = std::max(end.row, middle_start_row);
+    if (end.row == start.row) {
+      scan_row(start, end, NativePoint(), first_row_matches);
+    } else {
+      scan_row(start, NativePoint(start.row + 1, 0), NativePoint(), first_row_matches);
+      scan_row(NativePoint(end.row, 0), end, NativePoint(end.row - start.row, 0), last_row_matches);
+    }
+
+    // When the middle rows are most of the buffer, count the occurrences
+    // outside of them instead and subtract those from the totals.
+    vector<bool> is_in_middle_rows(index.word_id_limit());
+    if (middle_end_row - middle_start_row <= index.row_count() / 2) {
+      for (uint32_t row = middle_start_row; row < middle_end_row; row++) {
+        for (const auto &occurrence : index.occurrences_in_row(row)) {
+          is_in_middle_rows[occurrence.word_id] = true;
         }
-        new_match_variants.clear();
       }
-
-      SubsequenceMatchVariant *best_match = nullptr;
-      for (auto &match_variant : match_variants) {
-        if (match_variant.query_index == query.size()) {
-          if (!best_match || best_match->score < match_variant.score) {
-            best_match = &match_variant;
-          }
+    } else {
+      vector<uint32_t> counts_outside_middle_rows(index.word_id_limit());
+      auto count_row = [&](uint32_t row) {
+        for (const auto &occurrence : index.occurrences_in_row(row)) {
+          counts_outside_middle_rows[occurrence.word_id]++;
         }
+      };
+      for (uint32_t row = 0; row < middle_start_row; row++) count_row(row);
+      for (uint32_t row = middle_end_row; row < index.row_count(); row++) count_row(row);
+      for (uint32_t word_id = 0; word_id < is_in_middle_rows.size(); word_id++) {
+        is_in_middle_rows[word_id] =
+          index.word(word_id) && index.occurrence_count(word_id) > counts_outside_middle_rows[word_id];
       }
+    }
 
-      matches.push_back(SubsequenceMatch{word, start_positions, best_match->match_indices, best_match->score});
+    vector<const u16string *> words;
+    for (uint32_t word_id = 0; word_id < is_in_middle_rows.size(); word_id++) {
+      if (is_in_middle_rows[word_id]) words.push_back(index.word(word_id));
+    }
+    for (const auto *row_matches : {&first_row_matches, &last_row_matches}) {
+      for (const auto &entry : *row_matches) {
+        if (row_matches == &last_row_matches && first_row_matches.count(entry.first)) continue;
+        auto word_id = index.find_word(entry.first);
+        if (!word_id || !is_in_middle_rows[*word_id]) words.push_back(&entry.first);
+      }
     }
 
-    std::sort(matches.begin(), matches.end(), [] (const SubsequenceMatch &a, const SubsequenceMatch &b) {
-      // Doing it this way helps us avoid sorting ambiguity keeping the ordering the same across platforms.
-      if (a.score > b.score) return true;
-      if (b.score > a.score) return false;
-      return a.word < b.word;
-    });
+    vector<SubsequenceMatch> matches = rank_subsequence_matches(words, query, raw_query, max_count, thread_count);
+
+    // Collect the positions of the ranked words in document order.
+    vector<uint32_t> match_index_for_word_id(index.word_id_limit(), UINT32_MAX);
+    for (uint32_t i = 0; i < matches.size(); i++) {
+      auto word_id = index.find_word(matches[i].word);
+      if (word_id) match_index_for_word_id[*word_id] = i;
+      auto first_row_entry = first_row_matches.find(matches[i].word);
+      if (first_row_entry != first_row_matches.end()) matches[i].positions = move(first_row_entry->second);
+    }
+    for (uint32_t row = middle_start_row; row < middle_end_row; row++) {
+      for (const auto &occurrence : index.occurrences_in_row(row)) {
+        uint32_t match_index = match_index_for_word_id[occurrence.word_id];
+        if (match_index != UINT32_MAX) {
+          matches[match_index].positions.push_back(NativePoint(row - start.row, occurrence.column));
+        }
+      }
+    }
+    for (auto &match : matches) {
+      auto last_row_entry = last_row_matches.find(match.word);
+      if (last_row_entry != last_row_matches.end()) {
+        match.positions.insert(match.positions.end(), last_row_entry->second.begin(), last_row_entry->second.end());
+      }
+    }
 
     return matches;
   }
@@ -643,21 +937,44 @@ struct NativeTextBuffer::Layer {
     bool result = false;
     uint32_t start_offset = 0;
     for_each_chunk_in_range(NativePoint(), extent(), [&](TextSlice chunk) {
-      if (chunk.text == &(*base_layer->text) ||
-          equal(chunk.begin(), chunk.end(), base_layer->text->begin() + start_offset)) {
-        start_offset += chunk.size();
-        return false;
-      }
-      result = true;
-      return true;
+      const char16_t *chunk_data = chunk.data();
+      uint32_t end_offset = start_offset + chunk.size();
+      result = base_layer->text->for_each_chunk_in_offset_range(start_offset, end_offset, [&](TextSlice base_chunk) {
+        bool is_equal = base_chunk.data() == chunk_data ||
+          equal(base_chunk.begin(), base_chunk.end(), chunk_data);
+        chunk_data += base_chunk.size();
+        return !is_equal;
+      });
+      start_offset = end_offset;
+      return result;
     });
 
     return result;
   }
 
+  // Builds this layer's text from the nearest layer below it that has one,
+  // sharing that text's pieces instead of copying its characters.
+  Rope compute_text() const {
+    vector<const Layer *> layers_above;
+    const Layer *layer = this;
+    while (!layer->text) {
+      layers_above.push_back(layer);
+      layer = layer->previous_layer;
+    }
+
+    Rope result{*layer->text};
+    for (auto iter = layers_above.rbegin(); iter != layers_above.rend(); ++iter) {
+      for (auto change : (*iter)->patch.get_changes()) {
+        result.splice(change.new_start, change.old_end.traversal(change.old_start), TextSlice(*change.new_text));
+      }
+    }
+    return result;
+  }
+
   bool has_astral() {
     bool result = false;
     for_each_chunk_in_range(NativePoint(), extent(), [&](TextSlice chunk) {
+      if (chunk.text->is_compact()) return false;
       for (auto ch : chunk) {
         if ((ch & 0xf800) == 0xd800) {
           result = true;
@@ -672,11 +989,27 @@ struct NativeTextBuffer::Layer {
 
 NativeTextBuffer::NativeTextBuffer(u16string &&text) :
   base_layer{new Layer(move(text))},
-  top_layer{base_layer} {}
+  top_layer{base_layer},
+  owning_thread{std::this_thread::get_id()},
+  has_released_snapshots{false},
+  deferred_search_cost{0},
+  excess_search_cost{0},
+  is_search_cost_stale{true},
+  flatten_count{0},
+  generation{1},
+  line_cache{} {}
 
 NativeTextBuffer::NativeTextBuffer() :
   base_layer{new Layer(Text{})},
-  top_layer{base_layer} {}
+  top_layer{base_layer},
+  owning_thread{std::this_thread::get_id()},
+  has_released_snapshots{false},
+  deferred_search_cost{0},
+  excess_search_cost{0},
+  is_search_cost_stale{true},
+  flatten_count{0},
+  generation{1},
+  line_cache{} {}
 
 NativeTextBuffer::~NativeTextBuffer() {
   Layer *layer = top_layer;
@@ -691,6 +1024,9 @@ NativeTextBuffer::NativeTextBuffer(const std::u16string &text) :
   NativeTextBuffer{u16string{text.begin(), text.end()}} {}
 
 void NativeTextBuffer::reset(Text &&new_base_text) {
+  word_index.reset();
+  is_search_cost_stale = true;
+  generation++;
   bool has_snapshot = false;
   auto layer = top_layer;
   while (layer) {
@@ -716,7 +1052,7 @@ void NativeTextBuffer::reset(Text &&new_base_text) {
 
   top_layer->extent_ = new_base_text.extent();
   top_layer->size_ = new_base_text.size();
-  top_layer->text = move(new_base_text);
+  top_layer->text = Rope{move(new_base_text)};
   top_layer->patch.clear();
   top_layer->uses_patch = false;
   base_layer = top_layer;
@@ -731,14 +1067,9 @@ Patch NativeTextBuffer::get_inverted_changes(const Snapshot *snapshot) const {
     layer = layer->previous_layer;
   }
 
-  Patch combination;
-  bool left_to_right = true;
-  for (const Patch *patch : patches) {
-    combination.combine(*patch, left_to_right);
-    left_to_right = !left_to_right;
-  }
+  Patch combination = Patch::compose(patches);
 
-  TextSlice base{*snapshot->base_layer.text};
+  const Rope &base = *snapshot->base_layer.text;
   Patch result;
   for (auto change : combination.get_changes()) {
     result.splice(
@@ -746,7 +1077,7 @@ Patch NativeTextBuffer::get_inverted_changes(const Snapshot *snapshot) const {
       change.new_end.traversal(change.new_start),
       change.old_end.traversal(change.old_start),
       *change.new_text,
-      Text{base.slice({change.old_start, change.old_end})},
+      Text{base.text_in_range({change.old_start, change.old_end})},
       change.new_text->size()
     );
   }
@@ -773,17 +1104,15 @@ void NativeTextBuffer::serialize_changes(Serializer &serializer) {
     layer = layer->previous_layer;
   }
 
-  Patch combination;
-  bool left_to_right = true;
-  for (const Patch *patch : patches) {
-    combination.combine(*patch, left_to_right);
-    left_to_right = !left_to_right;
-  }
+  Patch combination = Patch::compose(patches);
   combination.serialize(serializer);
 }
 
 bool NativeTextBuffer::deserialize_changes(Deserializer &deserializer) {
   if (top_layer != base_layer || base_layer->previous_layer) return false;
+  word_index.reset();
+  is_search_cost_stale = true;
+  generation++;
   top_layer = new Layer(base_layer);
   top_layer->size_ = deserializer.read<uint32_t>();
   top_layer->extent_ = NativePoint(deserializer);
@@ -791,8 +1120,8 @@ bool NativeTextBuffer::deserialize_changes(Deserializer &deserializer) {
   return true;
 }
 
-const Text &NativeTextBuffer::base_text() const {
-  return *base_layer->text;
+Text NativeTextBuffer::base_text() const {
+  return Text{base_layer->text->text()};
 }
 
 NativePoint NativeTextBuffer::extent() const {
@@ -805,11 +1134,13 @@ uint32_t NativeTextBuffer::size() const {
 
 optional<uint32_t> NativeTextBuffer::line_length_for_row(uint32_t row) {
   if (row > extent().row) return optional<uint32_t>{};
+  note_read();
   return top_layer->clip_position(NativePoint{row, UINT32_MAX}, true).position.column;
 }
 
 const char16_t *NativeTextBuffer::line_ending_for_row(uint32_t row) {
   if (row > extent().row) return nullptr;
+  note_read();
 
   static char16_t LF[] = {'\n', 0};
   static char16_t CRLF[] = {'\r', '\n', 0};
@@ -817,7 +1148,7 @@ const char16_t *NativeTextBuffer::line_ending_for_row(uint32_t row) {
 
   const char16_t *result = NONE;
   top_layer->for_each_chunk_in_range(
-    clip_position(NativePoint(row, UINT32_MAX)).position,
+    top_layer->clip_position(NativePoint(row, UINT32_MAX), true).position,
     NativePoint(row + 1, 0),
     [&result](TextSlice slice) {
       auto begin = slice.begin();
@@ -829,39 +1160,53 @@ const char16_t *NativeTextBuffer::line_ending_for_row(uint32_t row) {
 }
 
 void NativeTextBuffer::with_line_for_row(uint32_t row, const std::function<void(const char16_t *, uint32_t)> &callback) {
-  u16string result;
-  uint32_t column = 0;
+  TextSlice line = line_slice_for_row(row);
+  callback(line.data(), line.size());
+}
+
+optional<u16string> NativeTextBuffer::line_for_row(uint32_t row) {
+  if (row > extent().row) return optional<u16string>{};
+  TextSlice line = line_slice_for_row(row);
+  return u16string(line.begin(), line.end());
+}
+
+TextSlice NativeTextBuffer::line_slice_for_row(uint32_t row) {
+  LineCacheEntry &entry = line_cache[row % LINE_CACHE_SIZE];
+  if (entry.generation == generation && entry.row == row) return entry.slice;
+
+  note_read();
+  NativePoint line_end = top_layer->clip_position({row, UINT32_MAX}, true).position;
+  TextSlice result{EMPTY_TEXT};
   uint32_t slice_count = 0;
-  NativePoint line_end = clip_position({row, UINT32_MAX}).position;
   top_layer->for_each_chunk_in_range({row, 0}, line_end, [&](TextSlice slice) -> bool {
-    auto begin = slice.begin(), end = slice.end();
-    size_t size = end - begin;
-    slice_count++;
-    column += size;
-    if (slice_count == 1 && column == line_end.column) {
-      callback(slice.data(), slice.size());
-      return true;
+    if (++slice_count == 1) {
+      result = slice;
     } else {
-      result.insert(result.end(), begin, end);
-      return false;
+      // Reuse the entry's storage, so that reading many rows doesn't
+      // allocate for each one.
+      if (slice_count == 2) {
+        entry.text.clear();
+        entry.text.append(result);
+      }
+      entry.text.append(slice);
     }
-  });
-
-  if (slice_count != 1) {
-    callback(result.c_str(), result.size());
-  }
-}
+    return false;
+  }, true);
+  if (slice_count > 1) result = TextSlice{entry.text};
 
-optional<u16string> NativeTextBuffer::line_for_row(uint32_t row) {
-  if (row > extent().row) return optional<u16string>{};
-  return text_in_range({{row, 0}, {row, UINT32_MAX}});
+  entry.generation = generation;
+  entry.row = row;
+  entry.slice = result;
+  return result;
 }
 
 ClipResult NativeTextBuffer::clip_position(NativePoint position) {
+  note_read();
   return top_layer->clip_position(position, true);
 }
 
 NativePoint NativeTextBuffer::position_for_offset(uint32_t offset) {
+  note_read();
   return top_layer->position_for_offset(offset);
 }
 
@@ -874,6 +1219,7 @@ uint16_t NativeTextBuffer::character_at(NativePoint position) const {
 }
 
 u16string NativeTextBuffer::text_in_range(NativeRange range) {
+  note_read();
   return top_layer->text_in_range(range, true);
 }
 
@@ -890,12 +1236,46 @@ void NativeTextBuffer::set_text(const u16string &new_text) {
 }
 
 void NativeTextBuffer::set_text_in_range(NativeRange old_range, u16string &&string) {
-  if (top_layer == base_layer || top_layer->snapshot_count > 0) {
+  prepare_top_layer_for_edit();
+  splice_top_layer(old_range, move(string));
+}
+
+bool NativeTextBuffer::set_text_in_ranges(vector<pair<NativeRange, u16string>> &&edits) {
+  for (size_t i = 1; i < edits.size(); i++) {
+    if (edits[i].first.start < edits[i - 1].first.end) return false;
+  }
+  if (edits.empty()) return true;
+  prepare_top_layer_for_edit();
+
+  // Going from the last edit to the first leaves the start of each range
+  // where it was, so every range can be spliced in the buffer's original
+  // coordinates.
+  for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+    splice_top_layer(edit->first, move(edit->second));
+  }
+  return true;
+}
+
+void NativeTextBuffer::prepare_top_layer_for_edit() {
+  consolidate_released_layers();
+  generation++;
+  // A flattened layer keeps its copy of the text unless the layer below it
+  // can be read just as quickly.
+  if (top_layer == base_layer || top_layer->snapshot_count > 0 ||
+      (!top_layer->uses_patch && top_layer->previous_layer->uses_patch)) {
     top_layer = new Layer(top_layer);
+    is_search_cost_stale = true;
+  } else {
+    // Any copy of the text that squashing or flattening left in this layer
+    // is about to be out of date.
+    top_layer->text = optional<Rope>{};
+    top_layer->uses_patch = true;
   }
+}
 
-  auto start = clip_position(old_range.start);
-  auto end = old_range.end == old_range.start ? start : clip_position(old_range.end);
+void NativeTextBuffer::splice_top_layer(NativeRange old_range, u16string &&string) {
+  auto start = top_layer->clip_position(old_range.start, true);
+  auto end = old_range.end == old_range.start ? start : top_layer->clip_position(old_range.end, true);
   NativePoint deleted_extent = end.position.traversal(start.position);
   Text new_text{move(string)};
   NativePoint inserted_extent = new_text.extent();
@@ -911,6 +1291,7 @@ void NativeTextBuffer::set_text_in_range(NativeRange old_range, u16string &&stri
     move(new_text),
     deleted_text_size
   );
+  if (word_index) word_index->splice(start.position, deleted_extent, inserted_extent);
 
   auto change = top_layer->patch.grab_change_starting_before_new_position(start.position);
   if (change && change->old_text_size == change->new_text->size()) {
@@ -942,6 +1323,10 @@ vector<NativeRange> NativeTextBuffer::find_all(const Regex &regex, NativeRange r
   return top_layer->find_all_in_range(regex, range, false);
 }
 
+void NativeTextBuffer::scan(const Regex &regex, NativeRange range, const ScanCallback &callback) const {
+  top_layer->scan_in_range(regex, range, callback, false);
+}
+
 unsigned NativeTextBuffer::find_and_mark_all(MarkerIndex &index, MarkerIndex::MarkerId next_id,
                                        bool exclusive, const Regex &regex, NativeRange range) const {
   return top_layer->find_and_mark_all_in_range(index, next_id, exclusive, regex, range, false);
@@ -956,8 +1341,29 @@ bool NativeTextBuffer::SubsequenceMatch::operator==(const SubsequenceMatch &othe
   );
 }
 
-vector<SubsequenceMatch> NativeTextBuffer::find_words_with_subsequence_in_range(const u16string &query, const u16string &non_word_characters, NativeRange range) const {
-  return top_layer->find_words_with_subsequence_in_range(query, non_word_characters, range);
+vector<SubsequenceMatch> NativeTextBuffer::find_words_with_subsequence_in_range(const u16string &query,
+                                                                               const u16string &extra_word_characters,
+                                                                               NativeRange range, size_t max_count,
+                                                                               unsigned thread_count) const {
+  if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+
+  // Words that span rows can't be indexed.
+  if (extra_word_characters.find(u'\n') != u16string::npos) {
+    return top_layer->find_words_with_subsequence_in_range(query, extra_word_characters, range, max_count, thread_count);
+  }
+
+  if (!word_index || word_index->extra_word_characters() != extra_word_characters) {
+    word_index.reset(new WordIndex(extra_word_characters));
+  }
+  Layer *layer = top_layer;
+  word_index->update(extent(), [layer](NativePoint start, NativePoint end,
+                                       const std::function<void(const char16_t *, uint32_t)> &callback) {
+    layer->for_each_chunk_in_range(start, end, [&callback](TextSlice chunk) {
+      callback(chunk.data(), chunk.size());
+      return false;
+    });
+  });
+  return top_layer->find_words_with_subsequence_in_index(*word_index, query, range, max_count, thread_count);
 }
 
 bool NativeTextBuffer::is_modified() const {
@@ -1006,17 +1412,72 @@ size_t NativeTextBuffer::layer_count() const {
   return result;
 }
 
+NativeTextBuffer::LayerStats NativeTextBuffer::layer_stats() const {
+  LayerStats result{layer_count(), 0, 0, flatten_count};
+  for (const Layer *layer = top_layer; layer->uses_patch; layer = layer->previous_layer) {
+    result.search_depth++;
+    result.search_change_count += layer->patch.get_change_count();
+  }
+  return result;
+}
+
+// A patch search takes about one step per level of the patch's tree.
+static uint32_t patch_search_cost(const Patch &patch) {
+  uint32_t result = 1;
+  for (size_t change_count = patch.get_change_count(); change_count > 0; change_count >>= 1) result++;
+  return result;
+}
+
+// Accounts for the cost of a read from the top layer that could be saved by
+// flattening it, and flattens it once that cost outweighs a copy of the text.
+void NativeTextBuffer::note_read() {
+  if (is_search_cost_stale) {
+    excess_search_cost = 0;
+    if (top_layer->uses_patch) {
+      for (Layer *layer = top_layer->previous_layer; layer->uses_patch; layer = layer->previous_layer) {
+        excess_search_cost += patch_search_cost(layer->patch);
+      }
+    }
+    if (excess_search_cost == 0) deferred_search_cost = 0;
+    is_search_cost_stale = false;
+  }
+
+  if (excess_search_cost == 0) return;
+  deferred_search_cost += excess_search_cost;
+  if (deferred_search_cost >= MIN_FLATTENING_COST &&
+      deferred_search_cost * CHARACTERS_PER_PATCH_SEARCH_STEP >= top_layer->size()) {
+    flatten_layers();
+  }
+}
+
+void NativeTextBuffer::flatten_layers() {
+  // Layers held by snapshots can't change, so put the text in a new layer.
+  if (top_layer->snapshot_count > 0) top_layer = new Layer(top_layer);
+  top_layer->text = top_layer->compute_text();
+  flatten_count++;
+  deferred_search_cost = 0;
+  consolidate_layers();
+}
+
 NativeTextBuffer::Snapshot *NativeTextBuffer::create_snapshot() {
+  consolidate_released_layers();
   top_layer->snapshot_count++;
   base_layer->snapshot_count++;
   return new Snapshot(*this, *top_layer, *base_layer);
 }
 
 void NativeTextBuffer::flush_changes() {
-  if (!top_layer->text) {
-    top_layer->text = Text{text()};
+  consolidate_released_layers();
+  if (top_layer != base_layer) {
+    // When no snapshot holds the layers in between, consolidating folds their
+    // changes into the old base text. Otherwise, the new base layer needs a
+    // text of its own.
     base_layer = top_layer;
     consolidate_layers();
+    if (!top_layer->text) {
+      top_layer->text = top_layer->compute_text();
+      consolidate_layers();
+    }
   }
 }
 
@@ -1060,12 +1521,25 @@ vector<NativeRange> NativeTextBuffer::Snapshot::find_all(const Regex &regex, Nat
   return layer.find_all_in_range(regex, range, false);
 }
 
-vector<SubsequenceMatch> NativeTextBuffer::Snapshot::find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters, NativeRange range) const {
-  return layer.find_words_with_subsequence_in_range(query, extra_word_characters, range);
+void NativeTextBuffer::Snapshot::scan(const Regex &regex, NativeRange range, const ScanCallback &callback) const {
+  layer.scan_in_range(regex, range, callback, false);
 }
 
-const Text &NativeTextBuffer::Snapshot::base_text() const {
-  return *base_layer.text;
+vector<NativeRange> NativeTextBuffer::Snapshot::find_all_in_parallel(const Regex &regex, NativeRange range,
+                                                                    unsigned thread_count) const {
+  if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+  return layer.find_all_in_range_in_parallel(regex, range, thread_count);
+}
+
+vector<SubsequenceMatch> NativeTextBuffer::Snapshot::find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters,
+                                                                                         NativeRange range, size_t max_count,
+                                                                                         unsigned thread_count) const {
+  if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+  return layer.find_words_with_subsequence_in_range(query, extra_word_characters, range, max_count, thread_count);
+}
+
+Text NativeTextBuffer::Snapshot::base_text() const {
+  return Text{base_layer.text->text()};
 }
 
 NativeTextBuffer::Snapshot::Snapshot(NativeTextBuffer &buffer, NativeTextBuffer::Layer &layer,
@@ -1073,23 +1547,35 @@ NativeTextBuffer::Snapshot::Snapshot(NativeTextBuffer &buffer, NativeTextBuffer:
   : buffer{buffer}, layer{layer}, base_layer{base_layer} {}
 
 void NativeTextBuffer::Snapshot::flush_preceding_changes() {
-  if (!layer.text) {
-    layer.text = Text{text()};
-    if (layer.is_above_layer(buffer.base_layer)) buffer.base_layer = &layer;
-    buffer.consolidate_layers();
-  }
+  bool is_above_base_layer = layer.is_above_layer(buffer.base_layer);
+  if (layer.text && !is_above_base_layer) return;
+  if (!layer.text) layer.text = layer.compute_text();
+  if (is_above_base_layer) buffer.base_layer = &layer;
+  buffer.consolidate_layers();
 }
 
 NativeTextBuffer::Snapshot::~Snapshot() {
-  assert(layer.snapshot_count > 0);
-  layer.snapshot_count--;
-  base_layer.snapshot_count--;
-  if (layer.snapshot_count == 0 || base_layer.snapshot_count == 0) {
-    buffer.consolidate_layers();
+  // The buffer may free a layer as soon as its count reaches zero, so only
+  // the results of the decrements are used afterward.
+  uint32_t previous_layer_count = layer.snapshot_count--;
+  uint32_t previous_base_layer_count = base_layer.snapshot_count--;
+  assert(previous_layer_count > 0 && previous_base_layer_count > 0);
+  if (previous_layer_count == 1 || previous_base_layer_count == 1) {
+    if (std::this_thread::get_id() == buffer.owning_thread) {
+      buffer.consolidate_layers();
+    } else {
+      buffer.has_released_snapshots = true;
+    }
   }
 }
 
+void NativeTextBuffer::consolidate_released_layers() {
+  if (has_released_snapshots.exchange(false)) consolidate_layers();
+}
+
 void NativeTextBuffer::consolidate_layers() {
+  is_search_cost_stale = true;
+  generation++;
   Layer *layer = top_layer;
   vector<Layer *> mutable_layers;
   bool needed_by_layer_above = false;
@@ -1122,7 +1608,7 @@ void NativeTextBuffer::squash_layers(const vector<Layer *> &layers) {
   if (layer_count < 2) return;
 
   // Find the highest layer that has already computed its text.
-  optional<Text> text;
+  optional<Rope> text;
   for (layer_index = 0; layer_index < layer_count; layer_index++) {
     if (layers[layer_index]->text) {
       text = move(*layers[layer_index]->text);
@@ -1130,16 +1616,13 @@ void NativeTextBuffer::squash_layers(const vector<Layer *> &layers) {
     }
   }
 
-  // Incorporate into that text the patches from all the layers above.
+  // Incorporate into that text the patches from all the layers above. Each
+  // splice only touches the rope's pieces around the change.
   if (text) {
     layer_index--;
     for (; layer_index + 1 > 0; layer_index--) {
       for (auto change : layers[layer_index]->patch.get_changes()) {
-        text->splice(
-          change.new_start,
-          change.old_end.traversal(change.old_start),
-          *change.new_text
-        );
+        text->splice(change.new_start, change.old_end.traversal(change.old_start), TextSlice(*change.new_text));
       }
     }
   }
@@ -1150,15 +1633,11 @@ void NativeTextBuffer::squash_layers(const vector<Layer *> &layers) {
   Layer *previous_layer = layers.back()->previous_layer;
 
   if (previous_layer) {
-    layer_index = layer_count - 1;
-    patch = move(layers[layer_index]->patch);
-    layer_index--;
-
-    bool left_to_right = true;
-    for (; layer_index + 1 > 0; layer_index--) {
-      patch.combine(layers[layer_index]->patch, left_to_right);
-      left_to_right = !left_to_right;
+    vector<const Patch *> patches;
+    for (layer_index = layer_count - 1; layer_index + 1 > 0; layer_index--) {
+      patches.push_back(&layers[layer_index]->patch);
     }
+    patch = Patch::compose(patches);
   } else {
     assert(text);
   }
@@ -1166,6 +1645,7 @@ void NativeTextBuffer::squash_layers(const vector<Layer *> &layers) {
   layers[0]->previous_layer = previous_layer;
   layers[0]->text = move(text);
   layers[0]->patch = move(patch);
+  if (layers[0]->text) layers[0]->uses_patch = false;
 
   for (layer_index = 1; layer_index < layer_count; layer_index++) {
     delete layers[layer_index];
@@ -1193,10 +1673,35 @@ static wstring ToUTF16(string input) {
   return result;
 }
 
+// Win32 error codes aren't errno values, so translate the ones that file
+// operations commonly fail with.
+static int errno_for_last_error() {
+  switch (GetLastError()) {
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+      return ENOENT;
+    case ERROR_ACCESS_DENIED:
+      return EACCES;
+    case ERROR_SHARING_VIOLATION:
+    case ERROR_LOCK_VIOLATION:
+      return EBUSY;
+    case ERROR_NOT_SAME_DEVICE:
+      return EXDEV;
+    case ERROR_DISK_FULL:
+    case ERROR_HANDLE_DISK_FULL:
+      return ENOSPC;
+    case ERROR_NOT_ENOUGH_MEMORY:
+    case ERROR_OUTOFMEMORY:
+      return ENOMEM;
+    default:
+      return EIO;
+  }
+}
+
 static size_t get_file_size(FILE *file) {
   LARGE_INTEGER result;
   if (!GetFileSizeEx((HANDLE)_get_osfhandle(fileno(file)), &result)) {
-    errno = GetLastError();
+    errno = errno_for_last_error();
     return -1;
   }
   return static_cast<size_t>(result.QuadPart);
@@ -1209,8 +1714,63 @@ static FILE *open_file(const string &name, const char *flags) {
   return _wfopen(ToUTF16(name).c_str(), wide_flags);
 }
 
+// Reads `size` bytes at `offset`, returning false if they can't all be read.
+// This moves the file's position.
+static bool read_file_at(FILE *file, size_t offset, char *buffer, size_t size) {
+  HANDLE handle = (HANDLE)_get_osfhandle(fileno(file));
+  while (size > 0) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+    DWORD bytes_read;
+    DWORD bytes_to_read = static_cast<DWORD>(std::min<size_t>(size, 1 << 30));
+    if (!ReadFile(handle, buffer, bytes_to_read, &bytes_read, &overlapped) || bytes_read == 0) {
+      return false;
+    }
+    buffer += bytes_read;
+    offset += bytes_read;
+    size -= bytes_read;
+  }
+  return true;
+}
+
+static FILE *open_temp_file_for(const string &file_name, string *temp_file_name, string *target_file_name) {
+  DWORD attributes = GetFileAttributesW(ToUTF16(file_name).c_str());
+  if (attributes == INVALID_FILE_ATTRIBUTES) return nullptr;
+  if (attributes & (FILE_ATTRIBUTE_REPARSE_POINT | FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_DIRECTORY)) return nullptr;
+
+  static std::atomic<unsigned> temp_file_count{0};
+  *temp_file_name = file_name + ".~" + std::to_string(GetCurrentProcessId()) +
+    "-" + std::to_string(temp_file_count++) + ".tmp";
+  *target_file_name = file_name;
+  return open_file(*temp_file_name, "wbx");
+}
+
+static bool sync_file(FILE *file) {
+  return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+}
+
+static bool replace_file(const string &temp_file_name, const string &target_file_name) {
+  if (!MoveFileExW(
+    ToUTF16(temp_file_name).c_str(),
+    ToUTF16(target_file_name).c_str(),
+    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+  )) {
+    errno = errno_for_last_error();
+    return false;
+  }
+  return true;
+}
+
+static void remove_file(const string &name) {
+  _wunlink(ToUTF16(name).c_str());
+}
+
 #else
 
+#include <fcntl.h>
+#include <unistd.h>
+
 static size_t get_file_size(FILE *file) {
   struct stat file_stats;
   if (fstat(fileno(file), &file_stats) != 0) return -1;
@@ -1221,9 +1781,85 @@ static FILE *open_file(const std::string &name, const char *flags) {
   return fopen(name.c_str(), flags);
 }
 
+// Reads `size` bytes at `offset`, returning false if they can't all be read.
+static bool read_file_at(FILE *file, size_t offset, char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t bytes_read = pread(fileno(file), buffer, size, offset);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read <= 0) return false;
+    buffer += bytes_read;
+    offset += bytes_read;
+    size -= bytes_read;
+  }
+  return true;
+}
+
+// Opens a new file next to the one that symlinks in `file_name` resolve to,
+// with that file's mode and owner, so that it can replace it atomically once
+// it's written. Returns null when the target has to be written in place
+// instead: when it doesn't exist yet, has other hard links, or its directory
+// or ownership can't be reproduced.
+static FILE *open_temp_file_for(const string &file_name, string *temp_file_name, string *target_file_name) {
+  char *resolved_name = realpath(file_name.c_str(), nullptr);
+  if (!resolved_name) return nullptr;
+  *target_file_name = resolved_name;
+  free(resolved_name);
+
+  struct stat target_stats;
+  if (stat(target_file_name->c_str(), &target_stats) != 0) return nullptr;
+  if (!S_ISREG(target_stats.st_mode) || target_stats.st_nlink > 1) return nullptr;
+
+  size_t name_start = target_file_name->rfind('/') + 1;
+  *temp_file_name = target_file_name->substr(0, name_start) + "." +
+    target_file_name->substr(name_start) + ".XXXXXX";
+  int descriptor = mkstemp(&(*temp_file_name)[0]);
+  if (descriptor == -1) return nullptr;
+
+  struct stat temp_stats;
+  if (
+    fstat(descriptor, &temp_stats) != 0 ||
+    fchmod(descriptor, target_stats.st_mode & 07777) != 0 ||
+    ((temp_stats.st_uid != target_stats.st_uid || temp_stats.st_gid != target_stats.st_gid) &&
+     fchown(descriptor, target_stats.st_uid, target_stats.st_gid) != 0)
+  ) {
+    close(descriptor);
+    unlink(temp_file_name->c_str());
+    return nullptr;
+  }
+
+  FILE *file = fdopen(descriptor, "wb");
+  if (!file) {
+    close(descriptor);
+    unlink(temp_file_name->c_str());
+  }
+  return file;
+}
+
+static bool sync_file(FILE *file) {
+  return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+static bool replace_file(const string &temp_file_name, const string &target_file_name) {
+  if (rename(temp_file_name.c_str(), target_file_name.c_str()) != 0) return false;
+
+  // Make the rename itself durable.
+  string directory_name = target_file_name.substr(0, target_file_name.rfind('/') + 1);
+  int directory = open(directory_name.empty() ? "." : directory_name.c_str(), O_RDONLY);
+  if (directory != -1) {
+    fsync(directory);
+    close(directory);
+  }
+  return true;
+}
+
+static void remove_file(const string &name) {
+  unlink(name.c_str());
+}
+
 #endif
 
 static size_t CHUNK_SIZE = 10 * 1024;
+static size_t SAVE_BUFFER_SIZE = 1024 * 1024;
 
 static const int INVALID_ENCODING = -1;
 
@@ -1232,110 +1868,290 @@ struct Error {
   const char *syscall;
 };
 
+static size_t DECODE_BLOCK_SIZE = 1024 * 1024;
+
+static void append_line_offsets(vector<uint32_t> &line_offsets, const u16string &string, size_t start) {
+  Text::index_line_offsets(line_offsets, string.data(), start, string.size());
+}
+
+// When `encoding_name` is "auto", it is replaced with the encoding that is
+// detected from the file's contents.
 template <typename Callback>
-static u16string load_file(
+static Text load_file(
   const string &file_name,
-  const string &encoding_name,
+  string *encoding_name,
   optional<Error> *error,
   const Callback &callback
 ) {
-  auto conversion = transcoding_from(encoding_name.c_str());
-  if (!conversion) {
-    *error = Error{INVALID_ENCODING, nullptr};
-    return u"";
+  bool detect = is_auto_encoding(*encoding_name);
+  optional<EncodingConversion> conversion;
+  if (!detect) {
+    conversion = transcoding_from(encoding_name->c_str());
+    if (!conversion) {
+      *error = Error{INVALID_ENCODING, nullptr};
+      return Text{};
+    }
   }
 
+  // Every byte sequence can be decoded as ISO-8859-1, which needs no iconv
+  // support, so it stands in if the detected encoding is unavailable.
+  auto use_detected_encoding = [&](const char *detected_encoding_name) {
+    *encoding_name = detected_encoding_name;
+    conversion = transcoding_from(detected_encoding_name);
+    if (!conversion) {
+      *encoding_name = "ISO-8859-1";
+      conversion = transcoding_from("ISO-8859-1");
+    }
+  };
+
   FILE *file = open_file(file_name, "rb");
   if (!file) {
     *error = Error{errno, "open"};
-    return u"";
+    return Text{};
   }
 
   size_t file_size = get_file_size(file);
   if (file_size == static_cast<size_t>(-1)) {
     *error = Error{errno, "stat"};
-    return u"";
+    fclose(file);
+    return Text{};
   }
 
   u16string loaded_string;
-  vector<char> input_buffer(CHUNK_SIZE);
+  vector<uint32_t> line_offsets{0};
   loaded_string.reserve(file_size);
-  if (!conversion->decode(
-    loaded_string,
-    file,
-    input_buffer,
-    [&callback, file_size](size_t bytes_read) {
-      size_t percent_done = file_size > 0 ? 100 * bytes_read / file_size : 100;
-      callback(percent_done);
+
+  // Files are read and decoded a block at a time, indexing the line offsets
+  // of each decoded block while it is still in cache. Small files and
+  // streams (pipes and special files, whose size is zero) are read through a
+  // smaller buffer.
+  vector<char> input_buffer(file_size > CHUNK_SIZE ? DECODE_BLOCK_SIZE : CHUNK_SIZE);
+  size_t bytes_already_read = 0;
+  if (detect) {
+    // A file of known size is sampled where `detect_encoding` would look.
+    // Otherwise only the first chunk can be sampled, as a stream can't be
+    // read twice.
+    vector<char> samples;
+    bool has_samples = file_size > 0;
+    if (has_samples) {
+      for (const auto &range : encoding_detection_ranges(file_size)) {
+        samples.resize(samples.size() + range.second);
+        if (!read_file_at(file, range.first, samples.data() + samples.size() - range.second, range.second)) {
+          has_samples = false;
+          break;
+        }
+      }
+      if (fseek(file, 0, SEEK_SET) != 0) {
+        *error = Error{errno, "seek"};
+        fclose(file);
+        return Text{};
+      }
+    }
+
+    if (has_samples) {
+      use_detected_encoding(detect_encoding_from_ranges(samples.data(), file_size));
+    } else {
+      bytes_already_read = fread(input_buffer.data(), 1, CHUNK_SIZE, file);
+      use_detected_encoding(detect_encoding(input_buffer.data(), bytes_already_read, bytes_already_read < CHUNK_SIZE));
+    }
+  }
+
+  // A file that ends before its original size, as one that is truncated to
+  // be rewritten does, is read again from the start, once.
+  bool may_restart = file_size > 0;
+  for (;;) {
+    size_t indexed_size = 0;
+    size_t total_bytes_read = 0;
+    bool is_stopped = false;
+    bool decoded = conversion->decode(
+      loaded_string,
+      file,
+      input_buffer,
+      bytes_already_read,
+      [&](size_t bytes_read) {
+        append_line_offsets(line_offsets, loaded_string, indexed_size);
+        indexed_size = loaded_string.size();
+        total_bytes_read = bytes_read;
+        size_t percent_done = file_size > 0 ? 100 * bytes_read / file_size : 100;
+        is_stopped = !callback(percent_done);
+        return !is_stopped;
+      }
+    );
+    if (!decoded) {
+      *error = Error{errno, "read"};
+      break;
+    }
+
+    append_line_offsets(line_offsets, loaded_string, indexed_size);
+    if (!may_restart || is_stopped || total_bytes_read >= file_size) break;
+
+    may_restart = false;
+    bytes_already_read = 0;
+    loaded_string.clear();
+    line_offsets.assign(1, 0);
+    if (fseek(file, 0, SEEK_SET) != 0) {
+      *error = Error{errno, "seek"};
+      break;
     }
-  )) {
-    *error = Error{errno, "read"};
   }
 
   fclose(file);
-  return loaded_string;
+  return Text{move(loaded_string), move(line_offsets)};
 }
 
-optional<Patch> NativeTextBuffer::load(
-  const std::string &file_name,
-  const std::string &encoding_name,
-  std::function<void(size_t, const optional<Patch> &)> progress_callback
-) {
-  NativeTextBuffer *buffer = this;
-  NativeTextBuffer::Snapshot *snapshot = this->create_snapshot();
+struct NativeTextBuffer::Loader {
+  NativeTextBuffer *buffer;
+  NativeTextBuffer::Snapshot *snapshot;
+  string file_name;
+  string encoding_name;
+  std::function<void(size_t, const optional<Patch> &)> progress_callback;
   optional<Text> loaded_text;
   optional<Error> error;
   Patch patch;
-  bool force = false;
-  bool compute_patch = true;
-  bool cancelled = false;
-
-  auto callback = [](size_t percent_done) {};
+  bool force;
+  bool compute_patch;
+  bool reports_progress;
+  std::atomic<bool> cancelled;
+  std::atomic<size_t> percent_done;
+
+  Loader(NativeTextBuffer *buffer, const string &file_name, const string &encoding_name,
+         std::function<void(size_t, const optional<Patch> &)> progress_callback,
+         bool force, bool compute_patch, bool reports_progress) :
+    buffer{buffer},
+    snapshot{buffer->create_snapshot()},
+    file_name{file_name},
+    encoding_name{encoding_name},
+    progress_callback{progress_callback},
+    force{force},
+    compute_patch{compute_patch},
+    reports_progress{reports_progress},
+    cancelled{false},
+    percent_done{0} {}
+
+  ~Loader() {
+    if (snapshot) delete snapshot;
+  }
 
-  // Execute
-  if (!loaded_text) loaded_text = Text{load_file(file_name, encoding_name, &error, callback)};
-  if (!error && compute_patch) patch = text_diff(snapshot->base_text(), *loaded_text);
+  // Reads, decodes and diffs the file against the snapshot's base text. This
+  // only reads from the snapshot, so it may run on any thread.
+  void execute() {
+    auto callback = [this](size_t percent) {
+      percent_done = percent;
+      if (cancelled) return false;
+      if (reports_progress && progress_callback && percent < 100) progress_callback(percent, optional<Patch>{});
+      return true;
+    };
 
-  // Finish
-  if (error) {
-    delete snapshot;
-    return optional<Patch>{};
+    if (!loaded_text) loaded_text = load_file(file_name, &encoding_name, &error, callback);
+    if (!error && !cancelled && compute_patch) patch = text_diff(snapshot->base_text(), *loaded_text);
   }
 
-  if (cancelled || (!force && buffer->is_modified())) {
+  // Applies the loaded text to the buffer. This must run on the thread that
+  // owns the buffer.
+  optional<Patch> finish() {
+    if (error) {
+      delete snapshot;
+      snapshot = nullptr;
+      return optional<Patch>{};
+    }
+
+    if (cancelled || (!force && buffer->is_modified())) {
+      delete snapshot;
+      snapshot = nullptr;
+      return optional<Patch>{};
+    }
+
+    Patch inverted_changes = buffer->get_inverted_changes(snapshot);
     delete snapshot;
-    return optional<Patch>{};
-  }
+    snapshot = nullptr;
+
+    if (compute_patch && inverted_changes.get_change_count() > 0) {
+      inverted_changes.combine(patch);
+      patch = move(inverted_changes);
+    }
 
-  Patch inverted_changes = buffer->get_inverted_changes(snapshot);
-  delete snapshot;
+    bool has_changed;
+    optional<Patch> patch_wrapper;
+    if (compute_patch) {
+      has_changed = !compute_patch || patch.get_change_count() > 0;
+      patch_wrapper = move(patch);
+    } else {
+      has_changed = true;
+      patch_wrapper = optional<Patch>{};
+    }
 
-  if (compute_patch && inverted_changes.get_change_count() > 0) {
-    inverted_changes.combine(patch);
-    patch = move(inverted_changes);
-  }
+    if (progress_callback) {
+      progress_callback(100, patch_wrapper);
+    }
 
-  bool has_changed;
-  optional<Patch> patch_wrapper;
-  if (compute_patch) {
-    has_changed = !compute_patch || patch.get_change_count() > 0;
-    patch_wrapper = move(patch);
-  } else {
-    has_changed = true;
-    patch_wrapper = optional<Patch>{};
-  }
+    if (has_changed) {
+      buffer->reset(move(*loaded_text));
+    } else {
+      buffer->flush_changes();
+    }
 
-  if (progress_callback) {
-    progress_callback(100, patch_wrapper);
+    return patch_wrapper;
   }
+};
 
-  if (has_changed) {
-    buffer->reset(move(*loaded_text));
-  } else {
-    buffer->flush_changes();
-  }
+optional<Patch> NativeTextBuffer::load(
+  const std::string &file_name,
+  const std::string &encoding_name,
+  std::function<void(size_t, const optional<Patch> &)> progress_callback,
+  std::string *loaded_encoding_name
+) {
+  Loader loader{this, file_name, encoding_name, progress_callback, false, true, false};
+  loader.execute();
+  if (loaded_encoding_name) *loaded_encoding_name = loader.encoding_name;
+  return loader.finish();
+}
 
-  return patch_wrapper;
+NativeTextBuffer::LoadOperation *NativeTextBuffer::load_async(
+  const std::string &file_name,
+  const std::string &encoding_name,
+  std::function<void(size_t, const optional<Patch> &)> progress_callback,
+  bool force
+) {
+  return new LoadOperation(new Loader{this, file_name, encoding_name, progress_callback, force, true, true});
+}
+
+NativeTextBuffer::LoadOperation::LoadOperation(Loader *loader) :
+  loader{loader},
+  is_finished{false} {
+  thread = std::thread([this]() {
+    this->loader->execute();
+    is_executed = true;
+  });
+}
+
+NativeTextBuffer::LoadOperation::~LoadOperation() {
+  cancel();
+  if (thread.joinable()) thread.join();
+  delete loader;
+}
+
+void NativeTextBuffer::LoadOperation::cancel() {
+  loader->cancelled = true;
+}
+
+bool NativeTextBuffer::LoadOperation::is_done() const {
+  return is_executed;
+}
+
+size_t NativeTextBuffer::LoadOperation::percent_done() const {
+  return loader->percent_done;
+}
+
+// The encoding the file was decoded with, once the operation is done.
+const std::string &NativeTextBuffer::LoadOperation::encoding_name() const {
+  return loader->encoding_name;
+}
+
+optional<Patch> NativeTextBuffer::LoadOperation::finish() {
+  if (thread.joinable()) thread.join();
+  if (is_finished) return optional<Patch>{};
+  is_finished = true;
+  return loader->finish();
 }
 
 static void save_file(
@@ -1350,12 +2166,28 @@ static void save_file(
     return;
   }
 
-  FILE *file = open_file(file_name, "wb+");
+  // Write to a temporary file and rename it over the target once it's
+  // safely on disk, so that a failed save never leaves a truncated file.
+  string temp_file_name, target_file_name;
+  FILE *file = open_temp_file_for(file_name, &temp_file_name, &target_file_name);
+  if (!file) {
+    temp_file_name.clear();
+    file = open_file(file_name, "wb+");
+  }
   if (!file) {
     *error = Error{errno, "open"};
     return;
   }
 
+  auto fail = [&](const char *syscall) {
+    *error = Error{errno, syscall};
+    fclose(file);
+    if (!temp_file_name.empty()) remove_file(temp_file_name);
+  };
+
+  // Edited buffers have many small chunks, so gather their encoded output in
+  // a large stream buffer to keep the number of writes down.
+  setvbuf(file, nullptr, _IOFBF, SAVE_BUFFER_SIZE);
   vector<char> output_buffer(CHUNK_SIZE);
   for (TextSlice &chunk : snapshot->chunks()) {
     if (!conversion->encode(
@@ -1365,13 +2197,22 @@ static void save_file(
       file,
       output_buffer
     )) {
-      *error = Error{errno, "write"};
-      fclose(file);
-      return;
+      return fail("write");
     }
   }
 
-  fclose(file);
+  if (!sync_file(file)) return fail("fsync");
+
+  if (fclose(file) != 0) {
+    *error = Error{errno, "close"};
+    if (!temp_file_name.empty()) remove_file(temp_file_name);
+    return;
+  }
+
+  if (!temp_file_name.empty() && !replace_file(temp_file_name, target_file_name)) {
+    *error = Error{errno, "rename"};
+    remove_file(temp_file_name);
+  }
 }
 
 void NativeTextBuffer::save(const std::string &file_name, const std::string &encoding_name) {
@@ -1,25 +1,68 @@
 #ifndef SUPERSTRING_TEXT_BUFFER_H_
 #define SUPERSTRING_TEXT_BUFFER_H_
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include "text.h"
+#include "text-slice.h"
 #include "patch.h"
 #include "native-point.h"
 #include "native-range.h"
 #include "regex.h"
 #include "marker-index.h"
 
+class WordIndex;
+
 class NativeTextBuffer {
   struct Layer;
+  struct Loader;
   Layer *base_layer;
   Layer *top_layer;
+  mutable std::unique_ptr<WordIndex> word_index;
+  std::thread::id owning_thread;
+  std::atomic<bool> has_released_snapshots;
+  uint64_t deferred_search_cost;
+  uint32_t excess_search_cost;
+  bool is_search_cost_stale;
+  size_t flatten_count;
+
+  // Recently read lines that span several chunks, in slots chosen by row.
+  // Entries from an older generation are stale; the generation changes
+  // whenever the layers do.
+  struct LineCacheEntry {
+    uint64_t generation;
+    uint32_t row;
+    TextSlice slice;
+    Text text;
+  };
+  static const uint32_t LINE_CACHE_SIZE = 16;
+  uint64_t generation;
+  LineCacheEntry line_cache[LINE_CACHE_SIZE];
+
   void squash_layers(const std::vector<Layer *> &);
   void consolidate_layers();
+  void consolidate_released_layers();
+  void note_read();
+  void flatten_layers();
+  void prepare_top_layer_for_edit();
+  void splice_top_layer(NativeRange, std::u16string &&);
 
 public:
   static uint32_t MAX_CHUNK_SIZE_TO_COPY;
 
+  // Reads that have to search the patches of layers that snapshots keep
+  // below the top layer cost about this many copied characters per step of
+  // each patch search. Once that cost adds up to the size of the text, and
+  // to at least `MIN_FLATTENING_COST` steps, the top layer is given a copy of
+  // the text so that reads stop there.
+  static uint32_t CHARACTERS_PER_PATCH_SEARCH_STEP;
+  static uint32_t MIN_FLATTENING_COST;
+
   NativeTextBuffer();
   NativeTextBuffer(std::u16string &&);
   NativeTextBuffer(const std::u16string &text);
@@ -30,6 +73,11 @@ public:
   optional<std::u16string> line_for_row(uint32_t row);
   void with_line_for_row(uint32_t row, const std::function<void(const char16_t *, uint32_t)> &);
 
+  // The row's text without its line ending, without copying it when it is
+  // stored in one piece. The slice is only valid until the next call to a
+  // non-const method of the buffer.
+  TextSlice line_slice_for_row(uint32_t row);
+
   optional<uint32_t> line_length_for_row(uint32_t row);
   const char16_t *line_ending_for_row(uint32_t row);
   ClipResult clip_position(NativePoint);
@@ -41,6 +89,12 @@ public:
   void set_text(const std::u16string &);
   void set_text_in_range(NativeRange old_range, std::u16string &&);
   void set_text_in_range(NativeRange old_range, const std::u16string &);
+
+  // Replaces each range with its text in one change to the buffer. The
+  // ranges must be sorted and must not overlap, and all of them refer to
+  // the text as it was before any of the edits. Otherwise nothing is
+  // changed and false is returned.
+  bool set_text_in_ranges(std::vector<std::pair<NativeRange, std::u16string>> &&);
   bool is_modified() const;
   bool has_astral();
   std::vector<TextSlice> chunks() const;
@@ -49,10 +103,14 @@ public:
   void flush_changes();
   void serialize_changes(Serializer &);
   bool deserialize_changes(Deserializer &);
-  const Text &base_text() const;
+  // The base text is kept as a rope, so this builds a copy of it.
+  Text base_text() const;
 
   optional<NativeRange> find(const Regex &, NativeRange range = NativeRange::all_inclusive()) const;
   std::vector<NativeRange> find_all(const Regex &, NativeRange range = NativeRange::all_inclusive()) const;
+  // Calls the callback with each match in order, stopping once it returns true.
+  using ScanCallback = std::function<bool(NativeRange)>;
+  void scan(const Regex &, NativeRange range, const ScanCallback &) const;
   unsigned find_and_mark_all(MarkerIndex &, MarkerIndex::MarkerId, bool exclusive,
                              const Regex &, NativeRange range = NativeRange::all_inclusive()) const;
 
@@ -64,8 +122,19 @@ public:
     bool operator==(const SubsequenceMatch &) const;
   };
 
-  std::vector<SubsequenceMatch> find_words_with_subsequence_in_range(const std::u16string &, const std::u16string &, NativeRange) const;
-
+  // Finds the words in the range that contain the query as a subsequence,
+  // best match first. A `max_count` of zero returns all of them, and a
+  // `thread_count` of zero scores them on one thread per core. The buffer
+  // keeps an index of its words for the most recent `extra_word_characters`.
+  std::vector<SubsequenceMatch> find_words_with_subsequence_in_range(const std::u16string &, const std::u16string &, NativeRange,
+                                                                     size_t max_count = 0, unsigned thread_count = 0) const;
+
+  // A buffer belongs to the thread that constructed it, and only that thread
+  // may call its methods, create snapshots of it or flush a snapshot's
+  // preceding changes. Snapshots may be read on any number of threads while
+  // the buffer is edited, and may be deleted on any thread, as long as the
+  // buffer outlives them. When a snapshot is deleted on another thread, the
+  // layers it held are reclaimed by the buffer's next edit or snapshot.
   class Snapshot {
     friend class NativeTextBuffer;
     NativeTextBuffer &buffer;
@@ -86,10 +155,15 @@ public:
     std::vector<std::pair<const char16_t *, uint32_t>> primitive_chunks() const;
     std::u16string text() const;
     std::u16string text_in_range(NativeRange) const;
-    const Text &base_text() const;
+    Text base_text() const;
     optional<NativeRange> find(const Regex &, NativeRange range = NativeRange::all_inclusive()) const;
     std::vector<NativeRange> find_all(const Regex &, NativeRange range = NativeRange::all_inclusive()) const;
-    std::vector<SubsequenceMatch> find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters, NativeRange range) const;
+    void scan(const Regex &, NativeRange range, const ScanCallback &) const;
+    std::vector<NativeRange> find_all_in_parallel(const Regex &, NativeRange range = NativeRange::all_inclusive(),
+                                                  unsigned thread_count = 0) const;
+    std::vector<SubsequenceMatch> find_words_with_subsequence_in_range(std::u16string query, const std::u16string &extra_word_characters,
+                                                                       NativeRange range, size_t max_count = 0,
+                                                                       unsigned thread_count = 0) const;
   };
 
   friend class Snapshot;
@@ -98,10 +172,55 @@ public:
   bool is_modified(const Snapshot *) const;
   Patch get_inverted_changes(const Snapshot *) const;
 
+  struct LayerStats {
+    // Every layer, including those only kept for snapshots.
+    size_t layer_count;
+    // The layers whose patches a read from the top layer may search, and
+    // the number of changes in those patches.
+    size_t search_depth;
+    size_t search_change_count;
+    size_t flatten_count;
+  };
+
   size_t layer_count()  const;
+  LayerStats layer_stats() const;
   std::string get_dot_graph() const;
 
-  optional<Patch> load(const std::string &, const std::string &, std::function<void(size_t, const optional<Patch> &)>);
+  // An encoding name of "auto" detects the encoding from the file's
+  // contents; the name of the encoding used is stored in `loaded_encoding_name`.
+  // `progress_callback` is only called once, with 100 and the resulting patch.
+  optional<Patch> load(const std::string &, const std::string &, std::function<void(size_t, const optional<Patch> &)>,
+                       std::string *loaded_encoding_name = nullptr);
+
+  // Reads, decodes and diffs a file on a worker thread against a snapshot of
+  // the buffer. While loading, `progress_callback` is called on the worker
+  // thread with the percentage of the file decoded and an empty patch. The
+  // buffer itself is only updated by `finish`, which must be called on the
+  // thread that owns the buffer; it calls `progress_callback` one last time
+  // with 100 and the resulting patch. Deleting the operation cancels it and
+  // releases its snapshot of the buffer, so an operation must be deleted
+  // before the buffer it loads into.
+  class LoadOperation {
+    friend class NativeTextBuffer;
+    Loader *loader;
+    std::thread thread;
+    std::atomic<bool> is_executed{false};
+    bool is_finished;
+
+    LoadOperation(Loader *);
+
+  public:
+    ~LoadOperation();
+    void cancel();
+    bool is_done() const;
+    size_t percent_done() const;
+    const std::string &encoding_name() const;
+    optional<Patch> finish();
+  };
+
+  LoadOperation *load_async(const std::string &, const std::string &,
+                            std::function<void(size_t, const optional<Patch> &)>,
+                            bool force = false);
   void save(const std::string &, const std::string &);
 };
 
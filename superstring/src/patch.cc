@@ -1,10 +1,12 @@
 #include "patch.h"
 #include "optional.h"
+#include "slab-allocator.h"
 #include "text.h"
 #include "text-slice.h"
+#include <algorithm>
 #include <assert.h>
-#include <cmath>
 #include <memory>
+#include <new>
 #include <stdio.h>
 #include <sstream>
 #include <vector>
@@ -12,12 +14,63 @@
 using std::function;
 using std::move;
 using std::vector;
-using std::unique_ptr;
 using std::ostream;
 using std::endl;
 using Change = Patch::Change;
 
-static const uint32_t SERIALIZATION_VERSION = 1;
+// Version 1 wrote the changes directly after the version. Later versions
+// wrap them in a length-prefixed block, and write the texts that fit with one
+// byte per code unit.
+static const uint32_t SERIALIZATION_VERSION = 2;
+
+// A change's Text object, stored inside its node rather than behind a
+// unique_ptr, so the Text object itself takes no separate allocation. The
+// Text's content and line offsets are still allocated as usual.
+class EmbeddedText {
+  alignas(Text) char storage[sizeof(Text)];
+  bool is_present;
+
+ public:
+  EmbeddedText() : is_present{false} {}
+  EmbeddedText(const EmbeddedText &) = delete;
+  ~EmbeddedText() { reset(); }
+
+  void assign(Text &&text) {
+    if (is_present) {
+      *get() = move(text);
+    } else {
+      new (storage) Text(move(text));
+      is_present = true;
+    }
+  }
+
+  void reset() {
+    if (is_present) {
+      get()->~Text();
+      is_present = false;
+    }
+  }
+
+  void swap(EmbeddedText &other) {
+    if (is_present && other.is_present) {
+      std::swap(*get(), *other.get());
+    } else if (is_present) {
+      other.assign(move(*get()));
+      reset();
+    } else if (other.is_present) {
+      assign(move(*other.get()));
+      other.reset();
+    }
+  }
+
+  Text *get() const {
+    return is_present ? reinterpret_cast<Text *>(const_cast<char *>(storage)) : nullptr;
+  }
+
+  Text &operator*() const { return *get(); }
+  Text *operator->() const { return get(); }
+  explicit operator bool() const { return is_present; }
+};
 
 struct Patch::Node {
   Node *left;
@@ -29,8 +82,8 @@ struct Patch::Node {
   NativePoint old_distance_from_left_ancestor;
   NativePoint new_distance_from_left_ancestor;
 
-  unique_ptr<Text> old_text;
-  unique_ptr<Text> new_text;
+  EmbeddedText old_text;
+  EmbeddedText new_text;
   uint32_t old_text_size_;
 
   uint32_t old_subtree_text_size;
@@ -43,8 +96,8 @@ struct Patch::Node {
     NativePoint new_extent,
     NativePoint old_distance_from_left_ancestor,
     NativePoint new_distance_from_left_ancestor,
-    unique_ptr<Text> &&old_text,
-    unique_ptr<Text> &&new_text,
+    const Text *old_text,
+    const Text *new_text,
     uint32_t old_text_size
   ) :
     left{left},
@@ -53,13 +106,36 @@ struct Patch::Node {
     new_extent{new_extent},
     old_distance_from_left_ancestor{old_distance_from_left_ancestor},
     new_distance_from_left_ancestor{new_distance_from_left_ancestor},
-    old_text{std::move(old_text)},
-    new_text{std::move(new_text)},
     old_text_size_{old_text_size} {
+    if (old_text) this->old_text.assign(Text{*old_text});
+    if (new_text) this->new_text.assign(Text{*new_text});
     compute_subtree_text_sizes();
   }
 
-  Node(Deserializer &input) :
+  Node(
+    Node *left,
+    Node *right,
+    NativePoint old_extent,
+    NativePoint new_extent,
+    NativePoint old_distance_from_left_ancestor,
+    NativePoint new_distance_from_left_ancestor,
+    optional<Text> &&old_text,
+    optional<Text> &&new_text,
+    uint32_t old_text_size
+  ) :
+    left{left},
+    right{right},
+    old_extent{old_extent},
+    new_extent{new_extent},
+    old_distance_from_left_ancestor{old_distance_from_left_ancestor},
+    new_distance_from_left_ancestor{new_distance_from_left_ancestor},
+    old_text_size_{old_text_size} {
+    if (old_text) this->old_text.assign(move(*old_text));
+    if (new_text) this->new_text.assign(move(*new_text));
+    compute_subtree_text_sizes();
+  }
+
+  Node(Deserializer &input, bool allows_one_byte_units) :
     left{nullptr},
     right{nullptr},
     old_extent{input},
@@ -68,17 +144,14 @@ struct Patch::Node {
     new_distance_from_left_ancestor{input} {
 
     if (input.read<uint32_t>()) {
-      old_text = unique_ptr<Text>{new Text{input}};
+      old_text.assign(Text{input, allows_one_byte_units});
       old_text_size_ = 0;
     } else {
-      old_text = nullptr;
       old_text_size_ = input.read<uint32_t>();
     }
 
     if (input.read<uint32_t>()) {
-      new_text = unique_ptr<Text>{new Text{input}};
-    } else {
-      new_text = nullptr;
+      new_text.assign(Text{input, allows_one_byte_units});
     }
   }
 
@@ -91,10 +164,10 @@ struct Patch::Node {
 
   void set_old_text(optional<Text> &&text, uint32_t old_text_size) {
     if (text) {
-      old_text = unique_ptr<Text>{new Text{move(*text)}};
+      old_text.assign(move(*text));
       old_text_size_ = 0;
     } else {
-      old_text = nullptr;
+      old_text.reset();
       old_text_size_ = old_text_size;
     }
   }
@@ -113,9 +186,9 @@ struct Patch::Node {
 
   void set_new_text(optional<Text> &&text) {
     if (text) {
-      new_text = unique_ptr<Text>{new Text{move(*text)}};
+      new_text.assign(move(*text));
     } else {
-      new_text = nullptr;
+      new_text.reset();
     }
   }
 
@@ -144,35 +217,35 @@ struct Patch::Node {
     }
   }
 
-  Node *copy() {
-    auto result = new Node{
+  Node *copy(Patch &patch) {
+    auto result = patch.allocate_node(
       left,
       right,
       old_extent,
       new_extent,
       old_distance_from_left_ancestor,
       new_distance_from_left_ancestor,
-      old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
-      new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
-      old_text_size_,
-    };
+      old_text.get(),
+      new_text.get(),
+      old_text_size_
+    );
     result->old_subtree_text_size = old_subtree_text_size;
     result->new_subtree_text_size = new_subtree_text_size;
     return result;
   }
 
-  Node *invert() {
-    auto result = new Node{
+  Node *invert(Patch &patch) {
+    auto result = patch.allocate_node(
       left,
       right,
       new_extent,
       old_extent,
       new_distance_from_left_ancestor,
       old_distance_from_left_ancestor,
-      new_text ? unique_ptr<Text>(new Text(*new_text)) : nullptr,
-      old_text ? unique_ptr<Text>(new Text(*old_text)) : nullptr,
+      new_text.get(),
+      old_text.get(),
       new_text ? new_text->size() : 0
-    };
+    );
     result->old_subtree_text_size = new_subtree_text_size;
     result->new_subtree_text_size = old_subtree_text_size;
     return result;
@@ -185,14 +258,14 @@ struct Patch::Node {
     new_distance_from_left_ancestor.serialize(output);
     if (old_text) {
       output.append<uint32_t>(1);
-      old_text->serialize(output);
+      old_text->serialize(output, true);
     } else {
       output.append<uint32_t>(0);
       output.append<uint32_t>(old_text_size_);
     }
     if (new_text) {
       output.append<uint32_t>(1);
-      new_text->serialize(output);
+      new_text->serialize(output, true);
     } else {
       output.append<uint32_t>(0);
     }
@@ -279,6 +352,22 @@ struct Patch::Node {
   }
 };
 
+// The first few nodes live in the allocator itself, so a patch with a single
+// change needs just one allocation. Everything is released at once when the
+// patch is cleared or destroyed.
+struct Patch::NodeAllocator : slab_allocator<Patch::Node, 2, 8, 1024> {};
+
+template <typename... Args>
+Patch::Node *Patch::allocate_node(Args &&... args) {
+  if (!node_allocator) node_allocator.reset(new NodeAllocator());
+  return new (node_allocator->allocate()) Node(std::forward<Args>(args)...);
+}
+
+void Patch::free_node(Node *node) {
+  node->~Node();
+  node_allocator->free(node);
+}
+
 struct Patch::PositionStackEntry {
   NativePoint old_end;
   NativePoint new_end;
@@ -324,10 +413,6 @@ Patch::Patch(Patch &&other)
   *this = move(other);
 }
 
-Patch::Patch(Node *root, uint32_t change_count, bool merges_adjacent_changes)
-  : root{root}, change_count{change_count},
-    merges_adjacent_changes{merges_adjacent_changes} {}
-
 enum Transition : uint32_t { None, Left, Right, Up };
 
 Patch::Patch(Deserializer &input) :
@@ -335,38 +420,49 @@ Patch::Patch(Deserializer &input) :
   change_count{0},
   merges_adjacent_changes{true} {
   uint32_t serialization_version = input.read<uint32_t>();
-  if (serialization_version != SERIALIZATION_VERSION) return;
+  if (serialization_version == 1) {
+    deserialize_nodes(input, false);
+  } else {
+    Deserializer block = input.read_block();
+    if (serialization_version == SERIALIZATION_VERSION) deserialize_nodes(block, true);
+  }
+}
 
+void Patch::deserialize_nodes(Deserializer &input, bool allows_one_byte_units) {
   change_count = input.read<uint32_t>();
   if (change_count == 0) return;
 
-  node_stack.reserve(change_count);
-  root = new Node(input);
+  node_stack.reserve(std::min<size_t>(change_count, input.remaining()));
+  root = allocate_node(input, allows_one_byte_units);
   Node *node = root, *next_node = nullptr;
 
   for (uint32_t i = 1; i < change_count;) {
     switch (input.read<uint32_t>()) {
     case Left:
-      next_node = new Node(input);
+      next_node = allocate_node(input, allows_one_byte_units);
       node->left = next_node;
       node_stack.push_back(node);
       node = next_node;
       i++;
       break;
     case Right:
-      next_node = new Node(input);
+      next_node = allocate_node(input, allows_one_byte_units);
       node->right = next_node;
       node_stack.push_back(node);
       node = next_node;
       i++;
       break;
     case Up:
+      if (node_stack.empty()) {
+        clear();
+        return;
+      }
       node->compute_subtree_text_sizes();
       node = node_stack.back();
       node_stack.pop_back();
       break;
     default:
-      delete root;
+      clear();
       return;
     }
   }
@@ -379,6 +475,7 @@ Patch::Patch(Deserializer &input) :
 
 Patch &Patch::operator=(Patch &&other) {
   std::swap(root, other.root);
+  std::swap(node_allocator, other.node_allocator);
   std::swap(left_ancestor_stack, other.left_ancestor_stack);
   std::swap(node_stack, other.node_stack);
   std::swap(change_count, other.change_count);
@@ -387,25 +484,367 @@ Patch &Patch::operator=(Patch &&other) {
 }
 
 Patch::~Patch() {
-  if (root) delete_node(&root);
+  clear();
 }
 
-Patch Patch::compose(const std::vector<Patch *> &patches) {
-  Patch combination;
-  bool left_to_right = true;
-  for (size_t i = 0, n = patches.size(); i < n; i++) {
-    const Patch *patch = patches[i];
-    combination.combine(*patch, left_to_right);
-    left_to_right = !left_to_right;
+// Composition
+//
+// Rather than splicing every change of every patch into one accumulating
+// tree, patches are composed by merging their sorted change lists pairwise
+// in a single sweep, and the final list is linked into a balanced tree
+// bottom-up. Composing n patches with m total changes is O(m log n).
+
+struct Patch::Composer {
+  struct Hunk {
+    NativePoint old_start;
+    NativePoint old_end;
+    NativePoint new_start;
+    NativePoint new_end;
+    const Text *old_text;
+    const Text *new_text;
+    uint32_t old_text_size;
+  };
+
+  struct Frame {
+    const Node *node;
+    NativePoint left_ancestor_old_end;
+    NativePoint left_ancestor_new_end;
+  };
+
+  // Two scratch lists per level of recursion, reused between siblings.
+  vector<vector<Hunk>> buffers;
+  vector<Frame> frames;
+  vector<std::unique_ptr<Text>> texts;
+
+  Composer(size_t patch_count) {
+    size_t depth = 1;
+    for (size_t count = 1; count < patch_count; count *= 2) depth++;
+    buffers.resize(2 * depth);
+  }
+
+  void compose(const vector<const Patch *> &patches, size_t begin, size_t end,
+               size_t depth, vector<Hunk> &output) {
+    vector<Hunk> &earlier = buffers[2 * depth];
+    vector<Hunk> &later = buffers[2 * depth + 1];
+    earlier.clear();
+    later.clear();
+
+    if (end - begin == 1) {
+      const Patch &patch = *patches[begin];
+      if (patch.merges_adjacent_changes) {
+        append_changes(patch, output);
+      } else {
+        // Composing with an empty list merges any adjacent changes.
+        append_changes(patch, later);
+        merge(earlier, later, output);
+      }
+      return;
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    compose(patches, begin, middle, depth + 1, earlier);
+    compose(patches, middle, end, depth + 1, later);
+    merge(earlier, later, output);
+  }
+
+  // Appends the patch's changes in order, skipping any that are empty or that
+  // don't change their text, as `combine` would.
+  void append_changes(const Patch &patch, vector<Hunk> &output) {
+    const Node *node = patch.root;
+    NativePoint left_ancestor_old_end, left_ancestor_new_end;
+    frames.clear();
+    while (node || !frames.empty()) {
+      while (node) {
+        frames.push_back({node, left_ancestor_old_end, left_ancestor_new_end});
+        node = node->left;
+      }
+
+      Frame frame = frames.back();
+      frames.pop_back();
+      node = frame.node;
+      NativePoint old_start =
+        frame.left_ancestor_old_end.traverse(node->old_distance_from_left_ancestor);
+      NativePoint new_start =
+        frame.left_ancestor_new_end.traverse(node->new_distance_from_left_ancestor);
+      left_ancestor_old_end = old_start.traverse(node->old_extent);
+      left_ancestor_new_end = new_start.traverse(node->new_extent);
+
+      bool is_empty = node->old_extent.is_zero() && node->new_extent.is_zero();
+      bool is_noop = node->old_text && node->new_text && *node->old_text == *node->new_text;
+      if (!is_empty && !is_noop) {
+        output.push_back(Hunk{
+          old_start, left_ancestor_old_end,
+          new_start, left_ancestor_new_end,
+          node->old_text.get(), node->new_text.get(),
+          node->old_text_size()
+        });
+      }
+      node = node->right;
+    }
+  }
+
+  // A hunk's range in the intermediate text: the new range of a hunk from the
+  // earlier list, or the old range of a hunk from the later one.
+  static NativePoint intermediate_start(const Hunk &hunk, bool earlier) {
+    return earlier ? hunk.new_start : hunk.old_start;
+  }
+
+  static NativePoint intermediate_end(const Hunk &hunk, bool earlier) {
+    return earlier ? hunk.new_end : hunk.old_end;
+  }
+
+  static const Text *intermediate_text(const Hunk &hunk, bool earlier) {
+    return earlier ? hunk.new_text : hunk.old_text;
+  }
+
+  // Calls `callback` with each slice of the hunks' intermediate text that
+  // lies between `start` and `end`, advancing `cursor` past hunks that end
+  // before `start`. Returns false if a hunk that is needed has no text.
+  template <typename Callback>
+  static bool slice_intermediate_text(const Hunk *&cursor, const Hunk *hunks_end, bool earlier,
+                                      NativePoint start, NativePoint end,
+                                      const Callback &callback) {
+    if (!(start < end)) return true;
+    while (cursor != hunks_end && intermediate_end(*cursor, earlier) <= start) ++cursor;
+    for (const Hunk *hunk = cursor; hunk != hunks_end; ++hunk) {
+      NativePoint hunk_start = intermediate_start(*hunk, earlier);
+      if (!(hunk_start < end)) break;
+      NativePoint slice_start = NativePoint::max(start, hunk_start);
+      NativePoint slice_end = NativePoint::min(end, intermediate_end(*hunk, earlier));
+      if (!(slice_start < slice_end)) continue;
+      const Text *text = intermediate_text(*hunk, earlier);
+      if (!text) return false;
+      callback(TextSlice(*text).slice({
+        slice_start.traversal(hunk_start),
+        slice_end.traversal(hunk_start)
+      }));
+    }
+    return true;
+  }
+
+  const Text *store(Text &&text) {
+    texts.emplace_back(new Text(move(text)));
+    return texts.back().get();
+  }
+
+  // Composes two sorted hunk lists. Hunks of the earlier list (by new range)
+  // and the later list (by old range) that overlap or touch are merged into
+  // a single hunk, the same way `splice` merges adjacent changes.
+  void merge(const vector<Hunk> &earlier, const vector<Hunk> &later, vector<Hunk> &output) {
+    output.reserve(output.size() + earlier.size() + later.size());
+
+    const Hunk *a = earlier.data(), *a_end = a + earlier.size();
+    const Hunk *b = later.data(), *b_end = b + later.size();
+    NativePoint a_old_end, a_new_end, b_old_end, b_new_end;
+
+    while (a != a_end || b != b_end) {
+      // Hunks that touch nothing in the other list only need to be shifted.
+      if (a != a_end && (b == b_end || a->new_end < b->old_start) &&
+          (a + 1 == a_end || a->new_end < a[1].new_start)) {
+        Hunk hunk = *a;
+        hunk.new_start = b_new_end.traverse(a->new_start.traversal(b_old_end));
+        hunk.new_end = b_new_end.traverse(a->new_end.traversal(b_old_end));
+        a_old_end = a->old_end;
+        a_new_end = a->new_end;
+        ++a;
+        output.push_back(hunk);
+        continue;
+      }
+
+      if (b != b_end && (a == a_end || b->old_end < a->new_start) &&
+          (b + 1 == b_end || b->old_end < b[1].old_start)) {
+        Hunk hunk = *b;
+        hunk.old_start = a_old_end.traverse(b->old_start.traversal(a_new_end));
+        hunk.old_end = a_old_end.traverse(b->old_end.traversal(a_new_end));
+        b_old_end = b->old_end;
+        b_new_end = b->new_end;
+        ++b;
+        output.push_back(hunk);
+        continue;
+      }
+
+      const Hunk *a_begin = a, *b_begin = b;
+      NativePoint start, end;
+      if (b == b_end || (a != a_end && a->new_start <= b->old_start)) {
+        start = a->new_start;
+        end = a->new_end;
+        ++a;
+      } else {
+        start = b->old_start;
+        end = b->old_end;
+        ++b;
+      }
+
+      for (;;) {
+        if (a != a_end && a->new_start <= end) {
+          end = NativePoint::max(end, a->new_end);
+          ++a;
+        } else if (b != b_end && b->old_start <= end) {
+          end = NativePoint::max(end, b->old_end);
+          ++b;
+        } else {
+          break;
+        }
+      }
+
+      Hunk hunk;
+      hunk.old_start = a_old_end.traverse(start.traversal(a_new_end));
+      hunk.new_start = b_new_end.traverse(start.traversal(b_old_end));
+      if (a != a_begin) {
+        a_old_end = a[-1].old_end;
+        a_new_end = a[-1].new_end;
+      }
+      if (b != b_begin) {
+        b_old_end = b[-1].old_end;
+        b_new_end = b[-1].new_end;
+      }
+      hunk.old_end = a_old_end.traverse(end.traversal(a_new_end));
+      hunk.new_end = b_new_end.traverse(end.traversal(b_old_end));
+      if (hunk.old_start == hunk.old_end && hunk.new_start == hunk.new_end) continue;
+
+      if (b == b_begin && a == a_begin + 1) {
+        hunk.old_text = a_begin->old_text;
+        hunk.new_text = a_begin->new_text;
+        hunk.old_text_size = a_begin->old_text_size;
+        output.push_back(hunk);
+        continue;
+      }
+
+      if (a == a_begin && b == b_begin + 1) {
+        hunk.old_text = b_begin->old_text;
+        hunk.new_text = b_begin->new_text;
+        hunk.old_text_size = b_begin->old_text_size;
+        output.push_back(hunk);
+        continue;
+      }
+
+      // The old text is the earlier hunks' old text, joined by the parts of
+      // the intermediate text that they left unchanged, taken from the later
+      // hunks.
+      hunk.old_text = nullptr;
+      bool has_old_text = true;
+      for (const Hunk *h = b_begin; h != b; ++h) {
+        if (!h->old_text) has_old_text = false;
+      }
+      if (has_old_text) {
+        Text text;
+        auto append = [&text](TextSlice slice) { text.append(slice); };
+        const Hunk *cursor = b_begin;
+        NativePoint position = start;
+        for (const Hunk *h = a_begin; h != a && has_old_text; ++h) {
+          has_old_text = h->old_text &&
+            slice_intermediate_text(cursor, b, false, position, h->new_start, append);
+          if (has_old_text) text.append(TextSlice(*h->old_text));
+          position = h->new_end;
+        }
+        if (has_old_text && slice_intermediate_text(cursor, b, false, position, end, append)) {
+          hunk.old_text = store(move(text));
+        }
+      }
+
+      // The new text is built the same way from the later hunks' new text.
+      hunk.new_text = nullptr;
+      bool has_new_text = true;
+      {
+        Text text;
+        auto append = [&text](TextSlice slice) { text.append(slice); };
+        const Hunk *cursor = a_begin;
+        NativePoint position = start;
+        for (const Hunk *h = b_begin; h != b && has_new_text; ++h) {
+          has_new_text = h->new_text &&
+            slice_intermediate_text(cursor, a, true, position, h->old_start, append);
+          if (has_new_text) text.append(TextSlice(*h->new_text));
+          position = h->old_end;
+        }
+        if (has_new_text && slice_intermediate_text(cursor, a, true, position, end, append)) {
+          hunk.new_text = store(move(text));
+        }
+      }
+
+      if (hunk.old_text) {
+        if (hunk.new_text && *hunk.old_text == *hunk.new_text) continue;
+        hunk.old_text_size = hunk.old_text->size();
+      } else {
+        // Each later hunk replaced its old text, minus the parts that were
+        // inserted by earlier hunks, whose own old text is counted instead.
+        uint32_t old_text_size = 0;
+        bool is_known = true;
+        auto subtract = [&old_text_size](TextSlice slice) { old_text_size -= slice.size(); };
+        const Hunk *cursor = a_begin;
+        for (const Hunk *h = a_begin; h != a; ++h) old_text_size += h->old_text_size;
+        for (const Hunk *h = b_begin; h != b && is_known; ++h) {
+          old_text_size += h->old_text_size;
+          is_known = slice_intermediate_text(cursor, a, true, h->old_start, h->old_end, subtract);
+        }
+        hunk.old_text_size = is_known ? old_text_size : 0;
+      }
+
+      output.push_back(hunk);
+    }
   }
-  return combination;
+};
+
+Patch Patch::compose(const std::vector<const Patch *> &patches) {
+  Patch result;
+  if (patches.empty()) return result;
+
+  Composer composer(patches.size());
+  vector<Composer::Hunk> hunks;
+  composer.compose(patches, 0, patches.size(), 0, hunks);
+
+  // Nodes are built with their absolute start positions in place of their
+  // distances from their left ancestors; `build_balanced_tree` converts them.
+  vector<Node *> nodes;
+  nodes.reserve(hunks.size());
+  for (const Composer::Hunk &hunk : hunks) {
+    nodes.push_back(result.allocate_node(
+      nullptr, nullptr,
+      hunk.old_end.traversal(hunk.old_start),
+      hunk.new_end.traversal(hunk.new_start),
+      hunk.old_start, hunk.new_start,
+      hunk.old_text, hunk.new_text,
+      hunk.old_text_size
+    ));
+  }
+
+  result.root = build_balanced_tree(nodes.data(), nodes.size(), NativePoint(), NativePoint());
+  result.change_count = nodes.size();
+  return result;
+}
+
+Patch::Node *Patch::build_balanced_tree(Node **nodes, size_t count,
+                                        NativePoint left_ancestor_old_end,
+                                        NativePoint left_ancestor_new_end) {
+  if (count == 0) return nullptr;
+
+  size_t middle = count / 2;
+  Node *node = nodes[middle];
+  NativePoint old_start = node->old_distance_from_left_ancestor;
+  NativePoint new_start = node->new_distance_from_left_ancestor;
+
+  node->left = build_balanced_tree(
+    nodes, middle,
+    left_ancestor_old_end, left_ancestor_new_end
+  );
+  node->right = build_balanced_tree(
+    nodes + middle + 1, count - middle - 1,
+    old_start.traverse(node->old_extent), new_start.traverse(node->new_extent)
+  );
+  node->old_distance_from_left_ancestor = old_start.traversal(left_ancestor_old_end);
+  node->new_distance_from_left_ancestor = new_start.traversal(left_ancestor_new_end);
+  node->compute_subtree_text_sizes();
+  return node;
 }
 
 void Patch::serialize(Serializer &output) {
   output.append(SERIALIZATION_VERSION);
+  size_t block = output.begin_block();
   output.append(change_count);
 
-  if (!root) return;
+  if (!root) {
+    output.end_block(block);
+    return;
+  }
   root->serialize(output);
 
   Node *node = root;
@@ -435,12 +874,15 @@ void Patch::serialize(Serializer &output) {
       break;
     }
   }
+
+  output.end_block(block);
 }
 
 Patch Patch::copy() {
+  Patch result{merges_adjacent_changes};
   Node *new_root = nullptr;
   if (root) {
-    new_root = root->copy();
+    new_root = root->copy(result);
     node_stack.clear();
     node_stack.push_back(new_root);
 
@@ -448,23 +890,26 @@ Patch Patch::copy() {
       Node *node = node_stack.back();
       node_stack.pop_back();
       if (node->left) {
-        node->left = node->left->copy();
+        node->left = node->left->copy(result);
         node_stack.push_back(node->left);
       }
       if (node->right) {
-        node->right = node->right->copy();
+        node->right = node->right->copy(result);
         node_stack.push_back(node->right);
       }
     }
   }
 
-  return Patch{new_root, change_count, merges_adjacent_changes};
+  result.root = new_root;
+  result.change_count = change_count;
+  return result;
 }
 
 Patch Patch::invert() {
+  Patch result{merges_adjacent_changes};
   Node *inverted_root = nullptr;
   if (root) {
-    inverted_root = root->invert();
+    inverted_root = root->invert(result);
     node_stack.clear();
     node_stack.push_back(inverted_root);
 
@@ -472,17 +917,19 @@ Patch Patch::invert() {
       Node *node = node_stack.back();
       node_stack.pop_back();
       if (node->left) {
-        node->left = node->left->invert();
+        node->left = node->left->invert(result);
         node_stack.push_back(node->left);
       }
       if (node->right) {
-        node->right = node->right->invert();
+        node->right = node->right->invert(result);
         node_stack.push_back(node->right);
       }
     }
   }
 
-  return Patch{inverted_root, change_count, merges_adjacent_changes};
+  result.root = inverted_root;
+  result.change_count = change_count;
+  return result;
 }
 
 // Mutations
@@ -860,9 +1307,9 @@ void Patch::splice_old(NativePoint old_splice_start, NativePoint old_deletion_ex
             lower_bound->old_extent.traverse(upper_bound->old_extent);
         if (lower_bound->old_text && upper_bound->old_text) {
           lower_bound->old_text->append(*upper_bound->old_text);
-          std::swap(upper_bound->old_text, lower_bound->old_text);
+          upper_bound->old_text.swap(lower_bound->old_text);
         } else {
-          upper_bound->old_text = nullptr;
+          upper_bound->old_text.reset();
           upper_bound->old_text_size_ += lower_bound->old_text_size_;
         }
 
@@ -870,9 +1317,9 @@ void Patch::splice_old(NativePoint old_splice_start, NativePoint old_deletion_ex
             lower_bound->new_extent.traverse(upper_bound->new_extent);
         if (lower_bound->new_text && upper_bound->new_text) {
           lower_bound->new_text->append(*upper_bound->new_text);
-          std::swap(upper_bound->new_text, lower_bound->new_text);
+          upper_bound->new_text.swap(lower_bound->new_text);
         } else {
-          upper_bound->new_text = nullptr;
+          upper_bound->new_text.reset();
         }
 
         upper_bound->left = lower_bound->left;
@@ -915,35 +1362,61 @@ bool Patch::combine(const Patch &other, bool left_to_right) {
 }
 
 void Patch::clear() {
-  if (root) delete_node(&root);
+  if (!root) return;
+
+  node_stack.clear();
+  node_stack.push_back(root);
+  while (!node_stack.empty()) {
+    Node *node = node_stack.back();
+    node_stack.pop_back();
+    if (node->left) node_stack.push_back(node->left);
+    if (node->right) node_stack.push_back(node->right);
+    node->~Node();
+  }
+
+  root = nullptr;
+  change_count = 0;
+  node_allocator->release();
 }
 
 void Patch::rebalance() {
   if (!root)
     return;
 
-  // Transform tree to vine
-  Node *pseudo_root = root, *pseudo_root_parent = nullptr;
-  while (pseudo_root) {
-    Node *left = pseudo_root->left;
-    Node *right = pseudo_root->right;
-    if (left) {
-      rotate_node_right(left, pseudo_root, pseudo_root_parent);
-      pseudo_root = left;
-    } else {
-      pseudo_root_parent = pseudo_root;
-      pseudo_root = right;
+  // Collect the nodes in order, replacing their distances from their left
+  // ancestors with their absolute start positions, then relink them.
+  struct Frame {
+    Node *node;
+    NativePoint left_ancestor_old_end;
+    NativePoint left_ancestor_new_end;
+  };
+
+  vector<Node *> nodes;
+  vector<Frame> frames;
+  nodes.reserve(change_count);
+  Node *node = root;
+  NativePoint left_ancestor_old_end, left_ancestor_new_end;
+  while (node || !frames.empty()) {
+    while (node) {
+      frames.push_back({node, left_ancestor_old_end, left_ancestor_new_end});
+      node = node->left;
     }
-  }
 
-  // Transform vine to balanced tree
-  uint32_t n = change_count;
-  uint32_t m = std::pow(2, std::floor(std::log2(n + 1))) - 1;
-  perform_rebalancing_rotations(n - m);
-  while (m > 1) {
-    m = m / 2;
-    perform_rebalancing_rotations(m);
+    Frame frame = frames.back();
+    frames.pop_back();
+    node = frame.node;
+    node->old_distance_from_left_ancestor =
+      frame.left_ancestor_old_end.traverse(node->old_distance_from_left_ancestor);
+    node->new_distance_from_left_ancestor =
+      frame.left_ancestor_new_end.traverse(node->new_distance_from_left_ancestor);
+    nodes.push_back(node);
+
+    left_ancestor_old_end = node->old_distance_from_left_ancestor.traverse(node->old_extent);
+    left_ancestor_new_end = node->new_distance_from_left_ancestor.traverse(node->new_extent);
+    node = node->right;
   }
+
+  root = build_balanced_tree(nodes.data(), nodes.size(), NativePoint(), NativePoint());
 }
 
 // Non-splaying reads
@@ -1225,20 +1698,6 @@ void Patch::delete_root() {
   }
 }
 
-void Patch::perform_rebalancing_rotations(uint32_t count) {
-  Node *pseudo_root = root, *pseudo_root_parent = nullptr;
-  for (uint32_t i = 0; i < count; i++) {
-    if (!pseudo_root)
-      return;
-    Node *right_child = pseudo_root->right;
-    if (!right_child)
-      return;
-    rotate_node_left(right_child, pseudo_root, pseudo_root_parent);
-    pseudo_root = right_child->right;
-    pseudo_root_parent = right_child;
-  }
-}
-
 std::pair<optional<Text>, bool> Patch::compute_old_text(
   optional<Text> &&deleted_text, NativePoint new_splice_start, NativePoint new_deletion_end
 ) {
@@ -1317,17 +1776,17 @@ Patch::Node *Patch::build_node(Node *left, Node *right,
                        optional<Text> &&old_text, optional<Text> &&new_text,
                        uint32_t old_text_size) {
   change_count++;
-  return new Node{
+  return allocate_node(
     left,
     right,
     old_extent,
     new_extent,
     old_distance_from_left_ancestor,
     new_distance_from_left_ancestor,
-    old_text ? unique_ptr<Text>{new Text(*old_text)} : nullptr,
-    new_text ? unique_ptr<Text>{new Text(*new_text)} : nullptr,
+    move(old_text),
+    move(new_text),
     old_text_size
-  };
+  );
 }
 
 void Patch::delete_node(Node **node_to_delete) {
@@ -1342,7 +1801,7 @@ void Patch::delete_node(Node **node_to_delete) {
         node_stack.push_back(node->left);
       if (node->right)
         node_stack.push_back(node->right);
-      delete node;
+      free_node(node);
       change_count--;
     }
 
@@ -11,11 +11,14 @@
 
 class Patch {
   struct Node;
+  struct NodeAllocator;
+  struct Composer;
   struct OldCoordinates;
   struct NewCoordinates;
   struct PositionStackEntry;
 
   Node *root;
+  std::unique_ptr<NodeAllocator> node_allocator;
   std::vector<Node *> node_stack;
   std::vector<PositionStackEntry> left_ancestor_stack;
   uint32_t change_count;
@@ -40,7 +43,7 @@ public:
   Patch(Deserializer &input);
   Patch &operator=(Patch &&);
   ~Patch();
-  static Patch compose(const std::vector<Patch *> &);
+  static Patch compose(const std::vector<const Patch *> &);
   void serialize(Serializer &serializer);
 
   Patch copy();
@@ -82,8 +85,6 @@ public:
   std::string get_json() const;
 
 private:
-  Patch(Node *root, uint32_t change_count, bool merges_adjacent_changes);
-
   template <typename CoordinateSpace>
   std::vector<Change> get_changes_in_range(NativePoint, NativePoint, bool inclusive) const;
 
@@ -112,6 +113,7 @@ private:
   Node *splay_node_ending_after(NativePoint target, optional<NativePoint> exclusive_lower_bound);
 
   Change change_for_root_node();
+  void deserialize_nodes(Deserializer &, bool allows_one_byte_units);
 
   std::pair<optional<Text>, bool> compute_old_text(optional<Text> &&, NativePoint, NativePoint);
   uint32_t compute_old_text_size(uint32_t, NativePoint, NativePoint);
@@ -120,7 +122,10 @@ private:
   void rotate_node_right(Node *, Node *, Node *);
   void rotate_node_left(Node *, Node *, Node *);
   void delete_root();
-  void perform_rebalancing_rotations(uint32_t);
+  static Node *build_balanced_tree(Node **, size_t, NativePoint, NativePoint);
+  template <typename... Args>
+  Node *allocate_node(Args &&...);
+  void free_node(Node *);
   Node *build_node(Node *, Node *, NativePoint, NativePoint, NativePoint, NativePoint,
                   optional<Text> &&, optional<Text> &&, uint32_t old_text_size);
   void delete_node(Node **);
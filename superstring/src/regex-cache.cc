@@ -0,0 +1,74 @@
+#include "regex-cache.h"
+
+using std::shared_ptr;
+using std::u16string;
+using std::unique_lock;
+
+bool RegexCache::Key::operator==(const Key &other) const {
+  return pattern == other.pattern && ignore_case == other.ignore_case && unicode == other.unicode;
+}
+
+size_t RegexCache::KeyHash::operator()(const Key &key) const {
+  size_t result = std::hash<u16string>()(key.pattern);
+  return result ^ (key.ignore_case ? 0x9e3779b9 : 0) ^ (key.unicode ? 0x7f4a7c15 : 0);
+}
+
+RegexCache::RegexCache(size_t capacity) : capacity{capacity}, counts{0, 0, 0} {}
+
+shared_ptr<const Regex> RegexCache::get(const u16string &pattern, bool ignore_case,
+                                        bool unicode, u16string *error_message) {
+  Key key{pattern, ignore_case, unicode};
+
+  {
+    unique_lock<std::mutex> lock(mutex);
+    auto existing = index.find(key);
+    if (existing != index.end()) {
+      counts.hits++;
+      entries.splice(entries.begin(), entries, existing->second);
+      return existing->second->second;
+    }
+    counts.misses++;
+  }
+
+  // Compile without holding the lock so that other threads can keep using
+  // the cache in the meantime.
+  shared_ptr<const Regex> regex = std::make_shared<Regex>(pattern, error_message, ignore_case, unicode);
+  if (!*regex) return regex;
+
+  unique_lock<std::mutex> lock(mutex);
+  auto existing = index.find(key);
+  if (existing != index.end()) {
+    entries.splice(entries.begin(), entries, existing->second);
+    return existing->second->second;
+  }
+
+  entries.emplace_front(key, regex);
+  index.emplace(std::move(key), entries.begin());
+  while (entries.size() > capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+    counts.evictions++;
+  }
+  return regex;
+}
+
+RegexCache::Stats RegexCache::stats() const {
+  unique_lock<std::mutex> lock(mutex);
+  return counts;
+}
+
+size_t RegexCache::size() const {
+  unique_lock<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+void RegexCache::clear() {
+  unique_lock<std::mutex> lock(mutex);
+  index.clear();
+  entries.clear();
+}
+
+RegexCache &RegexCache::shared() {
+  static RegexCache instance;
+  return instance;
+}
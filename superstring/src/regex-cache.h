@@ -0,0 +1,56 @@
+#ifndef SUPERSTRING_REGEX_CACHE_H_
+#define SUPERSTRING_REGEX_CACHE_H_
+
+#include "regex.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A thread-safe, least-recently-used cache of compiled regexes. Compiling a
+// pattern costs far more than matching it against a line, so callers that
+// build the same patterns over and over should get them from here.
+class RegexCache {
+ public:
+  struct Key {
+    std::u16string pattern;
+    bool ignore_case;
+    bool unicode;
+
+    bool operator==(const Key &) const;
+  };
+
+  struct Stats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+  };
+
+  explicit RegexCache(size_t capacity = 128);
+
+  // Patterns that fail to compile aren't cached; the returned regex is then
+  // invalid and the error is written to `error_message` if it is given.
+  std::shared_ptr<const Regex> get(const std::u16string &pattern, bool ignore_case = false,
+                                   bool unicode = false, std::u16string *error_message = nullptr);
+  Stats stats() const;
+  size_t size() const;
+  void clear();
+
+  static RegexCache &shared();
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key &) const;
+  };
+
+  using Entry = std::pair<Key, std::shared_ptr<const Regex>>;
+
+  mutable std::mutex mutex;
+  size_t capacity;
+  std::list<Entry> entries;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+  Stats counts;
+};
+
+#endif // SUPERSTRING_REGEX_CACHE_H_
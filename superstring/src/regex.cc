@@ -1,13 +1,35 @@
 #include "regex.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <cctype>
+#include <memory>
 #include "pcre2.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline uint32_t count_trailing_zeros(uint32_t value) {
+  unsigned long result;
+  _BitScanForward(&result, value);
+  return result;
+}
+#else
+static inline uint32_t count_trailing_zeros(uint32_t value) {
+  return __builtin_ctz(value);
+}
+#endif
+
 using std::u16string;
 using MatchResult = Regex::MatchResult;
 
 const char16_t EMPTY_PATTERN[] = u".{0}";
 
-Regex::Regex() : code{nullptr} {}
+static const size_t NO_LITERAL = static_cast<size_t>(-1);
+
+Regex::Regex() : code{nullptr}, is_literal{false} {}
 
 static u16string preprocess_pattern(const char16_t *pattern, uint32_t length) {
   u16string result;
@@ -46,8 +68,93 @@ static u16string preprocess_pattern(const char16_t *pattern, uint32_t length) {
   return result;
 }
 
+static bool is_metacharacter(char16_t c) {
+  switch (c) {
+    case '\\': case '^': case '$': case '.': case '|': case '?': case '*':
+    case '+': case '(': case ')': case '[': case ']': case '{': case '}':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the characters that every match of the given pattern must start
+// with, setting `is_literal` if they make up the whole pattern. Only plain
+// characters and escaped punctuation count, and alternations rule out any
+// prefix at all.
+static u16string parse_literal_prefix(const u16string &pattern, bool *is_literal) {
+  u16string result;
+  *is_literal = false;
+  if (pattern.find(u'|') != u16string::npos) return result;
+
+  size_t i = 0;
+  while (i < pattern.size()) {
+    char16_t character = pattern[i];
+    size_t next_i = i + 1;
+    if (character == '\\') {
+      if (next_i == pattern.size()) break;
+      character = pattern[next_i++];
+      if (character < 128 && isalnum(character)) break;
+    } else if (is_metacharacter(character)) {
+      break;
+    }
+
+    if (next_i < pattern.size()) {
+      char16_t next_character = pattern[next_i];
+      if (next_character == '?' || next_character == '*' || next_character == '+' || next_character == '{') break;
+    }
+
+    result += character;
+    i = next_i;
+  }
+
+  *is_literal = i == pattern.size();
+  return result;
+}
+
+// Returns the first offset at or after `start` where `literal` occurs in the
+// subject or where the subject ends partway through it, or NO_LITERAL if
+// there is no such offset. Full occurrences always come before partial ones.
+static size_t find_literal(const char16_t *subject, size_t length, size_t start, const u16string &literal) {
+  const size_t last_index = literal.size() - 1;
+  const char16_t first_character = literal[0];
+  auto occurs_at = [&](size_t offset) {
+    size_t compared_length = std::min(literal.size(), length - offset);
+    return std::char_traits<char16_t>::compare(subject + offset, literal.data(), compared_length) == 0;
+  };
 
-Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_message, bool ignore_case, bool unicode) {
+  size_t offset = start;
+
+  // Compare the first and last characters of the literal against eight
+  // positions at a time, only checking the rest where both of them match.
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128i first_characters = _mm_set1_epi16(first_character);
+  const __m128i last_characters = _mm_set1_epi16(literal[last_index]);
+  for (; offset + last_index + 8 <= length; offset += 8) {
+    __m128i firsts = _mm_loadu_si128(reinterpret_cast<const __m128i *>(subject + offset));
+    __m128i lasts = _mm_loadu_si128(reinterpret_cast<const __m128i *>(subject + offset + last_index));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi16(firsts, first_characters),
+      _mm_cmpeq_epi16(lasts, last_characters)
+    ));
+    while (mask) {
+      size_t candidate = offset + count_trailing_zeros(mask) / 2;
+      if (occurs_at(candidate)) return candidate;
+      mask &= mask - 1;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; offset < length; offset++) {
+    if (subject[offset] == first_character && occurs_at(offset)) return offset;
+  }
+
+  return NO_LITERAL;
+}
+
+Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_message, bool ignore_case, bool unicode)
+  : is_literal{false} {
   if (pattern_length == 0) {
     pattern = EMPTY_PATTERN;
     pattern_length = 4;
@@ -69,10 +176,12 @@ Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_
     nullptr
   );
 
-  if (code == nullptr && error_message != nullptr) {
-    uint16_t message_buffer[256];
-    size_t length = pcre2_get_error_message(error_number, message_buffer, 256);
-    error_message->assign(message_buffer, message_buffer + length);
+  if (code == nullptr) {
+    if (error_message != nullptr) {
+      uint16_t message_buffer[256];
+      size_t length = pcre2_get_error_message(error_number, message_buffer, 256);
+      error_message->assign(message_buffer, message_buffer + length);
+    }
     return;
   }
 
@@ -80,6 +189,12 @@ Regex::Regex(const char16_t *pattern, uint32_t pattern_length, u16string *error_
     code,
     PCRE2_JIT_COMPLETE|PCRE2_JIT_PARTIAL_HARD|PCRE2_JIT_PARTIAL_SOFT
   );
+
+  // Case-insensitive and UTF patterns are left to PCRE2, which folds case and
+  // validates the subject for them.
+  if (!ignore_case && !unicode) {
+    literal_prefix = parse_literal_prefix(final_pattern, &is_literal);
+  }
 }
 
 Regex::Regex(const char16_t *pattern, u16string *error_message, bool ignore_case, bool unicode)
@@ -88,7 +203,8 @@ Regex::Regex(const char16_t *pattern, u16string *error_message, bool ignore_case
 Regex::Regex(const u16string &pattern, u16string *error_message, bool ignore_case, bool unicode)
   : Regex(pattern.data(), pattern.size(), error_message, ignore_case, unicode) {}
 
-Regex::Regex(Regex &&other) : code{other.code} {
+Regex::Regex(Regex &&other)
+  : code{other.code}, literal_prefix{std::move(other.literal_prefix)}, is_literal{other.is_literal} {
   other.code = nullptr;
 }
 
@@ -98,6 +214,8 @@ Regex::~Regex() {
 
 Regex &Regex::operator=(Regex &&other) {
   std::swap(code, other.code);
+  std::swap(literal_prefix, other.literal_prefix);
+  std::swap(is_literal, other.is_literal);
   return *this;
 }
 
@@ -105,9 +223,36 @@ Regex::operator bool() const {
   return code != nullptr;
 }
 
+uint32_t Regex::max_lookbehind() const {
+  uint32_t result = 0;
+  if (code) pcre2_pattern_info(code, PCRE2_INFO_MAXLOOKBEHIND, &result);
+  return result;
+}
+
+bool Regex::is_literal_pattern() const {
+  return is_literal;
+}
+
+const u16string &Regex::get_literal_prefix() const {
+  return literal_prefix;
+}
+
 Regex::MatchData::MatchData(const Regex &regex)
   : data{pcre2_match_data_create_from_pattern(regex.code, nullptr)} {}
 
+Regex::MatchData::MatchData(uint32_t pair_count)
+  : data{pcre2_match_data_create(pair_count, nullptr)} {}
+
+Regex::MatchData &Regex::MatchData::for_current_thread(const Regex &regex) {
+  thread_local std::unique_ptr<MatchData> match_data;
+  uint32_t capture_count = 0;
+  if (regex.code) pcre2_pattern_info(regex.code, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+  if (!match_data || match_data->size() < capture_count + 1) {
+    match_data.reset(new MatchData(capture_count + 1));
+  }
+  return *match_data;
+}
+
 Regex::MatchData::~MatchData() {
   pcre2_match_data_free(data);
 }
@@ -131,6 +276,25 @@ Regex::MatchResult::operator bool() const {
 MatchResult Regex::match(const char16_t *string, size_t length,
                          MatchData &match_data, unsigned options) const {
   MatchResult result{MatchResult::None, 0, 0};
+  size_t start_offset = 0;
+
+  // Skip straight to the first place the literal part of the pattern occurs.
+  // A pure literal needs nothing more; otherwise PCRE2 takes over from there.
+  if (!literal_prefix.empty()) {
+    start_offset = find_literal(string, length, 0, literal_prefix);
+    if (start_offset == NO_LITERAL) return result;
+
+    bool is_partial = start_offset + literal_prefix.size() > length;
+    if (is_partial && (options & MatchOptions::IsEndSearch)) return result;
+
+    if (is_literal) {
+      PCRE2_SIZE *ovector_pointer = pcre2_get_ovector_pointer(match_data.data);
+      result.type = is_partial ? MatchResult::Partial : MatchResult::Full;
+      result.start_offset = ovector_pointer[0] = start_offset;
+      result.end_offset = ovector_pointer[1] = is_partial ? length : start_offset + literal_prefix.size();
+      return result;
+    }
+  }
 
   unsigned int pcre_options = 0;
   if (!(options & MatchOptions::IsEndSearch)) pcre_options |= PCRE2_PARTIAL_HARD;
@@ -141,7 +305,7 @@ MatchResult Regex::match(const char16_t *string, size_t length,
     code,
     reinterpret_cast<const uint16_t *>(string),
     length,
-    0,
+    start_offset,
     pcre_options,
     match_data.data,
     nullptr
@@ -175,7 +339,7 @@ MatchResult Regex::match(const u16string &string, MatchData &match_data, unsigne
 }
 
 MatchResult Regex::match(const char16_t *string, size_t length) const {
-  MatchData match_data(*this);
+  MatchData &match_data = MatchData::for_current_thread(*this);
   const unsigned options = MatchOptions::IsBeginningOfLine | MatchOptions::IsEndOfLine | MatchOptions::IsEndSearch;
   return match(string, length, match_data, options);
 }
@@ -189,7 +353,7 @@ MatchResult Regex::match(char16_t character) const {
 }
 
 bool Regex::match(const char16_t *string, size_t length, size_t &last_index) const {
-  MatchData match_data(*this);
+  MatchData &match_data = MatchData::for_current_thread(*this);
   unsigned options = MatchOptions::IsEndOfLine | MatchOptions::IsEndSearch;
   if (last_index == 0) {
     options |= MatchOptions::IsBeginningOfLine;
@@ -222,7 +386,7 @@ double Regex::search(const u16string &string) const {
 }
 
 u16string Regex::replace(const char16_t *string, size_t length, const char16_t *replacement, size_t replacement_length) const {
-  MatchData match_data(*this);
+  MatchData &match_data = MatchData::for_current_thread(*this);
   const MatchResult match_result = match(string, length, match_data);
   if (match_result.type == MatchResult::Full) {
     u16string result;
@@ -11,6 +11,8 @@ struct BuildRegexResult;
 
 class Regex {
   pcre2_real_code_16 *code;
+  std::u16string literal_prefix;
+  bool is_literal;
   Regex(pcre2_real_code_16 *);
 
  public:
@@ -22,6 +24,9 @@ class Regex {
   ~Regex();
   Regex &operator=(Regex &&);
   operator bool() const;
+  uint32_t max_lookbehind() const;
+  bool is_literal_pattern() const;
+  const std::u16string &get_literal_prefix() const;
 
   struct Range {
     size_t start_offset;
@@ -31,11 +36,17 @@ class Regex {
   class MatchData {
     pcre2_real_match_data_16 *data;
     friend class Regex;
+    MatchData(uint32_t pair_count);
 
    public:
     MatchData(const Regex &);
     ~MatchData();
 
+    // Returns match data owned by the calling thread with room for the given
+    // regex's captures. The match methods that don't take any match data use
+    // it too, so its contents only last until the thread's next match.
+    static MatchData &for_current_thread(const Regex &);
+
     uint32_t size();
     Range operator[](uint32_t);
   };
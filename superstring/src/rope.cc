@@ -0,0 +1,397 @@
+#include "rope.h"
+#include <algorithm>
+
+using std::move;
+using std::u16string;
+
+// Pieces smaller than this are copied together with the text inserted next to
+// them, so that editing a character at a time doesn't leave a piece per
+// character.
+static const uint32_t SMALL_PIECE_SIZE = 256;
+
+static const uint32_t INITIAL_RANDOM_STATE = 0x9e3779b9;
+
+Rope::Piece::Piece(std::shared_ptr<const Text> &&text) :
+  text{move(text)},
+  start_offset{0},
+  end_offset{this->text->size()},
+  start_position{NativePoint()},
+  end_position{this->text->extent()} {}
+
+Rope::Piece::Piece(const std::shared_ptr<const Text> &text, uint32_t start_offset, uint32_t end_offset,
+                   NativePoint start_position, NativePoint end_position) :
+  text{text},
+  start_offset{start_offset},
+  end_offset{end_offset},
+  start_position{start_position},
+  end_position{end_position} {}
+
+uint32_t Rope::Piece::size() const {
+  return end_offset - start_offset;
+}
+
+NativePoint Rope::Piece::extent() const {
+  return end_position.traversal(start_position);
+}
+
+TextSlice Rope::Piece::slice(uint32_t start, uint32_t end) const {
+  NativePoint slice_start = start == 0 ?
+    start_position :
+    text->position_for_offset(start_offset + start, start_position.row, false);
+  NativePoint slice_end = end == size() ?
+    end_position :
+    text->position_for_offset(start_offset + end, slice_start.row, false);
+  return TextSlice(text.get(), slice_start, slice_end);
+}
+
+Rope::Node::Node(Piece &&piece, uint32_t priority) :
+  piece{move(piece)},
+  left{nullptr},
+  right{nullptr},
+  priority{priority} {
+  compute_subtree_summary();
+}
+
+Rope::Node::Node(const Node &other) :
+  piece{other.piece},
+  left{other.left ? new Node(*other.left) : nullptr},
+  right{other.right ? new Node(*other.right) : nullptr},
+  priority{other.priority},
+  subtree_size{other.subtree_size},
+  subtree_extent{other.subtree_extent} {}
+
+void Rope::Node::compute_subtree_summary() {
+  subtree_size = Rope::subtree_size(left) + piece.size() + Rope::subtree_size(right);
+  subtree_extent = Rope::subtree_extent(left)
+    .traverse(piece.extent())
+    .traverse(Rope::subtree_extent(right));
+}
+
+Rope::Rope() : root{nullptr}, random_state{INITIAL_RANDOM_STATE} {}
+
+Rope::Rope(Text &&text) : Rope{} {
+  if (!text.empty()) {
+    root = new Node(Piece(std::make_shared<const Text>(move(text))), next_priority());
+  }
+}
+
+Rope::Rope(const Rope &other) :
+  root{other.root ? new Node(*other.root) : nullptr},
+  random_state{other.random_state} {}
+
+Rope::Rope(Rope &&other) : root{other.root}, random_state{other.random_state} {
+  other.root = nullptr;
+}
+
+Rope::~Rope() {
+  delete_subtree(root);
+}
+
+Rope &Rope::operator=(const Rope &other) {
+  if (this != &other) {
+    delete_subtree(root);
+    root = other.root ? new Node(*other.root) : nullptr;
+    random_state = other.random_state;
+  }
+  return *this;
+}
+
+Rope &Rope::operator=(Rope &&other) {
+  if (this != &other) {
+    delete_subtree(root);
+    root = other.root;
+    random_state = other.random_state;
+    other.root = nullptr;
+  }
+  return *this;
+}
+
+uint32_t Rope::subtree_size(const Node *node) {
+  return node ? node->subtree_size : 0;
+}
+
+NativePoint Rope::subtree_extent(const Node *node) {
+  return node ? node->subtree_extent : NativePoint();
+}
+
+void Rope::delete_subtree(Node *node) {
+  if (!node) return;
+  delete_subtree(node->left);
+  delete_subtree(node->right);
+  delete node;
+}
+
+uint32_t Rope::next_priority() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+Rope::Node *Rope::merge(Node *left, Node *right) {
+  if (!left) return right;
+  if (!right) return left;
+  if (left->priority > right->priority) {
+    left->right = merge(left->right, right);
+    left->compute_subtree_summary();
+    return left;
+  } else {
+    right->left = merge(left, right->left);
+    right->compute_subtree_summary();
+    return right;
+  }
+}
+
+// Splits the tree so that `left` holds the text before the given offset and
+// `right` the text after it. A piece containing the offset becomes two, the
+// second of which gets the given priority.
+void Rope::split(Node *node, uint32_t offset, Node **left, Node **right, uint32_t priority) {
+  if (!node) {
+    *left = nullptr;
+    *right = nullptr;
+    return;
+  }
+
+  uint32_t piece_start = subtree_size(node->left);
+  uint32_t piece_end = piece_start + node->piece.size();
+  if (offset <= piece_start) {
+    split(node->left, offset, left, &node->left, priority);
+    node->compute_subtree_summary();
+    *right = node;
+  } else if (offset >= piece_end) {
+    split(node->right, offset - piece_end, &node->right, right, priority);
+    node->compute_subtree_summary();
+    *left = node;
+  } else {
+    Piece &piece = node->piece;
+    uint32_t split_offset = piece.start_offset + (offset - piece_start);
+    NativePoint split_position = piece.text->position_for_offset(
+      split_offset,
+      piece.start_position.row,
+      false
+    );
+    Node *suffix = new Node(
+      Piece(piece.text, split_offset, piece.end_offset, split_position, piece.end_position),
+      priority
+    );
+    piece.end_offset = split_offset;
+    piece.end_position = split_position;
+    *right = merge(suffix, node->right);
+    node->right = nullptr;
+    node->compute_subtree_summary();
+    *left = node;
+  }
+}
+
+uint32_t Rope::size() const {
+  return subtree_size(root);
+}
+
+NativePoint Rope::extent() const {
+  return subtree_extent(root);
+}
+
+size_t Rope::piece_count() const {
+  size_t result = 0;
+  for_each_chunk_in_offset_range(0, size(), [&result](TextSlice) {
+    result++;
+    return false;
+  });
+  return result;
+}
+
+// The offset at which the given row starts, which must not be past the last
+// row.
+uint32_t Rope::row_start_offset(uint32_t row) const {
+  uint32_t offset = 0;
+  const Node *node = root;
+  while (node && row > 0) {
+    uint32_t left_rows = subtree_extent(node->left).row;
+    if (row <= left_rows) {
+      node = node->left;
+      continue;
+    }
+
+    row -= left_rows;
+    offset += subtree_size(node->left);
+    const Piece &piece = node->piece;
+    uint32_t piece_rows = piece.end_position.row - piece.start_position.row;
+    if (row <= piece_rows) {
+      return offset + piece.text->line_offsets[piece.start_position.row + row] - piece.start_offset;
+    }
+
+    row -= piece_rows;
+    offset += piece.size();
+    node = node->right;
+  }
+  return offset;
+}
+
+uint32_t Rope::offset_for_unclipped_position(NativePoint position) const {
+  if (position.row > extent().row) return size();
+  uint32_t row_start = row_start_offset(position.row);
+  if (position.column >= size() - row_start) return size();
+  return row_start + position.column;
+}
+
+uint16_t Rope::at(uint32_t offset) const {
+  const Node *node = root;
+  while (node) {
+    uint32_t left_size = subtree_size(node->left);
+    if (offset < left_size) {
+      node = node->left;
+      continue;
+    }
+
+    offset -= left_size;
+    if (offset < node->piece.size()) {
+      return node->piece.text->at(node->piece.start_offset + offset);
+    }
+
+    offset -= node->piece.size();
+    node = node->right;
+  }
+  return 0;
+}
+
+uint16_t Rope::at(NativePoint position) const {
+  return at(clip_position(position).offset);
+}
+
+ClipResult Rope::clip_position(NativePoint position) const {
+  NativePoint extent = this->extent();
+  uint32_t row = position.row;
+  if (row > extent.row) return {extent, size()};
+
+  uint32_t start = row_start_offset(row);
+  uint32_t end;
+  if (row == extent.row) {
+    end = size();
+  } else {
+    end = row_start_offset(row + 1) - 1;
+    if (end > 0 && at(end - 1) == '\r') {
+      end--;
+    }
+  }
+
+  if (position.column > end - start) {
+    return {NativePoint(row, end - start), end};
+  } else {
+    return {position, start + position.column};
+  }
+}
+
+NativePoint Rope::position_for_offset(uint32_t offset, bool clip_crlf) const {
+  uint32_t size = this->size();
+  if (offset > size) offset = size;
+
+  uint32_t row = 0;
+  uint32_t row_start = 0;
+  uint32_t node_start = 0;
+  const Node *node = root;
+  while (node) {
+    uint32_t left_size = subtree_size(node->left);
+    if (offset < node_start + left_size) {
+      node = node->left;
+      continue;
+    }
+
+    NativePoint left_extent = subtree_extent(node->left);
+    if (left_extent.row > 0) {
+      row += left_extent.row;
+      row_start = node_start + left_size - left_extent.column;
+    }
+    node_start += left_size;
+
+    const Piece &piece = node->piece;
+    if (offset <= node_start + piece.size()) {
+      NativePoint position = piece.text->position_for_offset(
+        piece.start_offset + (offset - node_start),
+        piece.start_position.row,
+        false
+      );
+      if (position.row > piece.start_position.row) {
+        row += position.row - piece.start_position.row;
+        row_start = node_start + piece.text->line_offsets[position.row] - piece.start_offset;
+      }
+      break;
+    }
+
+    NativePoint piece_extent = piece.extent();
+    if (piece_extent.row > 0) {
+      row += piece_extent.row;
+      row_start = node_start + piece.size() - piece_extent.column;
+    }
+    node_start += piece.size();
+    node = node->right;
+  }
+
+  uint32_t column = offset - row_start;
+  if (clip_crlf && offset > 0 && offset < size && at(offset) == '\n' && at(offset - 1) == '\r') {
+    column--;
+  }
+  return NativePoint(row, column);
+}
+
+void Rope::splice(NativePoint start, NativePoint deletion_extent, TextSlice inserted_slice) {
+  uint32_t start_offset = clip_position(start).offset;
+  uint32_t end_offset = clip_position(start.traverse(deletion_extent)).offset;
+
+  Node *left, *deleted, *right;
+  split(root, start_offset, &left, &right, next_priority());
+  split(right, end_offset - start_offset, &deleted, &right, next_priority());
+  delete_subtree(deleted);
+
+  const Node *last_node = left;
+  while (last_node && last_node->right) last_node = last_node->right;
+  const Node *first_node = right;
+  while (first_node && first_node->left) first_node = first_node->left;
+
+  bool merges_before = last_node && last_node->piece.size() < SMALL_PIECE_SIZE;
+  bool merges_after = first_node && first_node->piece.size() < SMALL_PIECE_SIZE;
+  if (merges_before + merges_after + !inserted_slice.empty() < 2) {
+    merges_before = false;
+    merges_after = false;
+  }
+
+  Node *before = nullptr, *after = nullptr;
+  if (merges_before) {
+    split(left, subtree_size(left) - last_node->piece.size(), &left, &before, 0);
+  }
+  if (merges_after) {
+    split(right, first_node->piece.size(), &after, &right, 0);
+  }
+
+  Text inserted_text;
+  if (before) inserted_text.append(before->piece.slice(0, before->piece.size()));
+  inserted_text.append(inserted_slice);
+  if (after) inserted_text.append(after->piece.slice(0, after->piece.size()));
+  delete before;
+  delete after;
+
+  Node *inserted = nullptr;
+  if (!inserted_text.empty()) {
+    inserted = new Node(Piece(std::make_shared<const Text>(move(inserted_text))), next_priority());
+  }
+  root = merge(merge(left, inserted), right);
+}
+
+u16string Rope::text_in_range(NativeRange range) const {
+  u16string result;
+  uint32_t start_offset = clip_position(range.start).offset;
+  uint32_t end_offset = clip_position(range.end).offset;
+  if (end_offset > start_offset) result.reserve(end_offset - start_offset);
+  for_each_chunk_in_offset_range(start_offset, end_offset, [&result](TextSlice chunk) {
+    result.append(chunk.data(), chunk.size());
+    return false;
+  });
+  return result;
+}
+
+u16string Rope::text() const {
+  return text_in_range(NativeRange{NativePoint(), extent()});
+}
+
+std::ostream &operator<<(std::ostream &stream, const Rope &rope) {
+  return stream << Text{rope.text()};
+}
@@ -0,0 +1,119 @@
+#ifndef SUPERSTRING_ROPE_H_
+#define SUPERSTRING_ROPE_H_
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include "native-point.h"
+#include "native-range.h"
+#include "text.h"
+#include "text-slice.h"
+
+// A text stored as a balanced tree of pieces, each of which is a slice of an
+// immutable `Text` that other ropes may share. Splicing, clipping and
+// converting between offsets and positions only visit one path through the
+// tree, so they take O(log n) time however large the text is, and copying a
+// rope copies its pieces but none of its characters.
+class Rope {
+  struct Piece {
+    std::shared_ptr<const Text> text;
+    uint32_t start_offset;
+    uint32_t end_offset;
+    NativePoint start_position;
+    NativePoint end_position;
+
+    Piece(std::shared_ptr<const Text> &&);
+    Piece(const std::shared_ptr<const Text> &, uint32_t, uint32_t, NativePoint, NativePoint);
+    uint32_t size() const;
+    NativePoint extent() const;
+    TextSlice slice(uint32_t start, uint32_t end) const;
+  };
+
+  struct Node {
+    Piece piece;
+    Node *left;
+    Node *right;
+    uint32_t priority;
+    uint32_t subtree_size;
+    NativePoint subtree_extent;
+
+    Node(Piece &&, uint32_t priority);
+    Node(const Node &);
+    void compute_subtree_summary();
+  };
+
+  Node *root;
+  uint32_t random_state;
+
+  static uint32_t subtree_size(const Node *);
+  static NativePoint subtree_extent(const Node *);
+  static void delete_subtree(Node *);
+  static Node *merge(Node *, Node *);
+  static void split(Node *, uint32_t offset, Node **left, Node **right, uint32_t priority);
+  uint32_t next_priority();
+  uint32_t row_start_offset(uint32_t row) const;
+  uint32_t offset_for_unclipped_position(NativePoint) const;
+
+  template <typename Callback>
+  static bool for_each_piece_in_range(const Node *node, uint32_t node_start,
+                                      uint32_t start, uint32_t end, const Callback &callback) {
+    if (!node) return false;
+    uint32_t piece_start = node_start + subtree_size(node->left);
+    uint32_t piece_end = piece_start + node->piece.size();
+    if (start < piece_start &&
+        for_each_piece_in_range(node->left, node_start, start, end, callback)) {
+      return true;
+    }
+    if (start < piece_end && end > piece_start) {
+      TextSlice slice = node->piece.slice(
+        (start > piece_start ? start : piece_start) - piece_start,
+        (end < piece_end ? end : piece_end) - piece_start
+      );
+      if (callback(slice)) return true;
+    }
+    if (end > piece_end) {
+      return for_each_piece_in_range(node->right, piece_end, start, end, callback);
+    }
+    return false;
+  }
+
+ public:
+  Rope();
+  Rope(Text &&);
+  Rope(const Rope &);
+  Rope(Rope &&);
+  ~Rope();
+  Rope &operator=(const Rope &);
+  Rope &operator=(Rope &&);
+
+  uint32_t size() const;
+  NativePoint extent() const;
+  size_t piece_count() const;
+  uint16_t at(uint32_t offset) const;
+  uint16_t at(NativePoint position) const;
+  ClipResult clip_position(NativePoint) const;
+  NativePoint position_for_offset(uint32_t, bool clip_crlf = true) const;
+  void splice(NativePoint start, NativePoint deletion_extent, TextSlice inserted_slice);
+  std::u16string text_in_range(NativeRange) const;
+  std::u16string text() const;
+
+  // Calls `callback` with each piece of the text between the given positions,
+  // which aren't clipped, in order, until it returns true. Returns whether
+  // the callback stopped the iteration.
+  template <typename Callback>
+  bool for_each_chunk_in_range(NativePoint start, NativePoint end, const Callback &callback) const {
+    uint32_t start_offset = offset_for_unclipped_position(start);
+    uint32_t end_offset = offset_for_unclipped_position(end);
+    return for_each_chunk_in_offset_range(start_offset, end_offset, callback);
+  }
+
+  template <typename Callback>
+  bool for_each_chunk_in_offset_range(uint32_t start, uint32_t end, const Callback &callback) const {
+    if (start >= end) return false;
+    return for_each_piece_in_range(root, 0, start, end, callback);
+  }
+
+  friend std::ostream &operator<<(std::ostream &, const Rope &);
+};
+
+#endif // SUPERSTRING_ROPE_H_
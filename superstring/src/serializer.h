@@ -2,7 +2,15 @@
 #define SERIALIZER_H_
 
 #include <vector>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+
+// Values are always stored little-endian. On little-endian hosts they are
+// copied in bulk rather than a byte at a time.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SERIALIZER_BIG_ENDIAN 1
+#endif
 
 class Serializer {
   std::vector<uint8_t> &vector;
@@ -13,13 +21,50 @@ class Serializer {
 
   template <typename T>
   void append(T value) {
+#ifdef SERIALIZER_BIG_ENDIAN
     for (auto i = 0u; i < sizeof(T); i++) {
       vector.push_back(value & 0xFF);
       value >>= 8;
     }
+#else
+    std::memcpy(extend(sizeof(T)), &value, sizeof(T));
+#endif
+  }
+
+  template <typename T>
+  void append_array(const T *values, size_t count) {
+#ifdef SERIALIZER_BIG_ENDIAN
+    for (size_t i = 0; i < count; i++) append<T>(values[i]);
+#else
+    if (count > 0) std::memcpy(extend(count * sizeof(T)), values, count * sizeof(T));
+#endif
+  }
+
+  // Grows the output by `size` bytes and returns where they start, so that
+  // callers can fill them in place.
+  uint8_t *extend(size_t size) {
+    size_t offset = vector.size();
+    vector.resize(offset + size);
+    return vector.data() + offset;
+  }
+
+  // Blocks are prefixed with their length in bytes, letting readers skip
+  // them whole. `begin_block` returns a token to pass to `end_block`.
+  size_t begin_block() {
+    append<uint32_t>(0);
+    return vector.size();
+  }
+
+  void end_block(size_t block_start) {
+    uint32_t length = static_cast<uint32_t>(vector.size() - block_start);
+    for (auto i = 0u; i < sizeof(uint32_t); i++) {
+      vector[block_start - sizeof(uint32_t) + i] = (length >> (8 * i)) & 0xFF;
+    }
   }
 };
 
+// Reads from memory that the caller keeps alive, such as a vector or a
+// mapped file. Reading past the end yields zeros rather than overrunning.
 class Deserializer {
   const uint8_t *read_ptr;
   const uint8_t *end_ptr;
@@ -29,14 +74,25 @@ class Deserializer {
     read_ptr(input.data()),
     end_ptr(input.data() + input.size()) {};
 
+  inline Deserializer(const uint8_t *data, size_t size) :
+    read_ptr(data),
+    end_ptr(data + size) {};
+
+  size_t remaining() const {
+    return end_ptr - read_ptr;
+  }
+
   template <typename T>
   T peek() const {
     T value = 0;
-    const uint8_t *temp_ptr = read_ptr;
-    if (static_cast<unsigned>(end_ptr - temp_ptr) >= sizeof(T)) {
+    if (remaining() >= sizeof(T)) {
+#ifdef SERIALIZER_BIG_ENDIAN
       for (auto i = 0u; i < sizeof(T); i++) {
-        value |= static_cast<T>(*(temp_ptr++)) << static_cast<T>(8 * i);
+        value |= static_cast<T>(read_ptr[i]) << static_cast<T>(8 * i);
       }
+#else
+      std::memcpy(&value, read_ptr, sizeof(T));
+#endif
     }
     return value;
   }
@@ -44,9 +100,35 @@ class Deserializer {
   template <typename T>
   T read() {
     T value = peek<T>();
-    read_ptr += sizeof(T);
+    skip(sizeof(T));
     return value;
   }
+
+  // Returns the next `size` bytes in place and advances past them, or
+  // returns null if fewer than that remain.
+  const uint8_t *read_bytes(size_t size) {
+    if (remaining() < size) {
+      read_ptr = end_ptr;
+      return nullptr;
+    }
+    const uint8_t *result = read_ptr;
+    read_ptr += size;
+    return result;
+  }
+
+  // Returns a reader over the next length-prefixed block and advances past
+  // it. A truncated block is clipped to the bytes that remain.
+  Deserializer read_block() {
+    uint32_t length = read<uint32_t>();
+    if (length > remaining()) length = static_cast<uint32_t>(remaining());
+    const uint8_t *block = read_ptr;
+    read_ptr += length;
+    return Deserializer(block, length);
+  }
+
+  void skip(size_t size) {
+    read_ptr += size < remaining() ? size : remaining();
+  }
 };
 
 #endif // SERIALIZER_H_
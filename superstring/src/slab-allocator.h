@@ -0,0 +1,65 @@
+#ifndef SUPERSTRING_SLAB_ALLOCATOR_H
+#define SUPERSTRING_SLAB_ALLOCATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Hands out uninitialized slots for objects of type T from slabs owned by the
+// allocator, reusing the slots that are freed. The first `InlineSlotCount`
+// slots live in the allocator itself, and later slabs double in size, from
+// `FirstSlabSize` up to `MaxSlabSize` slots. Objects created together stay
+// close in memory, and all slots are released at once by `release` or when
+// the allocator is destroyed, without running any destructors.
+template <typename T, uint32_t InlineSlotCount, uint32_t FirstSlabSize, uint32_t MaxSlabSize>
+class slab_allocator {
+  static_assert(InlineSlotCount > 0, "slab_allocator needs at least one inline slot");
+  using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  Slot inline_slots[InlineSlotCount];
+  std::vector<std::unique_ptr<Slot[]>> slabs;
+  Slot *next_slot;
+  Slot *slab_end;
+  void *free_slots;
+  uint32_t next_slab_size;
+
+public:
+  slab_allocator() {
+    release();
+  }
+
+  slab_allocator(const slab_allocator &) = delete;
+  slab_allocator &operator=(const slab_allocator &) = delete;
+
+  void *allocate() {
+    if (free_slots) {
+      void *result = free_slots;
+      free_slots = *static_cast<void **>(free_slots);
+      return result;
+    }
+
+    if (next_slot == slab_end) {
+      slabs.emplace_back(new Slot[next_slab_size]);
+      next_slot = slabs.back().get();
+      slab_end = next_slot + next_slab_size;
+      if (next_slab_size < MaxSlabSize) next_slab_size *= 2;
+    }
+    return next_slot++;
+  }
+
+  void free(void *slot) {
+    *static_cast<void **>(slot) = free_slots;
+    free_slots = slot;
+  }
+
+  void release() {
+    slabs.clear();
+    next_slot = inline_slots;
+    slab_end = inline_slots + InlineSlotCount;
+    free_slots = nullptr;
+    next_slab_size = FirstSlabSize;
+  }
+};
+
+#endif // SUPERSTRING_SLAB_ALLOCATOR_H
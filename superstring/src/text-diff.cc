@@ -1,13 +1,16 @@
 #include "text-diff.h"
 #include "libmba-diff.h"
 #include "text-slice.h"
+#include <algorithm>
 #include <vector>
 #include <string.h>
 #include <ostream>
 #include <cassert>
+#include <unordered_map>
 
 using std::move;
 using std::ostream;
+using std::pair;
 using std::vector;
 
 static NativePoint previous_column(NativePoint position) {
@@ -18,34 +21,250 @@ static NativePoint previous_column(NativePoint position) {
 
 static int MAX_EDIT_DISTANCE = 4 * 1024;
 
-Patch text_diff(const Text &old_text, const Text &new_text) {
-  Patch result;
-  Text empty;
-  Text cr{u"\r"};
-  Text lf{u"\n"};
+// Hunks whose lines add up to more than this are replaced whole rather than
+// diffed character by character, which keeps the worst case predictable.
+static uint32_t MAX_CHARACTER_DIFF_SIZE = 64 * 1024;
 
-  vector<diff_edit> edit_script;
+// Beyond this depth, gaps between unique lines are diffed directly.
+static unsigned MAX_PATIENCE_DEPTH = 64;
 
-  int edit_distance = diff(
-    old_text.content.data(),
-    old_text.content.size(),
-    new_text.content.data(),
-    new_text.content.size(),
-    MAX_EDIT_DISTANCE,
-    &edit_script
-  );
+namespace {
+
+struct LineKey {
+  const char16_t *data;
+  uint32_t size;
+
+  bool operator==(const LineKey &other) const {
+    return size == other.size && memcmp(data, other.data, size * sizeof(char16_t)) == 0;
+  }
+};
+
+struct LineKeyHash {
+  size_t operator()(const LineKey &key) const {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < key.size; i++) {
+      hash = (hash ^ key.data[i]) * 1099511628211ull;
+    }
+    return hash;
+  }
+};
+
+// Matches up the lines of two texts using patience diff: lines that occur
+// exactly once on each side anchor the match, and the gaps between anchors
+// are matched recursively. Gaps without such lines fall back to a bounded
+// Myers diff over the lines.
+class LineMatcher {
+  struct Occurrence {
+    uint32_t generation;
+    uint32_t old_count;
+    uint32_t new_count;
+    uint32_t new_row;
+  };
+
+  vector<uint32_t> old_lines;
+  vector<uint32_t> new_lines;
+  vector<Occurrence> occurrences;
+  uint32_t generation;
+
+  void add_lines(const Text &text, vector<uint32_t> &lines,
+                 std::unordered_map<LineKey, uint32_t, LineKeyHash> &ids) {
+    uint32_t row_count = text.line_offsets.size();
+    lines.reserve(row_count);
+    for (uint32_t row = 0; row < row_count; row++) {
+      uint32_t start = text.line_offsets[row];
+      uint32_t end = row + 1 < row_count ? text.line_offsets[row + 1] : text.size();
+      auto entry = ids.emplace(LineKey{text.content.data() + start, end - start}, ids.size());
+      lines.push_back(entry.first->second);
+    }
+  }
+
+  void match_lines(uint32_t old_start, uint32_t old_end, uint32_t new_start, uint32_t new_end,
+                   unsigned depth) {
+    while (old_start < old_end && new_start < new_end &&
+           old_lines[old_start] == new_lines[new_start]) {
+      matches.push_back({old_start++, new_start++});
+    }
+
+    uint32_t suffix_size = 0;
+    while (old_start < old_end - suffix_size && new_start < new_end - suffix_size &&
+           old_lines[old_end - suffix_size - 1] == new_lines[new_end - suffix_size - 1]) {
+      suffix_size++;
+    }
+
+    if (depth < MAX_PATIENCE_DEPTH) {
+      match_unique_lines(old_start, old_end - suffix_size, new_start, new_end - suffix_size, depth);
+    } else {
+      match_lines_directly(old_start, old_end - suffix_size, new_start, new_end - suffix_size);
+    }
+
+    for (uint32_t i = suffix_size; i > 0; i--) {
+      matches.push_back({old_end - i, new_end - i});
+    }
+  }
+
+  void match_unique_lines(uint32_t old_start, uint32_t old_end, uint32_t new_start,
+                          uint32_t new_end, unsigned depth) {
+    if (old_start == old_end || new_start == new_end) return;
+
+    generation++;
+    for (uint32_t row = old_start; row < old_end; row++) {
+      Occurrence &occurrence = occurrences[old_lines[row]];
+      if (occurrence.generation != generation) {
+        occurrence = Occurrence{generation, 0, 0, 0};
+      }
+      occurrence.old_count++;
+    }
+    for (uint32_t row = new_start; row < new_end; row++) {
+      Occurrence &occurrence = occurrences[new_lines[row]];
+      if (occurrence.generation == generation) {
+        occurrence.new_count++;
+        occurrence.new_row = row;
+      }
+    }
+
+    vector<pair<uint32_t, uint32_t>> anchors;
+    for (uint32_t row = old_start; row < old_end; row++) {
+      const Occurrence &occurrence = occurrences[old_lines[row]];
+      if (occurrence.old_count == 1 && occurrence.new_count == 1) {
+        anchors.push_back({row, occurrence.new_row});
+      }
+    }
+
+    if (anchors.empty()) {
+      match_lines_directly(old_start, old_end, new_start, new_end);
+      return;
+    }
+
+    uint32_t old_row = old_start, new_row = new_start;
+    for (const auto &anchor : longest_increasing_subsequence(anchors)) {
+      match_lines(old_row, anchor.first, new_row, anchor.second, depth + 1);
+      matches.push_back(anchor);
+      old_row = anchor.first + 1;
+      new_row = anchor.second + 1;
+    }
+    match_lines(old_row, old_end, new_row, new_end, depth + 1);
+  }
+
+  // Returns the longest run of anchors, which are ordered by old row, whose
+  // new rows are also increasing.
+  static vector<pair<uint32_t, uint32_t>> longest_increasing_subsequence(
+    const vector<pair<uint32_t, uint32_t>> &anchors
+  ) {
+    vector<uint32_t> pile_tops;
+    vector<uint32_t> predecessors(anchors.size());
+    for (uint32_t i = 0; i < anchors.size(); i++) {
+      auto pile = std::lower_bound(
+        pile_tops.begin(), pile_tops.end(), anchors[i].second,
+        [&anchors](uint32_t index, uint32_t new_row) { return anchors[index].second < new_row; }
+      );
+      predecessors[i] = pile == pile_tops.begin() ? UINT32_MAX : *(pile - 1);
+      if (pile == pile_tops.end()) {
+        pile_tops.push_back(i);
+      } else {
+        *pile = i;
+      }
+    }
 
-  if (edit_distance == -1 || edit_distance >= MAX_EDIT_DISTANCE) {
-    result.splice(NativePoint(), old_text.extent(), new_text.extent(), old_text, new_text);
+    vector<pair<uint32_t, uint32_t>> result(pile_tops.size());
+    uint32_t index = pile_tops.empty() ? UINT32_MAX : pile_tops.back();
+    for (size_t i = result.size(); i > 0; i--) {
+      result[i - 1] = anchors[index];
+      index = predecessors[index];
+    }
     return result;
   }
 
-  size_t old_offset = 0;
-  size_t new_offset = 0;
-  NativePoint old_position;
-  NativePoint new_position;
+  // Diffs the rows as sequences of line ids, renumbered densely so that they
+  // fit the 16-bit units that `diff` compares. Leaves the rows unmatched if
+  // they differ too much.
+  void match_lines_directly(uint32_t old_start, uint32_t old_end, uint32_t new_start,
+                            uint32_t new_end) {
+    if (old_start == old_end || new_start == new_end) return;
+
+    generation++;
+    uint32_t local_id_count = 0;
+    std::u16string old_ids, new_ids;
+    old_ids.reserve(old_end - old_start);
+    new_ids.reserve(new_end - new_start);
+    for (uint32_t row = old_start; row < old_end; row++) {
+      Occurrence &occurrence = occurrences[old_lines[row]];
+      if (occurrence.generation != generation) {
+        occurrence = Occurrence{generation, 0, 0, local_id_count++};
+      }
+      old_ids.push_back(occurrence.new_row);
+    }
+    for (uint32_t row = new_start; row < new_end; row++) {
+      Occurrence &occurrence = occurrences[new_lines[row]];
+      if (occurrence.generation != generation) {
+        occurrence = Occurrence{generation, 0, 0, local_id_count++};
+      }
+      new_ids.push_back(occurrence.new_row);
+    }
+    if (local_id_count > UINT16_MAX) return;
+
+    vector<diff_edit> edit_script;
+    int edit_distance = diff(
+      old_ids.data(), old_ids.size(),
+      new_ids.data(), new_ids.size(),
+      MAX_EDIT_DISTANCE,
+      &edit_script
+    );
+    if (edit_distance == -1 || edit_distance >= MAX_EDIT_DISTANCE) return;
+
+    uint32_t old_row = old_start, new_row = new_start;
+    for (const diff_edit &edit : edit_script) {
+      switch (edit.op) {
+        case DIFF_MATCH:
+          for (uint32_t i = 0; i < edit.len; i++) {
+            matches.push_back({old_row++, new_row++});
+          }
+          break;
+        case DIFF_DELETE:
+          old_row += edit.len;
+          break;
+        case DIFF_INSERT:
+          new_row += edit.len;
+          break;
+      }
+    }
+  }
+
+ public:
+  // Pairs of matching old and new rows, in increasing order.
+  vector<pair<uint32_t, uint32_t>> matches;
+
+  LineMatcher(const Text &old_text, const Text &new_text) : generation{0} {
+    std::unordered_map<LineKey, uint32_t, LineKeyHash> ids;
+    add_lines(old_text, old_lines, ids);
+    add_lines(new_text, new_lines, ids);
+    occurrences.resize(ids.size(), Occurrence{0, 0, 0, 0});
+    match_lines(0, old_lines.size(), 0, new_lines.size(), 0);
+  }
+};
+
+}  // namespace
+
+static uint32_t offset_for_row(const Text &text, uint32_t row) {
+  return row < text.line_offsets.size() ? text.line_offsets[row] : text.size();
+}
+
+static NativePoint position_for_row(const Text &text, uint32_t row) {
+  return row < text.line_offsets.size() ? NativePoint(row, 0) : text.extent();
+}
+
+// Splices the changes in the given edit script, which describes the text
+// starting at the given offsets, into the patch.
+static void splice_edit_script(Patch &result, const Text &old_text, const Text &new_text,
+                               size_t old_offset, size_t new_offset,
+                               const vector<diff_edit> &edit_script) {
+  Text empty;
+  Text cr{u"\r"};
+  Text lf{u"\n"};
 
-  for (struct diff_edit &edit : edit_script) {
+  NativePoint old_position = old_text.position_for_offset(old_offset, 0, false);
+  NativePoint new_position = new_text.position_for_offset(new_offset, 0, false);
+
+  for (const diff_edit &edit : edit_script) {
     switch (edit.op) {
       case DIFF_MATCH:
         if (edit.len == 0) continue;
@@ -97,6 +316,66 @@ Patch text_diff(const Text &old_text, const Text &new_text) {
       }
     }
   }
+}
+
+// Diffs the given rows character by character, or replaces them whole if
+// they are too large or too different.
+static void splice_hunk(Patch &result, const Text &old_text, const Text &new_text,
+                        uint32_t old_start_row, uint32_t old_end_row,
+                        uint32_t new_start_row, uint32_t new_end_row) {
+  uint32_t old_start = offset_for_row(old_text, old_start_row);
+  uint32_t old_end = offset_for_row(old_text, old_end_row);
+  uint32_t new_start = offset_for_row(new_text, new_start_row);
+  uint32_t new_end = offset_for_row(new_text, new_end_row);
+
+  if (old_start < old_end && new_start < new_end &&
+      (old_end - old_start) + (new_end - new_start) <= MAX_CHARACTER_DIFF_SIZE) {
+    vector<diff_edit> edit_script;
+    int edit_distance = diff(
+      old_text.content.data() + old_start, old_end - old_start,
+      new_text.content.data() + new_start, new_end - new_start,
+      MAX_EDIT_DISTANCE,
+      &edit_script
+    );
+    if (edit_distance != -1 && edit_distance < MAX_EDIT_DISTANCE) {
+      splice_edit_script(result, old_text, new_text, old_start, new_start, edit_script);
+      return;
+    }
+  }
+
+  NativePoint old_start_position = position_for_row(old_text, old_start_row);
+  NativePoint new_start_position = position_for_row(new_text, new_start_row);
+  result.splice(
+    new_start_position,
+    position_for_row(old_text, old_end_row).traversal(old_start_position),
+    position_for_row(new_text, new_end_row).traversal(new_start_position),
+    Text{TextSlice(old_text).slice({old_start_position, position_for_row(old_text, old_end_row)})},
+    Text{TextSlice(new_text).slice({new_start_position, position_for_row(new_text, new_end_row)})}
+  );
+}
+
+// Diffs line by line first, then character by character within each run of
+// changed lines, so that a large rewrite doesn't turn into a single change.
+Patch text_diff(const Text &old_text, const Text &new_text) {
+  Patch result;
+  if (old_text == new_text) return result;
+
+  LineMatcher matcher(old_text, new_text);
+
+  uint32_t old_row = 0, new_row = 0;
+  for (const auto &match : matcher.matches) {
+    if (match.first > old_row || match.second > new_row) {
+      splice_hunk(result, old_text, new_text, old_row, match.first, new_row, match.second);
+    }
+    old_row = match.first + 1;
+    new_row = match.second + 1;
+  }
+
+  uint32_t old_row_count = old_text.line_offsets.size();
+  uint32_t new_row_count = new_text.line_offsets.size();
+  if (old_row < old_row_count || new_row < new_row_count) {
+    splice_hunk(result, old_text, new_text, old_row, old_row_count, new_row, new_row_count);
+  }
 
   return result;
 }
@@ -112,6 +112,10 @@ Text::const_iterator TextSlice::end() const {
   return text->cbegin() + end_offset();
 }
 
+uint16_t TextSlice::at(uint32_t offset) const {
+  return text->at(start_offset() + offset);
+}
+
 uint16_t TextSlice::front() const {
   return *begin();
 }
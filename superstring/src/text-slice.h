@@ -26,6 +26,7 @@ class TextSlice {
   TextSlice slice(NativeRange range) const;
   NativePoint position_for_offset(uint32_t offset, uint32_t min_row = 0) const;
   NativePoint extent() const;
+  uint16_t at(uint32_t offset) const;
   uint16_t front() const;
   uint16_t back() const;
   bool is_valid() const;
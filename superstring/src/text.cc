@@ -2,20 +2,111 @@
 #include <algorithm>
 #include "text-slice.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline uint32_t count_trailing_zeros(uint32_t value) {
+  unsigned long result;
+  _BitScanForward(&result, value);
+  return result;
+}
+#else
+static inline uint32_t count_trailing_zeros(uint32_t value) {
+  return __builtin_ctz(value);
+}
+#endif
+
 using std::function;
 using std::move;
 using std::ostream;
 using std::vector;
 using std::u16string;
 
-Text::Text() : line_offsets{0} {}
-
-Text::Text(u16string &&content) : content{move(content)}, line_offsets{0} {
-  for (uint32_t offset = 0, size = this->content.size(); offset < size; offset++) {
-    if (this->content[offset] == '\n') {
-      line_offsets.push_back(offset + 1);
+// Marks, in the high bit of a serialized text's size, a text written with one
+// byte per code unit.
+static const uint32_t ONE_BYTE_UNITS_FLAG = 1u << 31;
+
+// Scans content[start, end), optionally appending the offset that follows
+// each '\n' to `line_offsets`, and returns the bitwise OR of every code unit
+// scanned. Lines only end at LF, so a CRLF is indexed by its LF and a lone CR
+// doesn't start a new line.
+template <bool index_lines>
+static uint16_t scan_content(const char16_t *content, uint32_t start, uint32_t end,
+                             vector<uint32_t> *line_offsets) {
+  uint32_t offset = start;
+  uint16_t bits = 0;
+
+#if defined(__AVX2__)
+  const __m256i newlines = _mm256_set1_epi16('\n');
+  __m256i vector_bits = _mm256_setzero_si256();
+  for (; offset + 16 <= end; offset += 16) {
+    __m256i characters = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(content + offset));
+    vector_bits = _mm256_or_si256(vector_bits, characters);
+    if (index_lines) {
+      uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(characters, newlines));
+      while (mask) {
+        uint32_t index = count_trailing_zeros(mask) / 2;
+        line_offsets->push_back(offset + index + 1);
+        mask &= mask - 1;
+        mask &= mask - 1;
+      }
     }
   }
+  uint16_t lanes[16];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), vector_bits);
+  for (uint16_t lane : lanes) bits |= lane;
+#elif defined(__SSE2__) || defined(_M_X64)
+  const __m128i newlines = _mm_set1_epi16('\n');
+  __m128i vector_bits = _mm_setzero_si128();
+  for (; offset + 8 <= end; offset += 8) {
+    __m128i characters = _mm_loadu_si128(reinterpret_cast<const __m128i *>(content + offset));
+    vector_bits = _mm_or_si128(vector_bits, characters);
+    if (index_lines) {
+      uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi16(characters, newlines));
+      while (mask) {
+        uint32_t index = count_trailing_zeros(mask) / 2;
+        line_offsets->push_back(offset + index + 1);
+        mask &= mask - 1;
+        mask &= mask - 1;
+      }
+    }
+  }
+  uint16_t lanes[8];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), vector_bits);
+  for (uint16_t lane : lanes) bits |= lane;
+#endif
+
+  for (; offset < end; offset++) {
+    uint16_t character = content[offset];
+    bits |= character;
+    if (index_lines && character == '\n') line_offsets->push_back(offset + 1);
+  }
+
+  return bits;
+}
+
+static bool fits_in_one_byte(const char16_t *content, uint32_t size) {
+  return scan_content<false>(content, 0, size, nullptr) < 0x100;
+}
+
+static bool fits_in_one_byte(TextSlice slice) {
+  return fits_in_one_byte(slice.data(), slice.size());
+}
+
+void Text::index_line_offsets(vector<uint32_t> &line_offsets, const char16_t *content,
+                              uint32_t start, uint32_t end) {
+  scan_content<true>(content, start, end, &line_offsets);
+}
+
+Text::Text() : line_offsets{0}, compact{true} {}
+
+Text::Text(u16string &&content) : content{move(content)}, line_offsets{0} {
+  compact = scan_content<true>(
+    this->content.data(), 0, this->content.size(), &line_offsets
+  ) < 0x100;
 }
 
 Text::Text(const std::u16string &string) :
@@ -26,7 +117,8 @@ Text::Text(TextSlice slice) :
     slice.text->content.begin() + slice.start_offset(),
     slice.text->content.begin() + slice.end_offset()
   },
-  line_offsets{} {
+  line_offsets{},
+  compact{slice.text->compact || fits_in_one_byte(slice)} {
   line_offsets.push_back(slice.start_offset());
   line_offsets.insert(
     line_offsets.end(),
@@ -39,23 +131,49 @@ Text::Text(TextSlice slice) :
   }
 }
 
-Text::Text(const u16string &&content, const vector<uint32_t> &&line_offsets) :
-  content{move(content)}, line_offsets{move(line_offsets)} {}
+Text::Text(u16string &&content, vector<uint32_t> &&line_offsets) :
+  content{move(content)},
+  line_offsets{move(line_offsets)},
+  compact{fits_in_one_byte(this->content.data(), this->content.size())} {}
 
-Text::Text(Deserializer &deserializer) : line_offsets{0} {
+// Compact texts are written with one byte per code unit, which is flagged in
+// the high bit of the size. Wide texts are written as little-endian UTF-16,
+// so on little-endian hosts both directions are a single copy.
+Text::Text(Deserializer &deserializer, bool allows_one_byte_units) : line_offsets{0} {
   uint32_t size = deserializer.read<uint32_t>();
-  content.reserve(size);
-  for (uint32_t offset = 0; offset < size; offset++) {
-    uint16_t character = deserializer.read<uint16_t>();
-    content.push_back(character);
-    if (character == '\n') line_offsets.push_back(offset + 1);
+  bool has_one_byte_units = allows_one_byte_units && (size & ONE_BYTE_UNITS_FLAG);
+  if (has_one_byte_units) size &= ~ONE_BYTE_UNITS_FLAG;
+  const uint8_t *bytes = deserializer.read_bytes(has_one_byte_units ? size : size * 2ul);
+  if (!bytes) size = 0;
+
+  content.resize(size);
+  if (has_one_byte_units) {
+    for (uint32_t offset = 0; offset < size; offset++) {
+      content[offset] = bytes[offset];
+    }
+  } else {
+#ifdef SERIALIZER_BIG_ENDIAN
+    for (uint32_t offset = 0; offset < size; offset++) {
+      content[offset] = bytes[2 * offset] | (bytes[2 * offset + 1] << 8);
+    }
+#else
+    if (size > 0) std::memcpy(&content[0], bytes, size * sizeof(char16_t));
+#endif
   }
+
+  compact = scan_content<true>(content.data(), 0, size, &line_offsets) < 0x100;
 }
 
-void Text::serialize(Serializer &serializer) const {
-  serializer.append<uint32_t>(size());
-  for (uint16_t character : content) {
-    serializer.append<uint16_t>(character);
+void Text::serialize(Serializer &serializer, bool allows_one_byte_units) const {
+  if (allows_one_byte_units && compact) {
+    serializer.append<uint32_t>(size() | ONE_BYTE_UNITS_FLAG);
+    uint8_t *bytes = serializer.extend(size());
+    for (uint16_t character : content) {
+      *bytes++ = character;
+    }
+  } else {
+    serializer.append<uint32_t>(size());
+    serializer.append_array(reinterpret_cast<const uint16_t *>(content.data()), content.size());
   }
 }
 
@@ -90,6 +208,7 @@ Text Text::concat(TextSlice a, TextSlice b, TextSlice c) {
 void Text::clear() {
   content.clear();
   line_offsets.assign({0});
+  compact = true;
 }
 
 template<typename T>
@@ -137,6 +256,9 @@ void Text::splice(NativePoint start, NativePoint deletion_extent, TextSlice inse
   uint32_t content_splice_start = offset_for_position(start);
   uint32_t content_splice_end = offset_for_position(start.traverse(deletion_extent));
   uint32_t original_content_size = content.size();
+  if (compact && !inserted_slice.text->compact) {
+    compact = fits_in_one_byte(inserted_slice);
+  }
   splice_vector(
     content,
     content_splice_start,
@@ -243,6 +365,10 @@ bool Text::empty() const {
   return content.empty();
 }
 
+bool Text::is_compact() const {
+  return compact;
+}
+
 template <typename T>
 inline void hash_combine(std::size_t &seed, const T &value) {
   std::hash<T> hasher;
@@ -259,6 +385,9 @@ size_t Text::digest() const {
 
 void Text::append(TextSlice slice) {
   int64_t line_offset_delta = static_cast<int64_t>(content.size()) - static_cast<int64_t>(slice.start_offset());
+  if (compact && !slice.text->compact) {
+    compact = fits_in_one_byte(slice);
+  }
 
   content.insert(
     content.end(),
@@ -280,6 +409,7 @@ void Text::append(TextSlice slice) {
 
 void Text::assign(TextSlice slice) {
   uint32_t slice_start_offset = slice.start_offset();
+  compact = slice.text->compact || fits_in_one_byte(slice);
 
   content.assign(
     slice.begin(),
@@ -21,10 +21,11 @@ class Text {
 
  public:
   static NativePoint extent(const std::u16string &);
+  static void index_line_offsets(std::vector<uint32_t> &, const char16_t *, uint32_t start, uint32_t end);
 
   std::u16string content;
   std::vector<uint32_t> line_offsets;
-  Text(const std::u16string &&, const std::vector<uint32_t> &&);
+  Text(std::u16string &&, std::vector<uint32_t> &&);
 
   using const_iterator = std::u16string::const_iterator;
 
@@ -32,7 +33,9 @@ class Text {
   Text(const std::u16string &);
   Text(std::u16string &&);
   Text(TextSlice slice);
-  Text(Deserializer &deserializer);
+  // Formats that allow it store compact texts with one byte per code unit.
+  // Older formats always use two.
+  Text(Deserializer &deserializer, bool allows_one_byte_units = false);
   template<typename Iter>
   Text(Iter begin, Iter end) : Text(std::u16string{begin, end}) {}
 
@@ -54,16 +57,24 @@ class Text {
   uint32_t line_length_for_row(uint32_t row) const;
   void append(TextSlice);
   void assign(TextSlice);
-  void serialize(Serializer &) const;
+  void serialize(Serializer &, bool allows_one_byte_units = false) const;
   uint32_t size() const;
   const char16_t *data() const;
   size_t digest() const;
+  bool is_compact() const;
   void clear();
 
   bool operator!=(const Text &) const;
   bool operator==(const Text &) const;
 
   friend std::ostream &operator<<(std::ostream &, const Text &);
+
+ private:
+  // Whether every code unit in `content` is known to be below 0x100, in
+  // which case the text can be transcoded as one byte per code unit. It is
+  // only a query: the content is still stored as UTF-16. Deleting the last
+  // wide character doesn't clear it.
+  bool compact;
 };
 
 #endif // SUPERSTRING_TEXT_H_
@@ -0,0 +1,156 @@
+#include "word-index.h"
+#include <algorithm>
+#include <cassert>
+#include <cwctype>
+
+using std::u16string;
+using std::vector;
+
+const size_t WordIndex::MAX_WORD_LENGTH;
+
+WordIndex::WordIndex(const u16string &extra_word_characters) :
+  extra_word_characters_{extra_word_characters},
+  is_built{false} {}
+
+const u16string &WordIndex::extra_word_characters() const {
+  return extra_word_characters_;
+}
+
+bool WordIndex::is_word_character(char16_t c) const {
+  return
+    std::iswalnum(c) ||
+    std::find(extra_word_characters_.begin(), extra_word_characters_.end(), c) != extra_word_characters_.end();
+}
+
+void WordIndex::splice(NativePoint start, NativePoint deletion_extent, NativePoint insertion_extent) {
+  if (is_built) pending_changes.splice(start, deletion_extent, insertion_extent);
+}
+
+void WordIndex::update(NativePoint extent, const ReadText &read_text) {
+  vector<std::pair<uint32_t, uint32_t>> stale_row_ranges;
+
+  if (!is_built) {
+    rows.assign(extent.row + 1, vector<Occurrence>{});
+    stale_row_ranges.push_back({0, extent.row});
+    is_built = true;
+  } else {
+    auto changes = pending_changes.get_changes();
+    pending_changes.clear();
+
+    // Work backward so that the rows of each change are still where they
+    // were before it. Rows shared by adjacent changes are cleared twice and
+    // replaced twice, which leaves the right number of rows.
+    for (auto change = changes.rbegin(); change != changes.rend(); ++change) {
+      uint32_t start_row = change->old_start.row;
+      uint32_t old_row_count = change->old_end.row - start_row + 1;
+      uint32_t new_row_count = change->new_end.row - change->new_start.row + 1;
+      for (uint32_t row = start_row; row < start_row + old_row_count; row++) clear_row(row);
+      if (new_row_count > old_row_count) {
+        rows.insert(rows.begin() + start_row + old_row_count, new_row_count - old_row_count, vector<Occurrence>{});
+      } else {
+        rows.erase(rows.begin() + start_row + new_row_count, rows.begin() + start_row + old_row_count);
+      }
+    }
+
+    for (const auto &change : changes) {
+      if (!stale_row_ranges.empty() && change.new_start.row <= stale_row_ranges.back().second + 1) {
+        stale_row_ranges.back().second = std::max(stale_row_ranges.back().second, change.new_end.row);
+      } else {
+        stale_row_ranges.push_back({change.new_start.row, change.new_end.row});
+      }
+    }
+  }
+
+  assert(rows.size() == extent.row + 1);
+  for (const auto &row_range : stale_row_ranges) {
+    index_rows(row_range.first, row_range.second, extent, read_text);
+  }
+}
+
+uint32_t WordIndex::row_count() const {
+  return rows.size();
+}
+
+const vector<WordIndex::Occurrence> &WordIndex::occurrences_in_row(uint32_t row) const {
+  return rows[row];
+}
+
+uint32_t WordIndex::word_id_limit() const {
+  return words.size();
+}
+
+const u16string *WordIndex::word(uint32_t word_id) const {
+  return words[word_id].text;
+}
+
+uint32_t WordIndex::occurrence_count(uint32_t word_id) const {
+  return words[word_id].occurrence_count;
+}
+
+optional<uint32_t> WordIndex::find_word(const u16string &word) const {
+  auto entry = word_ids.find(word);
+  if (entry == word_ids.end()) return optional<uint32_t>{};
+  return entry->second;
+}
+
+void WordIndex::clear_row(uint32_t row) {
+  for (const Occurrence &occurrence : rows[row]) {
+    Word &word = words[occurrence.word_id];
+    if (--word.occurrence_count == 0) {
+      word_ids.erase(*word.text);
+      word.text = nullptr;
+      free_word_ids.push_back(occurrence.word_id);
+    }
+  }
+  rows[row].clear();
+}
+
+void WordIndex::index_rows(uint32_t start_row, uint32_t end_row, NativePoint extent, const ReadText &read_text) {
+  for (uint32_t row = start_row; row <= end_row; row++) clear_row(row);
+
+  NativePoint position(start_row, 0);
+  uint32_t word_start_column = 0;
+  u16string current_word;
+  NativePoint end = end_row < extent.row ? NativePoint(end_row + 1, 0) : extent;
+  read_text(position, end, [&](const char16_t *characters, uint32_t length) {
+    for (const char16_t *c = characters, *characters_end = characters + length; c != characters_end; ++c) {
+      if (is_word_character(*c)) {
+        if (current_word.empty()) word_start_column = position.column;
+        current_word += *c;
+      } else if (!current_word.empty()) {
+        add_occurrence(position.row, word_start_column, current_word);
+        current_word.clear();
+      }
+
+      if (*c == '\n') {
+        position.row++;
+        position.column = 0;
+      } else {
+        position.column++;
+      }
+    }
+  });
+
+  if (!current_word.empty()) add_occurrence(position.row, word_start_column, current_word);
+}
+
+void WordIndex::add_occurrence(uint32_t row, uint32_t column, const u16string &word) {
+  if (word.size() > MAX_WORD_LENGTH) return;
+
+  auto entry = word_ids.find(word);
+  if (entry == word_ids.end()) {
+    uint32_t word_id;
+    if (free_word_ids.empty()) {
+      word_id = words.size();
+      words.push_back(Word{nullptr, 0});
+    } else {
+      word_id = free_word_ids.back();
+      free_word_ids.pop_back();
+    }
+    entry = word_ids.emplace(word, word_id).first;
+    words[word_id].text = &entry->first;
+  }
+
+  words[entry->second].occurrence_count++;
+  rows[row].push_back(Occurrence{column, entry->second});
+}
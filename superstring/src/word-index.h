@@ -0,0 +1,69 @@
+#ifndef SUPERSTRING_WORD_INDEX_H_
+#define SUPERSTRING_WORD_INDEX_H_
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "native-point.h"
+#include "optional.h"
+#include "patch.h"
+
+// The words on each row of a buffer, where a word is a run of alphanumeric
+// characters and `extra_word_characters`, which must not include '\n'.
+// Edits are only recorded as they happen; the rows they touch are read and
+// indexed again by the next `update`, so a burst of typing on one line costs
+// a single re-index.
+class WordIndex {
+ public:
+  // Longer words are never matched, so they are left out of the index.
+  static const size_t MAX_WORD_LENGTH = 80;
+
+  struct Occurrence {
+    uint32_t column;
+    uint32_t word_id;
+  };
+
+  // Calls the callback with successive chunks of the text between two
+  // positions.
+  using ReadText = std::function<void(NativePoint, NativePoint,
+                                      const std::function<void(const char16_t *, uint32_t)> &)>;
+
+  explicit WordIndex(const std::u16string &extra_word_characters);
+
+  const std::u16string &extra_word_characters() const;
+  bool is_word_character(char16_t) const;
+
+  void splice(NativePoint start, NativePoint deletion_extent, NativePoint insertion_extent);
+  void update(NativePoint extent, const ReadText &);
+
+  uint32_t row_count() const;
+  const std::vector<Occurrence> &occurrences_in_row(uint32_t row) const;
+
+  // Word ids are below `word_id_limit`. The ids of words that no longer
+  // occur are reused, and `word` returns null for them until then.
+  uint32_t word_id_limit() const;
+  const std::u16string *word(uint32_t word_id) const;
+  uint32_t occurrence_count(uint32_t word_id) const;
+  optional<uint32_t> find_word(const std::u16string &) const;
+
+ private:
+  struct Word {
+    const std::u16string *text;
+    uint32_t occurrence_count;
+  };
+
+  void clear_row(uint32_t row);
+  void index_rows(uint32_t start_row, uint32_t end_row, NativePoint extent, const ReadText &);
+  void add_occurrence(uint32_t row, uint32_t column, const std::u16string &word);
+
+  std::u16string extra_word_characters_;
+  Patch pending_changes;
+  bool is_built;
+  std::vector<std::vector<Occurrence>> rows;
+  std::vector<Word> words;
+  std::vector<uint32_t> free_word_ids;
+  std::unordered_map<std::u16string, uint32_t> word_ids;
+};
+
+#endif // SUPERSTRING_WORD_INDEX_H_
@@ -27,6 +27,26 @@ TEST_CASE("EncodingConversion::decode - basic UTF-8") {
   REQUIRE(string2 == u"abγdefg\nhijklmnop");
 }
 
+TEST_CASE("EncodingConversion::decode - stopping a stream early") {
+  auto conversion = transcoding_from("UTF-8");
+  FILE *file = tmpfile();
+  string input(10000, 'a');
+  fwrite(input.data(), 1, input.size(), file);
+  rewind(file);
+
+  u16string string;
+  vector<char> buffer(1000);
+  vector<size_t> progress;
+  REQUIRE(conversion->decode(string, file, buffer, 0, [&progress](size_t bytes_read) {
+    progress.push_back(bytes_read);
+    return progress.size() < 2;
+  }));
+  fclose(file);
+
+  REQUIRE(progress == vector<size_t>({1000, 2000}));
+  REQUIRE(string == u16string(2000, 'a'));
+}
+
 TEST_CASE("EncodingConversion::decode - basic ISO-8859-1") {
   auto conversion = transcoding_from("ISO-8859-1");
   string input("qrst" "\xfc" "v"); // qrstüv
@@ -145,3 +165,167 @@ TEST_CASE("EncodingConversion::encode - invalid characters at the end of the str
     string, &start, string.size(), output.data(), output.size(), true);
   REQUIRE(std::string(output.data(), bytes_encoded) == "abc" "\ufffd");
 }
+
+TEST_CASE("EncodingConversion::decode - invalid byte sequences between long ASCII runs") {
+  auto conversion = transcoding_from("UTF-8");
+
+  // Place the invalid bytes at every offset within a block of ASCII.
+  for (size_t prefix_length = 0; prefix_length < 40; prefix_length++) {
+    string prefix(prefix_length, 'a'), suffix(40, 'b');
+    u16string expected_prefix(prefix_length, u'a'), expected_suffix(40, u'b');
+
+    u16string decoded;
+    string input = prefix + "\xc0" + suffix;
+    conversion->decode(decoded, input.data(), input.size());
+    REQUIRE(decoded == expected_prefix + u"�" + expected_suffix);
+
+    // A three-byte sequence cut short by an ASCII byte.
+    decoded.clear();
+    input = prefix + "\xe2\x82" + suffix;
+    conversion->decode(decoded, input.data(), input.size());
+    REQUIRE(decoded == expected_prefix + u"��" + expected_suffix);
+
+    decoded.clear();
+    input = prefix + "\xe2\x82\xac" + suffix; // '€'
+    conversion->decode(decoded, input.data(), input.size());
+    REQUIRE(decoded == expected_prefix + u"€" + expected_suffix);
+  }
+}
+
+TEST_CASE("EncodingConversion::encode - invalid characters between long ASCII runs") {
+  auto conversion = transcoding_to("UTF-8");
+
+  for (size_t prefix_length = 0; prefix_length < 40; prefix_length++) {
+    u16string prefix(prefix_length, u'a'), suffix(40, u'b');
+    u16string string = prefix + u"\xd800" + suffix;
+
+    vector<char> output(200);
+    size_t start = 0;
+    size_t bytes_encoded = conversion->encode(
+      string, &start, string.size(), output.data(), output.size());
+    REQUIRE(std::string(output.data(), bytes_encoded) ==
+      std::string(prefix_length, 'a') + "�" + std::string(40, 'b'));
+  }
+}
+
+TEST_CASE("EncodingConversion - native UTF-8 and ISO-8859-1 conversions match iconv") {
+  // iconv handles these aliases, while "UTF-8" and "ISO-8859-1" are
+  // converted natively.
+  auto native_utf8_decoder = transcoding_from("UTF-8");
+  auto native_utf8_encoder = transcoding_to("UTF-8");
+  auto iconv_utf8_decoder = transcoding_from("UTF8");
+  auto iconv_utf8_encoder = transcoding_to("UTF8");
+  auto native_latin1_decoder = transcoding_from("ISO-8859-1");
+  auto native_latin1_encoder = transcoding_to("ISO-8859-1");
+  auto iconv_latin1_decoder = transcoding_from("ISO_8859-1");
+
+  auto t = time(nullptr);
+  for (uint32_t i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    // Mostly ASCII, with an occasional multi-byte character, as in source code.
+    u16string text;
+    for (uint32_t j = 0, n = rand() % 200; j < n; j++) {
+      switch (rand() % 20) {
+        case 0: text += u"γ"; break;
+        case 1: text += u"€"; break;
+        case 2: text += u"\xd83d\xde01"; break;
+        case 3: text += static_cast<char16_t>(0x80 + rand() % 0x80); break;
+        default: text += static_cast<char16_t>(' ' + rand() % 95); break;
+      }
+    }
+
+    vector<char> native_bytes(text.size() * 4 + 1), iconv_bytes(text.size() * 4 + 1);
+    size_t native_start = 0, iconv_start = 0;
+    size_t native_length = native_utf8_encoder->encode(
+      text, &native_start, text.size(), native_bytes.data(), native_bytes.size(), true);
+    size_t iconv_length = iconv_utf8_encoder->encode(
+      text, &iconv_start, text.size(), iconv_bytes.data(), iconv_bytes.size(), true);
+    REQUIRE(std::string(native_bytes.data(), native_length) == std::string(iconv_bytes.data(), iconv_length));
+    REQUIRE(native_start == text.size());
+
+    u16string native_text, iconv_text;
+    native_utf8_decoder->decode(native_text, native_bytes.data(), native_length, true);
+    iconv_utf8_decoder->decode(iconv_text, native_bytes.data(), native_length, true);
+    REQUIRE(native_text == text);
+    REQUIRE(iconv_text == text);
+
+    // Every byte is a valid Latin-1 character.
+    string latin1_input;
+    for (uint32_t j = 0, n = rand() % 200; j < n; j++) {
+      latin1_input += static_cast<char>(rand() % 256);
+    }
+    native_text.clear();
+    iconv_text.clear();
+    native_latin1_decoder->decode(native_text, latin1_input.data(), latin1_input.size(), true);
+    iconv_latin1_decoder->decode(iconv_text, latin1_input.data(), latin1_input.size(), true);
+    REQUIRE(native_text == iconv_text);
+
+    vector<char> latin1_output(native_text.size() + 1);
+    size_t latin1_start = 0;
+    size_t latin1_length = native_latin1_encoder->encode(
+      native_text, &latin1_start, native_text.size(), latin1_output.data(), latin1_output.size(), true);
+    REQUIRE(std::string(latin1_output.data(), latin1_length) == latin1_input);
+  }
+}
+
+TEST_CASE("EncodingConversion::encode - characters outside of ISO-8859-1") {
+  auto conversion = transcoding_to("ISO-8859-1");
+  u16string string = u"abcdefghijklmnopqrstü" u"γ" u"xyz";
+
+  vector<char> output(30);
+  size_t start = 0;
+  size_t bytes_encoded = conversion->encode(
+    string, &start, string.size(), output.data(), output.size());
+  REQUIRE(std::string(output.data(), bytes_encoded) == "abcdefghijklmnopqrst" "\xfc");
+  REQUIRE(start == 21);
+}
+
+TEST_CASE("detect_encoding") {
+  REQUIRE(string(detect_encoding("", 0)) == "UTF-8");
+  REQUIRE(string(detect_encoding("abc", 3)) == "UTF-8");
+  REQUIRE(string(detect_encoding("\xef\xbb\xbf" "abc", 6)) == "UTF-8");
+  REQUIRE(string(detect_encoding("\xfe\xff" "\0a\0b", 6)) == "UTF-16BE");
+  REQUIRE(string(detect_encoding("a\0b\0c\0d\0", 8)) == "UTF-16LE");
+  REQUIRE(string(detect_encoding("\0a\0b\0c\0d", 8)) == "UTF-16BE");
+  REQUIRE(string(detect_encoding("abc \xce\xb3", 6)) == "UTF-8");
+  REQUIRE(string(detect_encoding("caf\xe9", 4)) == "ISO-8859-1");
+  REQUIRE(string(detect_encoding("\x93quoted\x94", 8)) == "WINDOWS-1252");
+  REQUIRE(string(detect_encoding("\x81\x93", 2)) == "ISO-8859-1");
+
+  // A character cut off at the end of the data only counts against UTF-8 if
+  // the data is the whole file.
+  REQUIRE(string(detect_encoding("abc \xce", 5, false)) == "UTF-8");
+  REQUIRE(string(detect_encoding("abc \xce", 5, true)) == "ISO-8859-1");
+
+  // Blocks that are sampled from the middle of the data may begin in the
+  // middle of a character.
+  string content;
+  while (content.size() < 1024 * 1024) content += "\xce\xb3";
+  REQUIRE(string(detect_encoding(content.data(), content.size() - 1, false)) == "UTF-8");
+  content[content.size() / 2 + 1] = '\xff';
+  content.insert(content.size() / 2, 4096 * 16, '\xff');
+  REQUIRE(string(detect_encoding(content.data(), content.size())) == "ISO-8859-1");
+}
+
+TEST_CASE("detect_encoding_from_ranges") {
+  auto detect_from_ranges = [](const string &content) {
+    string samples;
+    for (const auto &range : encoding_detection_ranges(content.size())) {
+      samples += content.substr(range.first, range.second);
+    }
+    return string(detect_encoding_from_ranges(samples.data(), content.size()));
+  };
+
+  REQUIRE(detect_from_ranges("") == "UTF-8");
+  REQUIRE(detect_from_ranges("caf\xe9") == "ISO-8859-1");
+
+  string content;
+  while (content.size() < 1024 * 1024) content += "\xce\xb3";
+  REQUIRE(detect_from_ranges(content) == "UTF-8");
+  content.insert(content.size() / 2, 4096 * 16, '\x93');
+  REQUIRE(detect_from_ranges(content) == string(detect_encoding(content.data(), content.size())));
+  REQUIRE(detect_from_ranges(content) == "WINDOWS-1252");
+}
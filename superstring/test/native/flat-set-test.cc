@@ -0,0 +1,65 @@
+#include "test-helpers.h"
+#include "flat_set.h"
+
+using std::vector;
+
+template <typename Set>
+static vector<unsigned> contents(const Set &set) {
+  return vector<unsigned>(set.begin(), set.end());
+}
+
+TEST_CASE("small_flat_set - growing past its inline storage") {
+  small_flat_set<unsigned, 2> set;
+  set.insert(5);
+  set.insert(1);
+  set.insert(5);
+  REQUIRE(contents(set) == vector<unsigned>({1, 5}));
+
+  set.insert(3);
+  set.insert(9);
+  set.insert(0);
+  REQUIRE(set.size() == 5);
+  REQUIRE(contents(set) == vector<unsigned>({0, 1, 3, 5, 9}));
+  REQUIRE(set.count(3) == 1);
+  REQUIRE(set.count(4) == 0);
+
+  // Copies own their storage, whether it is inline or not.
+  small_flat_set<unsigned, 2> copy(set);
+  set.erase(3u);
+  REQUIRE(contents(copy) == vector<unsigned>({0, 1, 3, 5, 9}));
+  REQUIRE(contents(set) == vector<unsigned>({0, 1, 5, 9}));
+
+  small_flat_set<unsigned, 2> small;
+  small.insert(7);
+  small_flat_set<unsigned, 2> small_copy(small);
+  small.insert(8);
+  REQUIRE(contents(small_copy) == vector<unsigned>({7}));
+}
+
+TEST_CASE("small_flat_set - erasing") {
+  small_flat_set<unsigned, 2> set;
+  for (unsigned i = 0; i < 6; i++) set.insert(i);
+
+  set.erase(10u);
+  REQUIRE(set.size() == 6);
+
+  auto iter = set.erase(set.begin() + 1);
+  REQUIRE(*iter == 2);
+  set.erase(5u);
+  set.erase(0u);
+  REQUIRE(contents(set) == vector<unsigned>({2, 3, 4}));
+
+  for (auto iter = set.begin(); iter != set.end();) {
+    if (*iter % 2 == 0) {
+      iter = set.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  REQUIRE(contents(set) == vector<unsigned>({3}));
+
+  set.clear();
+  REQUIRE(set.size() == 0);
+  set.insert(4);
+  REQUIRE(contents(set) == vector<unsigned>({4}));
+}
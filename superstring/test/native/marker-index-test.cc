@@ -0,0 +1,303 @@
+#include "test-helpers.h"
+#include "marker-index.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+using std::pair;
+using std::vector;
+using MarkerId = MarkerIndex::MarkerId;
+
+static NativeRange get_random_marker_range(Generator &rand) {
+  NativePoint start(rand() % 50, rand() % 20);
+  NativePoint end = start;
+  if (rand() % 2) end = end.traverse(NativePoint(rand() % 5, rand() % 20));
+  return NativeRange{start, end};
+}
+
+static vector<MarkerId> ids(const flat_set<MarkerId> &set) {
+  return vector<MarkerId>(set.begin(), set.end());
+}
+
+static void require_same_markers(MarkerIndex &actual, MarkerIndex &expected, Generator &rand) {
+  REQUIRE(actual.dump() == expected.dump());
+  for (unsigned i = 0; i < 20; i++) {
+    NativeRange range = get_random_marker_range(rand);
+    REQUIRE(ids(actual.find_intersecting(range.start, range.end)) == ids(expected.find_intersecting(range.start, range.end)));
+    REQUIRE(ids(actual.find_containing(range.start, range.end)) == ids(expected.find_containing(range.start, range.end)));
+    REQUIRE(ids(actual.find_contained_in(range.start, range.end)) == ids(expected.find_contained_in(range.start, range.end)));
+    REQUIRE(ids(actual.find_starting_in(range.start, range.end)) == ids(expected.find_starting_in(range.start, range.end)));
+    REQUIRE(ids(actual.find_ending_in(range.start, range.end)) == ids(expected.find_ending_in(range.start, range.end)));
+  }
+}
+
+TEST_CASE("MarkerIndex::insert_batch - randomized batches") {
+  auto t = time(nullptr);
+  for (unsigned i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex batched(seed);
+    MarkerIndex individual(seed);
+    MarkerId next_id = 0;
+
+    for (unsigned j = 0, n = rand() % 20; j < n; j++) {
+      NativeRange range = get_random_marker_range(rand);
+      batched.insert(next_id, range.start, range.end);
+      individual.insert(next_id, range.start, range.end);
+      next_id++;
+    }
+
+    // Alternate between batches small enough to be inserted one at a time and
+    // batches large enough to rebuild the tree.
+    for (unsigned j = 0; j < 3; j++) {
+      vector<pair<MarkerId, NativeRange>> batch;
+      for (unsigned k = 0, n = rand() % 2 ? rand() % 5 : 10 + rand() % 50; k < n; k++) {
+        batch.push_back({next_id++, get_random_marker_range(rand)});
+      }
+      batched.insert_batch(batch);
+      for (const auto &marker : batch) {
+        individual.insert(marker.first, marker.second.start, marker.second.end);
+      }
+      require_same_markers(batched, individual, rand);
+    }
+
+    // The rebuilt tree must keep working with the other operations.
+    for (unsigned j = 0; j < 5; j++) {
+      NativeRange range = get_random_marker_range(rand);
+      NativePoint new_extent(rand() % 3, rand() % 10);
+      auto batched_result = batched.splice(range.start, range.extent(), new_extent);
+      auto individual_result = individual.splice(range.start, range.extent(), new_extent);
+      REQUIRE(ids(batched_result.touch) == ids(individual_result.touch));
+      REQUIRE(ids(batched_result.inside) == ids(individual_result.inside));
+      REQUIRE(ids(batched_result.overlap) == ids(individual_result.overlap));
+      REQUIRE(ids(batched_result.surround) == ids(individual_result.surround));
+
+      MarkerId id = rand() % next_id;
+      if (batched.has(id)) {
+        batched.remove(id);
+        individual.remove(id);
+      }
+      require_same_markers(batched, individual, rand);
+    }
+  }
+}
+
+TEST_CASE("MarkerIndex::splice_batch - randomized batches") {
+  // Positions are drawn from a small space so that markers often start or
+  // end exactly where splices do.
+  auto get_random_point = [](Generator &rand) { return NativePoint(rand() % 4, rand() % 6); };
+
+  auto t = time(nullptr);
+  for (unsigned i = 0; i < 300; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex batched(seed);
+    MarkerIndex individual(seed);
+
+    // Some indices have enough markers that small batches are spliced one
+    // at a time.
+    for (MarkerId id = 0, n = rand() % 2 ? rand() % 10 : 100 + rand() % 100; id < n; id++) {
+      NativePoint start = get_random_point(rand), end = get_random_point(rand);
+      if (end < start) std::swap(start, end);
+      batched.insert(id, start, end);
+      individual.insert(id, start, end);
+      if (rand() % 2) {
+        batched.set_exclusive(id, true);
+        individual.set_exclusive(id, true);
+      }
+    }
+
+    for (unsigned j = 0; j < 3; j++) {
+      vector<NativePoint> points;
+      for (unsigned k = 0, n = rand() % 12; k < n; k++) points.push_back(get_random_point(rand));
+      std::sort(points.begin(), points.end());
+
+      vector<MarkerIndex::Splice> splices;
+      for (size_t k = 0; k + 1 < points.size(); k += 2) {
+        NativePoint new_extent = rand() % 3 ? NativePoint(rand() % 2, rand() % 3) : NativePoint();
+        splices.push_back({points[k], points[k + 1].traversal(points[k]), new_extent});
+      }
+
+      REQUIRE(batched.splice_batch(splices));
+      for (auto splice = splices.rbegin(); splice != splices.rend(); ++splice) {
+        individual.splice(splice->start, splice->old_extent, splice->new_extent);
+      }
+      require_same_markers(batched, individual, rand);
+    }
+  }
+}
+
+TEST_CASE("MarkerIndex::splice_batch - overlapping splices") {
+  MarkerIndex marker_index;
+  marker_index.insert(1, {0, 2}, {0, 6});
+
+  REQUIRE(!marker_index.splice_batch({
+    {{0, 1}, {0, 3}, {0, 0}},
+    {{0, 3}, {0, 2}, {0, 1}},
+  }));
+  REQUIRE(marker_index.get_range(1) == (NativeRange{{0, 2}, {0, 6}}));
+}
+
+TEST_CASE("MarkerIndex::BoundaryCursor - randomized markers") {
+  auto t = time(nullptr);
+  for (unsigned i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    MarkerIndex marker_index(seed);
+    for (MarkerId id = 0, n = rand() % 50; id < n; id++) {
+      NativeRange range = get_random_marker_range(rand);
+      marker_index.insert(id, range.start, range.end);
+    }
+    NativeRange spliced_range = get_random_marker_range(rand);
+    marker_index.splice(spliced_range.start, spliced_range.extent(), NativePoint(rand() % 2, rand() % 5));
+    auto ranges = marker_index.dump();
+
+    MarkerIndex::BoundaryCursor cursor(&marker_index);
+    vector<MarkerId> containing;
+    for (unsigned j = 0; j < 10; j++) {
+      NativePoint start = get_random_marker_range(rand).start;
+
+      vector<MarkerId> expected_containing;
+      std::map<NativePoint, pair<vector<MarkerId>, vector<MarkerId>>> expected_boundaries;
+      for (const auto &entry : ranges) {
+        if (entry.second.start < start && start <= entry.second.end) expected_containing.push_back(entry.first);
+        if (start <= entry.second.start) expected_boundaries[entry.second.start].first.push_back(entry.first);
+        if (start <= entry.second.end) expected_boundaries[entry.second.end].second.push_back(entry.first);
+      }
+      std::sort(expected_containing.begin(), expected_containing.end(), [&](MarkerId a, MarkerId b) {
+        int comparison = marker_index.compare(a, b);
+        return comparison == 0 ? a < b : comparison == -1;
+      });
+
+      // Ids appended by seeking must not disturb what the vector holds.
+      containing.assign(1, UINT32_MAX);
+      cursor.seek(start, &containing);
+      REQUIRE(containing.front() == UINT32_MAX);
+      REQUIRE(vector<MarkerId>(containing.begin() + 1, containing.end()) == expected_containing);
+
+      for (auto &boundary : expected_boundaries) {
+        std::sort(boundary.second.first.begin(), boundary.second.first.end());
+        std::sort(boundary.second.second.begin(), boundary.second.second.end());
+        REQUIRE(!cursor.at_end());
+        REQUIRE(cursor.position() == boundary.first);
+        MarkerIndex::MarkerIdSpan starting = cursor.starting(), ending = cursor.ending();
+        REQUIRE(vector<MarkerId>(starting.begin(), starting.end()) == boundary.second.first);
+        REQUIRE(vector<MarkerId>(ending.begin(), ending.end()) == boundary.second.second);
+        cursor.advance();
+      }
+      REQUIRE(cursor.at_end());
+
+      size_t max_count = rand() % 5;
+      auto result = marker_index.find_boundaries_after(start, max_count);
+      REQUIRE(result.containing_start == expected_containing);
+      REQUIRE(result.boundaries.size() == std::min(max_count, expected_boundaries.size()));
+      auto expected_boundary = expected_boundaries.begin();
+      for (const auto &boundary : result.boundaries) {
+        REQUIRE(boundary.position == expected_boundary->first);
+        REQUIRE(ids(boundary.starting) == expected_boundary->second.first);
+        REQUIRE(ids(boundary.ending) == expected_boundary->second.second);
+        ++expected_boundary;
+      }
+    }
+  }
+}
+
+TEST_CASE("MarkerIndex::create_snapshot and MarkerIndex::restore_snapshot - randomized edits") {
+  auto t = time(nullptr);
+  for (unsigned i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    std::unique_ptr<MarkerIndex> marker_index(new MarkerIndex(seed));
+    std::set<MarkerId> exclusive_ids;
+    MarkerId next_id = 0;
+
+    struct RecordedSnapshot {
+      MarkerIndex::Snapshot snapshot;
+      std::unordered_map<MarkerId, NativeRange> ranges;
+      std::set<MarkerId> exclusive_ids;
+    };
+    vector<RecordedSnapshot> snapshots;
+
+    for (unsigned j = 0; j < 40; j++) {
+      switch (rand() % 6) {
+        case 0: {
+          NativeRange range = get_random_marker_range(rand);
+          marker_index->insert(next_id, range.start, range.end);
+          if (rand() % 3 == 0) {
+            marker_index->set_exclusive(next_id, true);
+            exclusive_ids.insert(next_id);
+          }
+          next_id++;
+          break;
+        }
+
+        case 1: {
+          NativeRange range = get_random_marker_range(rand);
+          marker_index->splice(range.start, range.extent(), NativePoint(rand() % 3, rand() % 10));
+          break;
+        }
+
+        case 2: {
+          MarkerId id = next_id > 0 ? rand() % next_id : 0;
+          if (marker_index->has(id)) marker_index->remove(id);
+          break;
+        }
+
+        case 3: {
+          vector<pair<MarkerId, NativeRange>> batch;
+          for (unsigned k = 0, n = rand() % 30; k < n; k++) {
+            batch.push_back({next_id++, get_random_marker_range(rand)});
+          }
+          marker_index->insert_batch(batch);
+          break;
+        }
+
+        case 4:
+          snapshots.push_back({marker_index->create_snapshot(), marker_index->dump(), exclusive_ids});
+          break;
+
+        case 5: {
+          if (snapshots.empty()) break;
+          const RecordedSnapshot &recorded = snapshots[rand() % snapshots.size()];
+
+          // A new index may restore a snapshot that outlived the old one.
+          if (rand() % 4 == 0) marker_index.reset(new MarkerIndex(seed));
+
+          marker_index->restore_snapshot(recorded.snapshot);
+          exclusive_ids = recorded.exclusive_ids;
+
+          MarkerIndex expected(seed);
+          for (const auto &entry : recorded.ranges) {
+            expected.insert(entry.first, entry.second.start, entry.second.end);
+          }
+          for (MarkerId id : exclusive_ids) expected.set_exclusive(id, true);
+          require_same_markers(*marker_index, expected, rand);
+
+          NativeRange range = get_random_marker_range(rand);
+          NativePoint new_extent(rand() % 3, rand() % 10);
+          auto result = marker_index->splice(range.start, range.extent(), new_extent);
+          auto expected_result = expected.splice(range.start, range.extent(), new_extent);
+          REQUIRE(ids(result.touch) == ids(expected_result.touch));
+          REQUIRE(ids(result.inside) == ids(expected_result.inside));
+          require_same_markers(*marker_index, expected, rand);
+          break;
+        }
+      }
+
+      // Later edits must leave every snapshot as it was taken.
+      for (const RecordedSnapshot &recorded : snapshots) {
+        REQUIRE(recorded.snapshot.size() == recorded.ranges.size());
+        REQUIRE(recorded.snapshot.dump() == recorded.ranges);
+      }
+    }
+  }
+}
@@ -3,8 +3,13 @@
 #include "native-text-buffer.h"
 #include "text-slice.h"
 #include "regex.h"
+#include <algorithm>
 #include <future>
 #include <thread>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 using std::move;
 using std::pair;
@@ -28,12 +33,102 @@ TEST_CASE("NativeTextBuffer::set_text_in_range - basic") {
   REQUIRE(buffer.text_in_range(NativeRange {{0, 1}, {10, 1}}) == u"z");
 }
 
+TEST_CASE("NativeTextBuffer::set_text_in_ranges - basic") {
+  NativeTextBuffer buffer{u"abc\ndef\nghi"};
+  REQUIRE(buffer.set_text_in_ranges({
+    {{{0, 0}, {0, 0}}, u">"},
+    {{{0, 1}, {1, 1}}, u"B\nD"},
+    {{{1, 3}, {1, 3}}, u"!"},
+    {{{2, 2}, {2, 3}}, u""},
+  }));
+  REQUIRE(buffer.text() == u">aB\nDef!\ngh");
+
+  REQUIRE(buffer.set_text_in_ranges({}));
+  REQUIRE(buffer.text() == u">aB\nDef!\ngh");
+
+  // Overlapping or unsorted ranges are rejected without changing anything.
+  REQUIRE(!buffer.set_text_in_ranges({
+    {{{0, 0}, {0, 2}}, u"x"},
+    {{{0, 1}, {0, 3}}, u"y"},
+  }));
+  REQUIRE(!buffer.set_text_in_ranges({
+    {{{1, 0}, {1, 1}}, u"x"},
+    {{{0, 0}, {0, 1}}, u"y"},
+  }));
+  REQUIRE(buffer.text() == u">aB\nDef!\ngh");
+}
+
+TEST_CASE("NativeTextBuffer::set_text_in_ranges - random edits") {
+  for (uint32_t seed = 0; seed < 100; seed++) {
+    Generator rand(seed);
+    Text original_text = get_random_text(rand);
+    NativeTextBuffer buffer{u16string(original_text.content)};
+    NativeTextBuffer expected_buffer{u16string(original_text.content)};
+
+    for (uint32_t i = 0; i < 5; i++) {
+      vector<NativePoint> points;
+      for (uint32_t j = 0, count = rand() % 10; j < count; j++) {
+        NativeRange range = get_random_range(rand, buffer);
+        points.push_back(range.start);
+        points.push_back(range.end);
+      }
+      std::sort(points.begin(), points.end());
+
+      vector<pair<NativeRange, u16string>> edits;
+      for (size_t j = 0; j + 1 < points.size(); j += 2) {
+        edits.push_back({{points[j], points[j + 1]}, get_random_string(rand, rand() % 5)});
+      }
+      for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+        expected_buffer.set_text_in_range(edit->first, u16string(edit->second));
+      }
+
+      auto snapshot = rand() % 2 ? buffer.create_snapshot() : nullptr;
+      buffer.set_text_in_ranges(move(edits));
+      REQUIRE(buffer.text() == expected_buffer.text());
+      REQUIRE(buffer.extent() == expected_buffer.extent());
+      REQUIRE(buffer.size() == expected_buffer.size());
+      delete snapshot;
+    }
+  }
+}
+
 TEST_CASE("NativeTextBuffer::line_length_for_row - basic") {
   NativeTextBuffer buffer{u"a\n\nb\r\rc\r\n\r\n"};
   REQUIRE(*buffer.line_length_for_row(0) == 1);
   REQUIRE(*buffer.line_length_for_row(1) == 0);
 }
 
+TEST_CASE("NativeTextBuffer::line_slice_for_row") {
+  NativeTextBuffer buffer{u"abc\r\ndef\nghi"};
+  TextSlice line = buffer.line_slice_for_row(0);
+  REQUIRE(u16string(line.begin(), line.end()) == u"abc");
+  REQUIRE(line.text == buffer.line_slice_for_row(0).text);
+
+  // Lines split across edits are assembled, and the results are reused
+  // until the buffer changes.
+  buffer.set_text_in_range({{1, 1}, {1, 2}}, u"E");
+  buffer.set_text_in_range({{1, 3}, {2, 1}}, u"-G");
+  line = buffer.line_slice_for_row(1);
+  REQUIRE(u16string(line.begin(), line.end()) == u"dEf-Ghi");
+  REQUIRE(line.data() == buffer.line_slice_for_row(1).data());
+  REQUIRE(*buffer.line_for_row(1) == u"dEf-Ghi");
+
+  buffer.set_text_in_range({{1, 0}, {1, 0}}, u">");
+  line = buffer.line_slice_for_row(1);
+  REQUIRE(u16string(line.begin(), line.end()) == u">dEf-Ghi");
+  buffer.with_line_for_row(0, [](const char16_t *data, uint32_t size) {
+    REQUIRE(u16string(data, size) == u"abc");
+  });
+
+  auto snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {1, 0}}, u"");
+  line = buffer.line_slice_for_row(0);
+  REQUIRE(u16string(line.begin(), line.end()) == u">dEf-Ghi");
+  delete snapshot;
+  line = buffer.line_slice_for_row(0);
+  REQUIRE(u16string(line.begin(), line.end()) == u">dEf-Ghi");
+}
+
 TEST_CASE("NativeTextBuffer::position_for_offset") {
   NativeTextBuffer buffer{u"ab\ndef\r\nhijk"};
   buffer.set_text_in_range({{0, 2}, {0, 2}}, u"c");
@@ -299,6 +394,143 @@ TEST_CASE("Snapshot::flush_preceding_changes") {
   }
 }
 
+TEST_CASE("NativeTextBuffer::Snapshot - reading and deleting on other threads") {
+  Generator rand(7);
+  NativeTextBuffer buffer{get_random_string(rand, 2000)};
+  Regex regex(u"[a-m]+\\r?$", nullptr);
+
+  vector<std::thread> threads;
+  std::atomic<unsigned> mismatch_count{0};
+  for (unsigned i = 0; i < 50; i++) {
+    for (unsigned j = 0; j < 5; j++) {
+      buffer.set_text_in_range(get_random_range(rand, buffer), get_random_string(rand, 5));
+    }
+    if (rand() % 5 == 0) buffer.flush_changes();
+
+    auto snapshot = buffer.create_snapshot();
+    u16string expected_text = buffer.text();
+    vector<NativeRange> expected_matches = buffer.find_all(regex);
+    threads.push_back(std::thread([snapshot, expected_text, expected_matches, &regex, &mismatch_count]() {
+      for (unsigned k = 0; k < 5; k++) {
+        if (snapshot->text() != expected_text || snapshot->find_all(regex) != expected_matches) {
+          mismatch_count++;
+        }
+      }
+      delete snapshot;
+    }));
+  }
+
+  for (auto &thread : threads) thread.join();
+  REQUIRE(mismatch_count == 0);
+
+  // The layers that a snapshot deleted on another thread held are reclaimed
+  // by the next edit.
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"x");
+  auto snapshot = buffer.create_snapshot();
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"y");
+  size_t layer_count = buffer.layer_count();
+  std::thread([snapshot]() { delete snapshot; }).join();
+  REQUIRE(buffer.layer_count() == layer_count);
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"z");
+  REQUIRE(buffer.layer_count() < layer_count);
+  REQUIRE(buffer.text().substr(0, 3) == u"zyx");
+}
+
+TEST_CASE("NativeTextBuffer::layer_stats - flattening layers held by snapshots") {
+  Generator rand(11);
+  NativeTextBuffer buffer{get_random_string(rand, 2000)};
+
+  vector<NativeTextBuffer::Snapshot *> snapshots;
+  vector<u16string> snapshot_texts;
+  for (unsigned i = 0; i < 50; i++) {
+    buffer.set_text_in_range(get_random_range(rand, buffer), get_random_string(rand, 5));
+    snapshots.push_back(buffer.create_snapshot());
+    snapshot_texts.push_back(buffer.text());
+  }
+  buffer.set_text_in_range(get_random_range(rand, buffer), get_random_string(rand, 5));
+  u16string expected_text = buffer.text();
+
+  Patch inverted_changes = buffer.get_inverted_changes(snapshots[20]);
+
+  auto stats = buffer.layer_stats();
+  REQUIRE(stats.layer_count == 52);
+  REQUIRE(stats.search_depth == 51);
+  REQUIRE(stats.flatten_count == 0);
+
+  // A few reads aren't worth copying the text.
+  for (uint32_t row = 0; row < 5; row++) buffer.line_length_for_row(row);
+  REQUIRE(buffer.layer_stats().flatten_count == 0);
+
+  // Many reads are, and leave the layers held by the snapshots untouched.
+  for (unsigned i = 0; i < 200; i++) buffer.clip_position({rand() % 100, rand() % 100});
+  stats = buffer.layer_stats();
+  REQUIRE(stats.flatten_count == 1);
+  REQUIRE(stats.search_depth == 0);
+  REQUIRE(stats.layer_count >= 52);
+  REQUIRE(buffer.text() == expected_text);
+  for (unsigned i = 0; i < snapshots.size(); i++) {
+    REQUIRE(snapshots[i]->text() == snapshot_texts[i]);
+  }
+
+  REQUIRE(buffer.get_inverted_changes(snapshots[20]).get_changes() == inverted_changes.get_changes());
+
+  // Further edits are made above the flattened layer.
+  buffer.set_text_in_range({{0, 0}, {0, 0}}, u"abc");
+  REQUIRE(buffer.text() == u"abc" + expected_text);
+  REQUIRE(buffer.layer_stats().search_depth == 1);
+
+  for (auto snapshot : snapshots) delete snapshot;
+  buffer.flush_changes();
+  REQUIRE(buffer.layer_count() == 1);
+  REQUIRE(buffer.text() == u"abc" + expected_text);
+}
+
+TEST_CASE("NativeTextBuffer::layer_stats - random edits, snapshots and flattening") {
+  uint32_t min_flattening_cost = NativeTextBuffer::MIN_FLATTENING_COST;
+  NativeTextBuffer::MIN_FLATTENING_COST = 1;
+
+  auto t = time(nullptr);
+  for (unsigned i = 0; i < 50; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    NativeTextBuffer buffer{get_random_string(rand, 100)};
+    vector<pair<NativeTextBuffer::Snapshot *, u16string>> snapshots;
+
+    for (unsigned j = 0; j < 30; j++) {
+      buffer.set_text_in_range(get_random_range(rand, buffer), get_random_string(rand, 5));
+      Text expected_text{buffer.text()};
+      if (rand() % 2) snapshots.push_back({buffer.create_snapshot(), expected_text.content});
+
+      for (unsigned k = 0, n = rand() % 10; k < n; k++) {
+        NativeRange range = get_random_range(rand, buffer);
+        REQUIRE(buffer.text_in_range(range) == Text{TextSlice(expected_text).slice(range)}.content);
+        REQUIRE(buffer.line_length_for_row(range.end.row) == expected_text.line_length_for_row(range.end.row));
+      }
+
+      if (rand() % 5 == 0 && !snapshots.empty()) {
+        uint32_t index = rand() % snapshots.size();
+        if (rand() % 2) snapshots[index].first->flush_preceding_changes();
+        REQUIRE(snapshots[index].first->text() == snapshots[index].second);
+        delete snapshots[index].first;
+        snapshots.erase(snapshots.begin() + index);
+      } else if (rand() % 10 == 0) {
+        buffer.flush_changes();
+        REQUIRE(!buffer.is_modified());
+      }
+
+      REQUIRE(buffer.text() == expected_text.content);
+      for (auto &snapshot : snapshots) REQUIRE(snapshot.first->text() == snapshot.second);
+    }
+
+    for (auto &snapshot : snapshots) delete snapshot.first;
+    REQUIRE(buffer.layer_count() <= 2);
+  }
+
+  NativeTextBuffer::MIN_FLATTENING_COST = min_flattening_cost;
+}
+
 TEST_CASE("NativeTextBuffer::reset") {
   NativeTextBuffer buffer{u"abcdef"};
   auto snapshot1 = buffer.create_snapshot();
@@ -331,6 +563,218 @@ TEST_CASE("NativeTextBuffer::reset") {
   REQUIRE(buffer.text() == u"456");
 }
 
+TEST_CASE("NativeTextBuffer::load") {
+  const char *file_name = "native-text-buffer-load-test.txt";
+
+  // Write enough multi-byte characters that some of them straddle the blocks
+  // in which the file is decoded.
+  string file_content;
+  u16string expected_text;
+  for (uint32_t row = 0; file_content.size() < 3 * 1024 * 1024; row++) {
+    file_content += "abc \xce\xb3\xce\xb3\xce\xb3 " + std::to_string(row) + "\r\n";
+    expected_text += u"abc \u03b3\u03b3\u03b3 ";
+    for (char c : std::to_string(row)) expected_text += c;
+    expected_text += u"\r\n";
+  }
+  FILE *file = fopen(file_name, "wb");
+  fwrite(file_content.data(), 1, file_content.size(), file);
+  fclose(file);
+
+  NativeTextBuffer buffer{u"abc"};
+  vector<size_t> progress;
+  auto patch = buffer.load(file_name, "UTF-8", [&progress](size_t percent_done, const optional<Patch> &) {
+    progress.push_back(percent_done);
+  });
+  remove(file_name);
+
+  REQUIRE(patch);
+  REQUIRE(progress == vector<size_t>({100}));
+  REQUIRE(!buffer.is_modified());
+  REQUIRE(buffer.text() == expected_text);
+  REQUIRE(buffer.base_text() == Text{expected_text});
+  REQUIRE(buffer.base_text().line_offsets == Text{expected_text}.line_offsets);
+
+  SECTION("a file that does not exist") {
+    REQUIRE(!buffer.load("does-not-exist.txt", "UTF-8", nullptr));
+    REQUIRE(buffer.text() == expected_text);
+  }
+}
+
+TEST_CASE("NativeTextBuffer::load - detecting the encoding") {
+  const char *file_name = "native-text-buffer-load-auto-test.txt";
+  auto write_file = [file_name](const string &content) {
+    FILE *file = fopen(file_name, "wb");
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+  };
+
+  NativeTextBuffer buffer{u""};
+  string encoding_name;
+
+  // Legacy bytes that only appear past the sampled prefix are still seen.
+  string content(100 * 1024, 'a');
+  u16string expected_text(100 * 1024, 'a');
+  while (content.size() < 400 * 1024) {
+    content += "caf\xe9 \x93quoted\x94\n";
+    expected_text += u"caf\u00e9 \u201cquoted\u201d\n";
+  }
+  write_file(content);
+  REQUIRE(buffer.load(file_name, "auto", nullptr, &encoding_name));
+  REQUIRE(encoding_name == "WINDOWS-1252");
+  REQUIRE(buffer.text() == expected_text);
+
+  write_file(string("\xff\xfe" "a\0b\0", 6));
+  REQUIRE(buffer.load(file_name, "auto", nullptr, &encoding_name));
+  REQUIRE(encoding_name == "UTF-16LE");
+  REQUIRE(buffer.text() == u"\ufeffab");
+
+  write_file("abc \xce\xb3\n");
+  auto operation = buffer.load_async(file_name, "auto", nullptr);
+  REQUIRE(operation->finish());
+  REQUIRE(operation->encoding_name() == "UTF-8");
+  REQUIRE(buffer.text() == u"abc \u03b3\n");
+  delete operation;
+
+  remove(file_name);
+}
+
+TEST_CASE("NativeTextBuffer::load_async") {
+  const char *file_name = "native-text-buffer-load-async-test.txt";
+  string file_content;
+  for (uint32_t row = 0; row < 100000; row++) {
+    file_content += "line " + std::to_string(row) + "\n";
+  }
+  FILE *file = fopen(file_name, "wb");
+  fwrite(file_content.data(), 1, file_content.size(), file);
+  fclose(file);
+
+  NativeTextBuffer buffer{u"line 0\n"};
+
+  SECTION("finishing the operation") {
+    std::atomic<bool> called_with_patch{false};
+    auto operation = buffer.load_async(file_name, "UTF-8", [&](size_t percent_done, const optional<Patch> &patch) {
+      if (patch) {
+        REQUIRE(percent_done == 100);
+        called_with_patch = true;
+      }
+    });
+    auto patch = operation->finish();
+    delete operation;
+    remove(file_name);
+
+    REQUIRE(called_with_patch);
+    REQUIRE(patch);
+    REQUIRE(patch->get_change_count() == 1);
+    REQUIRE(buffer.extent() == NativePoint(100000, 0));
+    REQUIRE(!buffer.is_modified());
+    REQUIRE(buffer.layer_count() == 1);
+  }
+
+  SECTION("editing the buffer while loading") {
+    auto operation = buffer.load_async(file_name, "UTF-8", nullptr);
+    buffer.set_text_in_range({{0, 0}, {0, 0}}, u"x");
+    auto patch = operation->finish();
+    delete operation;
+    remove(file_name);
+
+    REQUIRE(!patch);
+    REQUIRE(buffer.text() == u"xline 0\n");
+  }
+
+  SECTION("cancelling the operation") {
+    auto operation = buffer.load_async(file_name, "UTF-8", nullptr);
+    operation->cancel();
+    auto patch = operation->finish();
+    delete operation;
+    remove(file_name);
+
+    REQUIRE(!patch);
+    REQUIRE(buffer.text() == u"line 0\n");
+    REQUIRE(buffer.layer_count() == 1);
+  }
+}
+
+#ifndef WIN32
+TEST_CASE("NativeTextBuffer::load_async - a file that is truncated while loading") {
+  const char *file_name = "native-text-buffer-load-truncated-test.txt";
+  string file_content(4 * 1024 * 1024, 'a');
+  FILE *file = fopen(file_name, "wb");
+  fwrite(file_content.data(), 1, file_content.size(), file);
+  fclose(file);
+
+  NativeTextBuffer buffer{u""};
+  // The callback runs on the worker thread, so it only records its result.
+  std::atomic<bool> truncated{false};
+  std::atomic<int> truncate_result{-1};
+  auto operation = buffer.load_async(file_name, "UTF-8", [&](size_t, const optional<Patch> &) {
+    if (!truncated.exchange(true)) truncate_result = truncate(file_name, 1000);
+  });
+  REQUIRE(operation->finish());
+  delete operation;
+  remove(file_name);
+
+  REQUIRE(truncated);
+  REQUIRE(truncate_result == 0);
+  REQUIRE(buffer.text() == u16string(1000, 'a'));
+}
+#endif
+
+TEST_CASE("NativeTextBuffer::save") {
+  const char *file_name = "native-text-buffer-save-test.txt";
+  FILE *file = fopen(file_name, "wb");
+  fputs("original content that is longer than the new content\n", file);
+  fclose(file);
+
+  NativeTextBuffer buffer{u"abc\ndef\n"};
+  buffer.set_text_in_range({{1, 0}, {1, 0}}, u"\u00e9");
+
+  auto read_file = [](const char *name) {
+    string result;
+    FILE *file = fopen(name, "rb");
+    char chunk[256];
+    size_t length;
+    while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) result.append(chunk, length);
+    fclose(file);
+    return result;
+  };
+
+  SECTION("replacing an existing file") {
+#ifndef WIN32
+    chmod(file_name, 0640);
+#endif
+    buffer.save(file_name, "UTF-8");
+    REQUIRE(read_file(file_name) == "abc\n\xc3\xa9" "def\n");
+    REQUIRE(!buffer.is_modified());
+#ifndef WIN32
+    struct stat file_stats;
+    stat(file_name, &file_stats);
+    REQUIRE((file_stats.st_mode & 0777) == 0640);
+#endif
+  }
+
+#ifndef WIN32
+  SECTION("saving through a symlink") {
+    const char *link_name = "native-text-buffer-save-test-link.txt";
+    symlink(file_name, link_name);
+    buffer.save(link_name, "UTF-8");
+
+    struct stat link_stats;
+    lstat(link_name, &link_stats);
+    REQUIRE(S_ISLNK(link_stats.st_mode));
+    REQUIRE(read_file(file_name) == "abc\n\xc3\xa9" "def\n");
+    remove(link_name);
+  }
+#endif
+
+  SECTION("creating a new file") {
+    remove(file_name);
+    buffer.save(file_name, "UTF-8");
+    REQUIRE(read_file(file_name) == "abc\n\xc3\xa9" "def\n");
+  }
+
+  remove(file_name);
+}
+
 TEST_CASE("NativeTextBuffer::find") {
   NativeTextBuffer buffer{u"abcd\nef"};
 
@@ -427,6 +871,67 @@ TEST_CASE("NativeTextBuffer::find_all - empty matches") {
   }));
 }
 
+TEST_CASE("NativeTextBuffer::scan") {
+  NativeTextBuffer buffer{u"abc\ndef\nabc"};
+  buffer.set_text_in_range({{1, 0}, {1, 0}}, u"abc ");
+
+  vector<NativeRange> matches;
+  buffer.scan(Regex(u"abc", nullptr), NativeRange::all_inclusive(), [&matches](NativeRange match) {
+    matches.push_back(match);
+    return matches.size() == 2;
+  });
+  REQUIRE(matches == vector<NativeRange>({
+    NativeRange{NativePoint{0, 0}, NativePoint{0, 3}},
+    NativeRange{NativePoint{1, 0}, NativePoint{1, 3}},
+  }));
+}
+
+TEST_CASE("NativeTextBuffer::find_and_mark_all") {
+  NativeTextBuffer buffer{u"abc\ndef\nabc"};
+  buffer.set_text_in_range({{1, 0}, {1, 0}}, u"abc ");
+
+  MarkerIndex index;
+  index.insert(0, {1, 4}, {1, 7});
+  REQUIRE(buffer.find_and_mark_all(index, 1, true, Regex(u"abc", nullptr)) == 3);
+  REQUIRE(index.get_range(0) == (NativeRange{{1, 4}, {1, 7}}));
+  REQUIRE(index.get_range(1) == (NativeRange{{0, 0}, {0, 3}}));
+  REQUIRE(index.get_range(2) == (NativeRange{{1, 0}, {1, 3}}));
+  REQUIRE(index.get_range(3) == (NativeRange{{2, 0}, {2, 3}}));
+
+  // Exclusive markers don't grow to include text inserted at their start.
+  index.splice({1, 0}, {0, 0}, {0, 1});
+  REQUIRE(index.get_range(2) == (NativeRange{{1, 1}, {1, 4}}));
+}
+
+TEST_CASE("Snapshot::find_all_in_parallel") {
+  Generator rand(42);
+  u16string text;
+  while (text.size() < 1024 * 1024) {
+    switch (rand() % 4) {
+      case 0: text.append(u"abc def\n"); break;
+      case 1: text.append(u"\n\n"); break;
+      case 2: text.append(u"aaaa"); break;
+      case 3: text.append(u"b\r\n"); break;
+    }
+  }
+
+  NativeTextBuffer buffer{move(text)};
+  buffer.set_text_in_range({{100, 0}, {100, 2}}, u"xyz\nb");
+  buffer.set_text_in_range({{20000, 0}, {20001, 0}}, u"aaaa\n\naaaa");
+  auto snapshot = buffer.create_snapshot();
+
+  const char16_t *patterns[] = {u"\\w+", u"^a*", u"(a|\\n)+", u"b\\r?\\n\\n", u"[^b]{3,9}", u"$", u"\\b"};
+  for (auto pattern : patterns) {
+    Regex regex(pattern, nullptr);
+    auto expected = snapshot->find_all(regex);
+    REQUIRE(snapshot->find_all_in_parallel(regex, NativeRange::all_inclusive(), 4) == expected);
+    REQUIRE(snapshot->find_all_in_parallel(regex, {{50, 3}, {60000, 1}}, 3) ==
+            snapshot->find_all(regex, {{50, 3}, {60000, 1}}));
+  }
+
+  delete snapshot;
+}
+
 TEST_CASE("NativeTextBuffer::find_words_with_subsequence_in_range") {
   {
     NativeTextBuffer buffer{u"banana band bandana banana"};
@@ -465,6 +970,60 @@ TEST_CASE("NativeTextBuffer::find_words_with_subsequence_in_range") {
   }
 }
 
+TEST_CASE("NativeTextBuffer::find_words_with_subsequence_in_range - random edits") {
+  const char16_t *fragments[] = {
+    u"banana", u"band", u"bandana", u"Bar", u"barBaz", u"a_b", u"_", u" ", u" ", u"\n", u"\r\n", u"\r", u".", u"9"
+  };
+  auto get_random_words = [&](Generator &rand, unsigned count) {
+    u16string result;
+    for (unsigned i = 0; i < count; i++) result += fragments[rand() % 14];
+    return result;
+  };
+
+  for (uint32_t seed = 0; seed < 100; seed++) {
+    Generator rand(seed);
+    NativeTextBuffer buffer{get_random_words(rand, 200)};
+    const char16_t *queries[] = {u"b", u"ba", u"BNA", u"an", u"a_", u"z"};
+    const char16_t *extra_word_characters[] = {u"", u"_", u"_\n"};
+
+    for (uint32_t i = 0; i < 10; i++) {
+      NativeRange range = get_random_range(rand, buffer);
+      buffer.set_text_in_range(range, get_random_words(rand, rand() % 10));
+
+      auto snapshot = buffer.create_snapshot();
+      for (uint32_t j = 0; j < 3; j++) {
+        u16string query = queries[rand() % 6];
+        u16string word_characters = extra_word_characters[rand() % 3];
+        NativeRange query_range = rand() % 2 ? NativeRange::all_inclusive() : get_random_range(rand, buffer);
+        size_t max_count = rand() % 3;
+        auto expected = snapshot->find_words_with_subsequence_in_range(query, word_characters, query_range);
+        if (max_count > 0 && expected.size() > max_count) expected.resize(max_count);
+        REQUIRE(buffer.find_words_with_subsequence_in_range(query, word_characters, query_range, max_count) == expected);
+      }
+      delete snapshot;
+    }
+  }
+}
+
+TEST_CASE("NativeTextBuffer::find_words_with_subsequence_in_range - many words") {
+  Generator rand(42);
+  u16string text;
+  while (text.size() < 1024 * 1024) {
+    for (unsigned i = 0, length = 1 + rand() % 8; i < length; i++) text += 'a' + rand() % 26;
+    text += rand() % 8 ? ' ' : '\n';
+  }
+
+  NativeTextBuffer buffer{move(text)};
+  auto snapshot = buffer.create_snapshot();
+  auto expected = snapshot->find_words_with_subsequence_in_range(u"e", u"", NativeRange::all_inclusive(), 0, 1);
+  REQUIRE(expected.size() > 4096);
+  REQUIRE(snapshot->find_words_with_subsequence_in_range(u"e", u"", NativeRange::all_inclusive(), 0, 4) == expected);
+  REQUIRE(buffer.find_words_with_subsequence_in_range(u"e", u"", NativeRange::all_inclusive(), 0, 4) == expected);
+  expected.resize(10);
+  REQUIRE(buffer.find_words_with_subsequence_in_range(u"e", u"", NativeRange::all_inclusive(), 10, 4) == expected);
+  delete snapshot;
+}
+
 TEST_CASE("NativeTextBuffer::has_astral") {
   REQUIRE(NativeTextBuffer{u"ab" u"\xd83d" u"\xde01" u"cd"}.has_astral());
   REQUIRE(!NativeTextBuffer{u"abcd"}.has_astral());
@@ -569,6 +1128,12 @@ TEST_CASE("NativeTextBuffer - random edits and queries") {
         );
       }
 
+      for (uint32_t row = 0; row <= mutated_text.extent().row; row++) {
+        NativePoint line_end(row, mutated_text.line_length_for_row(row));
+        TextSlice line = buffer.line_slice_for_row(row);
+        REQUIRE(u16string(line.begin(), line.end()) == Text{TextSlice(mutated_text).slice({{row, 0}, line_end})}.content);
+      }
+
       for (uint32_t k = 0; k < 5; k++) {
         NativeRange range = get_random_range(rand, buffer);
         Text subtext{TextSlice(mutated_text).slice(range)};
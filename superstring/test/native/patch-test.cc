@@ -1,4 +1,5 @@
 #include "test-helpers.h"
+#include "text-slice.h"
 
 using Change = Patch::Change;
 using std::vector;
@@ -327,3 +328,117 @@ TEST_CASE("Patch::serialize") {
     }
   }));
 }
+
+TEST_CASE("Patch::serialize - versions") {
+  SECTION("reading the unframed version 1 format") {
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    serializer.append<uint32_t>(1);
+    serializer.append<uint32_t>(1);
+    NativePoint{0, 3}.serialize(serializer);
+    NativePoint{0, 5}.serialize(serializer);
+    NativePoint{1, 2}.serialize(serializer);
+    NativePoint{1, 2}.serialize(serializer);
+    serializer.append<uint32_t>(0);
+    serializer.append<uint32_t>(3);
+    serializer.append<uint32_t>(1);
+    Text{u"hello"}.serialize(serializer);
+    serializer.append<uint32_t>(42);
+
+    Deserializer deserializer(bytes);
+    Patch patch(deserializer);
+    REQUIRE(patch.get_changes() == vector<Change>({
+      Change{
+        NativePoint{1, 2}, NativePoint{1, 5},
+        NativePoint{1, 2}, NativePoint{1, 7},
+        nullptr, get_text(u"hello").get(),
+        0, 0, 3
+      }
+    }));
+    REQUIRE(deserializer.read<uint32_t>() == 42);
+  }
+
+  SECTION("skipping an unknown version") {
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    serializer.append<uint32_t>(99);
+    size_t block = serializer.begin_block();
+    serializer.append<uint32_t>(7);
+    serializer.end_block(block);
+    serializer.append<uint32_t>(42);
+
+    Deserializer deserializer(bytes);
+    Patch patch(deserializer);
+    REQUIRE(patch.get_change_count() == 0);
+    REQUIRE(deserializer.read<uint32_t>() == 42);
+  }
+
+  SECTION("reading a truncated patch") {
+    Patch patch;
+    patch.splice(NativePoint{0, 5}, NativePoint{0, 3}, NativePoint{0, 4}, Text{u"abc"}, Text{u"defg"});
+    patch.splice(NativePoint{0, 10}, NativePoint{0, 3}, NativePoint{0, 4}, Text{u"hij"}, Text{u"klmn"});
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    patch.serialize(serializer);
+
+    for (size_t size = 0; size < bytes.size(); size++) {
+      Deserializer deserializer(bytes.data(), size);
+      Patch truncated_patch(deserializer);
+      REQUIRE(deserializer.remaining() == 0);
+    }
+  }
+}
+
+TEST_CASE("Patch::compose - randomized changes") {
+  auto t = time(nullptr);
+  for (unsigned int i = 0; i < 200; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    bool with_old_text = rand() % 2;
+    Text original_text{get_random_string(rand, 100)};
+    Text text = original_text;
+    vector<const Patch *> patches;
+    for (unsigned int j = 0, n = 1 + rand() % 10; j < n; j++) {
+      Patch *patch = new Patch();
+      for (unsigned int k = 0, m = 1 + rand() % 5; k < m; k++) {
+        NativeRange deleted_range = get_random_range(rand, text);
+        Text deleted_text{TextSlice(text).slice(deleted_range)};
+        Text inserted_text{get_random_string(rand, rand() % 4)};
+        patch->splice(
+          deleted_range.start,
+          deleted_range.extent(),
+          inserted_text.extent(),
+          with_old_text ? optional<Text>{deleted_text} : optional<Text>{},
+          Text{inserted_text},
+          deleted_text.size()
+        );
+        text.splice(deleted_range.start, deleted_range.extent(), inserted_text);
+      }
+      patches.push_back(patch);
+    }
+
+    Patch composition = Patch::compose(patches);
+    auto changes = composition.get_changes();
+    REQUIRE(composition.get_change_count() == changes.size());
+
+    Text composed_text = original_text;
+    for (auto iter = changes.rbegin(); iter != changes.rend(); ++iter) {
+      Text old_text{TextSlice(original_text).slice({iter->old_start, iter->old_end})};
+      REQUIRE(iter->old_text_size == old_text.size());
+      if (with_old_text) {
+        REQUIRE(*iter->old_text == old_text);
+      } else {
+        REQUIRE(!iter->old_text);
+      }
+      composed_text.splice(iter->old_start, iter->old_end.traversal(iter->old_start), *iter->new_text);
+    }
+    REQUIRE(composed_text == text);
+
+    composition.rebalance();
+    REQUIRE(composition.get_changes() == changes);
+
+    for (const Patch *patch : patches) delete patch;
+  }
+}
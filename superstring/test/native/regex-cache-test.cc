@@ -0,0 +1,55 @@
+#include "test-helpers.h"
+#include "regex-cache.h"
+#include <atomic>
+#include <thread>
+
+using std::u16string;
+using std::vector;
+
+TEST_CASE("RegexCache::get - reuses compiled regexes") {
+  RegexCache cache(2);
+  auto regex1 = cache.get(u"\\w+");
+  REQUIRE(cache.get(u"\\w+") == regex1);
+  REQUIRE(cache.get(u"\\w+", true) != regex1);
+  REQUIRE(cache.get(u"\\w+", true)->match(u"ABC"));
+  REQUIRE(cache.stats().hits == 2);
+  REQUIRE(cache.stats().misses == 2);
+  REQUIRE(cache.size() == 2);
+
+  // The least recently used entry is evicted, but stays usable by its holders.
+  cache.get(u"\\w+");
+  cache.get(u"\\d+");
+  REQUIRE(cache.size() == 2);
+  REQUIRE(cache.stats().evictions == 1);
+  REQUIRE(cache.get(u"\\w+") == regex1);
+  REQUIRE(cache.get(u"\\w+", true) != regex1);
+  REQUIRE(cache.stats().misses == 4);
+}
+
+TEST_CASE("RegexCache::get - invalid patterns") {
+  RegexCache cache;
+  u16string error_message;
+  auto regex = cache.get(u"(", false, false, &error_message);
+  REQUIRE(!*regex);
+  REQUIRE(!error_message.empty());
+  REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("RegexCache::get - concurrent use") {
+  RegexCache cache(4);
+  std::atomic<unsigned> mismatch_count{0};
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&cache, &mismatch_count, i]() {
+      for (unsigned j = 0; j < 200; j++) {
+        u16string digit(1, u'0' + (i + j) % 6);
+        auto regex = cache.get(u"a" + digit);
+        if (regex->match(u"xa" + digit).start_offset != 1) mismatch_count++;
+      }
+    }));
+  }
+  for (auto &thread : threads) thread.join();
+  REQUIRE(mismatch_count == 0u);
+  auto stats = cache.stats();
+  REQUIRE(stats.hits + stats.misses == 800);
+}
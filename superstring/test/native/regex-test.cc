@@ -0,0 +1,63 @@
+#include "test-helpers.h"
+#include "regex.h"
+
+using std::u16string;
+using MatchResult = Regex::MatchResult;
+
+TEST_CASE("Regex - literal prefixes") {
+  REQUIRE(Regex(u"abc", nullptr).is_literal_pattern());
+  REQUIRE(Regex(u"abc", nullptr).get_literal_prefix() == u"abc");
+  REQUIRE(Regex(u"a\\.b\\(c\\)", nullptr).get_literal_prefix() == u"a.b(c)");
+  REQUIRE(Regex(u"a\\.b\\(c\\)", nullptr).is_literal_pattern());
+  REQUIRE(Regex(u"ab+c", nullptr).get_literal_prefix() == u"a");
+  REQUIRE(!Regex(u"ab+c", nullptr).is_literal_pattern());
+  REQUIRE(Regex(u"ab\\d", nullptr).get_literal_prefix() == u"ab");
+  REQUIRE(Regex(u"ab|c", nullptr).get_literal_prefix() == u"");
+  REQUIRE(Regex(u"^ab", nullptr).get_literal_prefix() == u"");
+  REQUIRE(Regex(u"abc", nullptr, true).get_literal_prefix() == u"");
+  REQUIRE(Regex(u"", nullptr).get_literal_prefix() == u"");
+
+  // Invalid patterns match nothing, even without an error message to report.
+  Regex invalid_regex(u"abc(", nullptr);
+  REQUIRE(!invalid_regex);
+  REQUIRE(invalid_regex.get_literal_prefix() == u"");
+  REQUIRE(!invalid_regex.is_literal_pattern());
+}
+
+TEST_CASE("Regex::match - literal patterns behave like PCRE2") {
+  // Wrapping a pattern in a group keeps it from being treated as a literal.
+  const char16_t *patterns[][2] = {
+    {u"aab", u"(?:aab)"},
+    {u"a", u"(?:a)"},
+    {u"ba\\.", u"(?:ba\\.)"},
+    {u"ab[ab]+", u"(?:ab)[ab]+"},
+    {u"ba\\b", u"(?:ba)\\b"},
+  };
+
+  Generator rand(0);
+  for (auto &pair : patterns) {
+    Regex regex(pair[0], nullptr);
+    Regex pcre_regex(pair[1], nullptr);
+    REQUIRE(!regex.get_literal_prefix().empty());
+    REQUIRE(pcre_regex.get_literal_prefix().empty());
+
+    Regex::MatchData match_data(regex);
+    Regex::MatchData pcre_match_data(pcre_regex);
+    for (unsigned i = 0; i < 2000; i++) {
+      u16string subject;
+      for (uint32_t j = rand() % 30; j > 0; j--) subject += u"ab. "[rand() % 4];
+      for (unsigned options = 0; options < 8; options++) {
+        MatchResult result = regex.match(subject, match_data, options);
+        MatchResult expected = pcre_regex.match(subject, pcre_match_data, options);
+        INFO("pattern: " << u16string(pair[0]) << ", subject: " << subject << ", options: " << options);
+        REQUIRE(result.type == expected.type);
+        if (result.type != MatchResult::None) {
+          REQUIRE(result.start_offset == expected.start_offset);
+          REQUIRE(result.end_offset == expected.end_offset);
+          REQUIRE(match_data[0].start_offset == result.start_offset);
+          REQUIRE(match_data[0].end_offset == result.end_offset);
+        }
+      }
+    }
+  }
+}
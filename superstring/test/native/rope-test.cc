@@ -0,0 +1,98 @@
+#include "test-helpers.h"
+#include "rope.h"
+#include "text-slice.h"
+
+using std::u16string;
+
+TEST_CASE("Rope - randomized splices") {
+  auto t = time(nullptr);
+  for (unsigned int i = 0; i < 30; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    Text text{get_random_string(rand, 500)};
+    Rope rope{Text{text}};
+
+    for (unsigned int j = 0; j < 20; j++) {
+      NativeRange deleted_range = get_random_range(rand, text);
+      uint32_t inserted_size = rand() % 3 == 0 ? rand() % 600 : rand() % 4;
+      Text inserted_text{get_random_string(rand, inserted_size)};
+
+      Rope rope_before_splice = rope;
+      u16string text_before_splice = text.content;
+      text.splice(deleted_range.start, deleted_range.extent(), inserted_text);
+      rope.splice(deleted_range.start, deleted_range.extent(), inserted_text);
+      REQUIRE(rope_before_splice.text() == text_before_splice);
+
+      REQUIRE(rope.text() == text.content);
+      REQUIRE(rope.size() == text.size());
+      REQUIRE(rope.extent() == text.extent());
+
+      for (uint32_t k = 0; k < 50; k++) {
+        uint32_t offset = rand() % (text.size() + 2);
+        REQUIRE(rope.at(offset) == (offset < text.size() ? text.at(offset) : 0));
+        REQUIRE(rope.position_for_offset(offset) == text.position_for_offset(offset));
+        REQUIRE(rope.position_for_offset(offset, false) == text.position_for_offset(offset, 0, false));
+      }
+
+      for (uint32_t k = 0; k < 20; k++) {
+        uint32_t row = rand() % (text.extent().row + 2);
+        for (uint32_t column : {0u, 1u, rand() % 10, UINT32_MAX}) {
+          NativePoint position{row, column};
+          ClipResult expected = text.clip_position(position);
+          ClipResult actual = rope.clip_position(position);
+          REQUIRE(actual.position == expected.position);
+          REQUIRE(actual.offset == expected.offset);
+        }
+      }
+
+      NativeRange range = get_random_range(rand, text);
+      u16string expected_text{Text{TextSlice(text).slice(range)}.content};
+      REQUIRE(rope.text_in_range(range) == expected_text);
+
+      u16string chunks_text;
+      rope.for_each_chunk_in_range(range.start, range.end, [&chunks_text](TextSlice chunk) {
+        REQUIRE(!chunk.empty());
+        chunks_text.append(chunk.data(), chunk.size());
+        return false;
+      });
+      REQUIRE(chunks_text == expected_text);
+
+      chunks_text.clear();
+      rope.for_each_chunk_in_range(range.start, NativePoint::max(), [&chunks_text](TextSlice chunk) {
+        chunks_text.append(chunk.data(), chunk.size());
+        return false;
+      });
+      REQUIRE(chunks_text == Text{TextSlice(text).suffix(range.start)}.content);
+    }
+  }
+}
+
+TEST_CASE("Rope - typing a character at a time") {
+  Rope rope{Text{u"abc\ndef"}};
+  for (uint32_t i = 0; i < 1000; i++) {
+    rope.splice({0, 3}, {0, 0}, Text{u"x"});
+  }
+  REQUIRE(rope.size() == 1007);
+  REQUIRE(rope.at(NativePoint(0, 3)) == 'x');
+  REQUIRE(rope.at(NativePoint(1, 0)) == 'd');
+  REQUIRE(rope.piece_count() < 10);
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    rope.splice({0, 3}, {0, 1}, Text{});
+  }
+  REQUIRE(rope.text() == u"abc\ndef");
+  REQUIRE(rope.piece_count() == 1);
+}
+
+TEST_CASE("Rope - empty text") {
+  Rope rope;
+  REQUIRE(rope.size() == 0);
+  REQUIRE(rope.extent() == NativePoint());
+  REQUIRE(rope.at(0u) == 0);
+  REQUIRE(rope.position_for_offset(5) == NativePoint());
+  REQUIRE(rope.clip_position({2, 3}).position == NativePoint());
+  REQUIRE(rope.text() == u"");
+  REQUIRE(rope.piece_count() == 0);
+}
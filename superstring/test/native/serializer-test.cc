@@ -0,0 +1,68 @@
+#include "test-helpers.h"
+#include "serializer.h"
+
+using std::vector;
+
+TEST_CASE("Serializer::append - little-endian values") {
+  vector<uint8_t> bytes;
+  Serializer serializer(bytes);
+  serializer.append<uint32_t>(0x04030201);
+  serializer.append<uint16_t>(0x0605);
+  serializer.append<uint8_t>(0x07);
+  const uint16_t values[] = {0x0908, 0x0b0a};
+  serializer.append_array(values, 2);
+  REQUIRE(bytes == vector<uint8_t>({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}));
+
+  Deserializer deserializer(bytes.data(), bytes.size());
+  REQUIRE(deserializer.read<uint32_t>() == 0x04030201);
+  REQUIRE(deserializer.read<uint16_t>() == 0x0605);
+  REQUIRE(deserializer.read<uint8_t>() == 0x07);
+  REQUIRE(deserializer.remaining() == 4);
+  const uint8_t *rest = deserializer.read_bytes(4);
+  REQUIRE(rest == bytes.data() + 7);
+  REQUIRE(deserializer.remaining() == 0);
+}
+
+TEST_CASE("Serializer::begin_block - length-prefixed blocks") {
+  vector<uint8_t> bytes;
+  Serializer serializer(bytes);
+  size_t outer = serializer.begin_block();
+  serializer.append<uint32_t>(1);
+  size_t inner = serializer.begin_block();
+  serializer.append<uint32_t>(2);
+  serializer.append<uint32_t>(3);
+  serializer.end_block(inner);
+  serializer.end_block(outer);
+  serializer.append<uint32_t>(4);
+
+  SECTION("reading a block's contents") {
+    Deserializer deserializer(bytes);
+    Deserializer outer_block = deserializer.read_block();
+    REQUIRE(outer_block.read<uint32_t>() == 1);
+    Deserializer inner_block = outer_block.read_block();
+    REQUIRE(inner_block.remaining() == 8);
+    REQUIRE(inner_block.read<uint32_t>() == 2);
+    REQUIRE(inner_block.read<uint32_t>() == 3);
+    REQUIRE(outer_block.remaining() == 0);
+    REQUIRE(deserializer.read<uint32_t>() == 4);
+  }
+
+  SECTION("skipping a block") {
+    Deserializer deserializer(bytes);
+    deserializer.read_block();
+    REQUIRE(deserializer.read<uint32_t>() == 4);
+  }
+
+  SECTION("truncated input") {
+    Deserializer deserializer(bytes.data(), 10);
+    Deserializer outer_block = deserializer.read_block();
+    REQUIRE(outer_block.remaining() == 6);
+    REQUIRE(outer_block.read<uint32_t>() == 1);
+    Deserializer inner_block = outer_block.read_block();
+    REQUIRE(inner_block.remaining() == 0);
+    REQUIRE(inner_block.read<uint32_t>() == 0);
+    REQUIRE(inner_block.read_bytes(1) == nullptr);
+    REQUIRE(deserializer.remaining() == 0);
+    REQUIRE(deserializer.read<uint32_t>() == 0);
+  }
+}
@@ -146,3 +146,94 @@ TEST_CASE("text_diff - randomized changes") {
     REQUIRE(old_text == new_text);
   }
 }
+
+static void apply_diff(Text &old_text, const Patch &patch) {
+  for (const Change &change : patch.get_changes()) {
+    old_text.splice(
+      change.new_start,
+      change.old_end.traversal(change.old_start),
+      *change.new_text
+    );
+  }
+}
+
+TEST_CASE("text_diff - many scattered changes") {
+  std::u16string old_content, new_content;
+  for (unsigned i = 0; i < 20000; i++) {
+    std::string number = std::to_string(i);
+    std::u16string line = u"  value" + std::u16string(number.begin(), number.end()) + u" = 1";
+    old_content += line + u"\n";
+    new_content += (i % 2 ? line + u";" : line) + u"\n";
+  }
+  Text old_text{old_content};
+  Text new_text{new_content};
+
+  Patch patch = text_diff(old_text, new_text);
+
+  auto changes = patch.get_changes();
+  REQUIRE(changes.size() == 10000);
+  for (const Change &change : changes) {
+    REQUIRE(change.old_start == change.old_end);
+    REQUIRE(*change.new_text == Text{u";"});
+  }
+
+  apply_diff(old_text, patch);
+  REQUIRE(old_text == new_text);
+}
+
+TEST_CASE("text_diff - randomized line changes") {
+  auto t = time(nullptr);
+  for (unsigned int i = 0; i < 100; i++) {
+    uint32_t seed = t * 1000 + i;
+    Generator rand(seed);
+    cout << "seed: " << seed << "\n";
+
+    vector<std::u16string> lines;
+    for (unsigned int j = 0; j < 200; j++) {
+      lines.push_back(get_random_string(rand, rand() % 3 ? 1 + rand() % 10 : 1) + u"\n");
+    }
+
+    std::u16string old_content;
+    for (const auto &line : lines) old_content += line;
+
+    for (unsigned int j = 0, n = rand() % 20; j < n; j++) {
+      uint32_t row = rand() % lines.size();
+      switch (rand() % 4) {
+        case 0:
+          lines.erase(lines.begin() + row);
+          break;
+        case 1:
+          lines.insert(lines.begin() + row, get_random_string(rand, 5) + u"\n");
+          break;
+        case 2:
+          lines.insert(lines.begin() + row, lines[rand() % lines.size()]);
+          break;
+        case 3:
+          lines[row] = get_random_string(rand, rand() % 10) + lines[row];
+          break;
+      }
+      if (lines.empty()) lines.push_back(u"\n");
+    }
+
+    std::u16string new_content;
+    for (const auto &line : lines) new_content += line;
+
+    Text old_text{old_content};
+    Text new_text{new_content};
+    Patch patch = text_diff(old_text, new_text);
+
+    for (const Change &change : patch.get_changes()) {
+      REQUIRE(
+        *change.new_text ==
+        Text(TextSlice(new_text).slice(NativeRange{change.new_start, change.new_end}))
+      );
+      REQUIRE(
+        *change.old_text ==
+        Text(TextSlice(old_text).slice(NativeRange{change.old_start, change.old_end}))
+      );
+    }
+
+    apply_diff(old_text, patch);
+    REQUIRE(old_text == new_text);
+  }
+}
@@ -2,6 +2,10 @@
 #include "text.h"
 #include "text-slice.h"
 
+using std::move;
+using std::u16string;
+using std::vector;
+
 TEST_CASE("Text::split") {
   Text text {u"abc\ndef\r\nghi"};
   TextSlice base_slice {text};
@@ -108,3 +112,87 @@ TEST_CASE("Text::offset_for_position - empty lines") {
   REQUIRE(text.offset_for_position({1, UINT32_MAX}) == 2);
   REQUIRE(slice.position_for_offset(2) == NativePoint(1, 0));
 }
+
+TEST_CASE("Text::is_compact") {
+  Text text {u"abc\ndef"};
+  REQUIRE(text.is_compact());
+
+  text.splice({0, 1}, {0, 1}, Text{u"ü"});
+  REQUIRE(text.is_compact());
+  REQUIRE(Text(TextSlice(text).prefix({0, 2})).is_compact());
+
+  text.splice({1, 0}, {0, 0}, Text{u"γ"});
+  REQUIRE(!text.is_compact());
+  REQUIRE(text == Text(u"aüc\nγdef"));
+  REQUIRE(Text(TextSlice(text).prefix({0, 2})).is_compact());
+
+  text.assign(TextSlice(text).prefix({0, 3}));
+  REQUIRE(text.is_compact());
+
+  text.clear();
+  REQUIRE(text.is_compact());
+}
+
+TEST_CASE("Text::serialize") {
+  for (auto content : {u"", u"abc\r\ndef\nÿ", u"abc\nγ\ndef"}) {
+    Text text {content};
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    text.serialize(serializer);
+    REQUIRE(bytes.size() == 4 + text.size() * 2);
+
+    Deserializer deserializer(bytes);
+    Text deserialized_text(deserializer);
+    REQUIRE(deserialized_text == text);
+    REQUIRE(deserialized_text.line_offsets == text.line_offsets);
+    REQUIRE(deserialized_text.is_compact() == text.is_compact());
+  }
+}
+
+TEST_CASE("Text::serialize - one byte per code unit") {
+  for (auto content : {u"", u"abc\r\ndef\nÿ", u"abc\nγ\ndef"}) {
+    Text text {content};
+    vector<uint8_t> bytes;
+    Serializer serializer(bytes);
+    text.serialize(serializer, true);
+    REQUIRE(bytes.size() == 4 + text.size() * (text.is_compact() ? 1 : 2));
+
+    Deserializer deserializer(bytes);
+    Text deserialized_text(deserializer, true);
+    REQUIRE(deserialized_text == text);
+    REQUIRE(deserialized_text.line_offsets == text.line_offsets);
+    REQUIRE(deserialized_text.is_compact() == text.is_compact());
+    REQUIRE(deserializer.remaining() == 0);
+  }
+}
+
+TEST_CASE("Text::serialize - truncated input") {
+  Text text {u"abc\nγ\ndef"};
+  vector<uint8_t> bytes;
+  Serializer serializer(bytes);
+  text.serialize(serializer);
+
+  Deserializer deserializer(bytes.data(), bytes.size() - 1);
+  Text deserialized_text(deserializer);
+  REQUIRE(deserialized_text == Text{});
+  REQUIRE(deserialized_text.line_offsets == vector<uint32_t>({0}));
+  REQUIRE(deserializer.remaining() == 0);
+}
+
+TEST_CASE("Text - line offsets of long content") {
+  u16string content;
+  vector<uint32_t> expected_line_offsets{0};
+  for (uint32_t i = 0; i < 1000; i++) {
+    content.append(i % 37, 'a');
+    content += (i % 3 == 0) ? u"\r\n" : u"\n";
+    expected_line_offsets.push_back(content.size());
+    if (i % 5 == 0) content += u"\r";
+  }
+
+  Text text {u16string(content)};
+  REQUIRE(text.line_offsets == expected_line_offsets);
+  REQUIRE(text.is_compact());
+
+  content[content.size() / 2] = 0x3b3;
+  REQUIRE(!Text{move(content)}.is_compact());
+}
@@ -99,7 +99,7 @@ unsigned DefaultHistoryProvider::createCheckpoint(const TextBuffer::MarkerSnapsh
 void DefaultHistoryProvider::groupChangesSinceCheckpoint(unsigned checkpointId, const TextBuffer::MarkerSnapshot &markerSnapshotAfter, bool deleteCheckpoint) {
   optional<double> checkpointIndex;
   TextBuffer::MarkerSnapshot markerSnapshotBefore;
-  std::vector<Patch *> patchesSinceCheckpoint;
+  std::vector<const Patch *> patchesSinceCheckpoint;
   for (double i = this->undoStack.size() - 1.0; i >= 0; i--) {
     const StackEntry &entry = this->undoStack[i];
     if (checkpointIndex) {
@@ -684,7 +684,7 @@ DisplayLayer::UpdateResult DisplayLayer::updateSpatialIndex(double startBufferRo
     if (screenRow >= endScreenRow && bufferColumn == 0) break;
     //if (deadline.timeRemaining() < 2) break;
     if (bufferRow > this->buffer->getLastRow()) break;
-    std::u16string bufferLine = this->buffer->lineForRow(bufferRow);
+    TextSlice bufferLine = this->buffer->lineSliceForRow(bufferRow);
     double bufferLineLength = bufferLine.size();
     currentScreenLineTabColumns.resize(0);
     double screenLineWidth = 0;
@@ -695,8 +695,8 @@ DisplayLayer::UpdateResult DisplayLayer::updateSpatialIndex(double startBufferRo
 
     while (bufferColumn <= bufferLineLength) {
       const optional<Point> foldEnd = folds.count(bufferRow) && folds[bufferRow].count(bufferColumn) ? folds[bufferRow][bufferColumn] : optional<Point>();
-      const optional<char16_t> previousCharacter = bufferColumn >= 1 ? bufferLine[bufferColumn - 1] : optional<char16_t>();
-      const optional<char16_t> character = foldEnd ? this->foldCharacter : bufferColumn <= bufferLineLength - 1 ? bufferLine[bufferColumn] : optional<char16_t>();
+      const optional<char16_t> previousCharacter = bufferColumn >= 1 ? optional<char16_t>(bufferLine.at(bufferColumn - 1)) : optional<char16_t>();
+      const optional<char16_t> character = foldEnd ? this->foldCharacter : bufferColumn <= bufferLineLength - 1 ? optional<char16_t>(bufferLine.at(bufferColumn)) : optional<char16_t>();
 
       // Are we in leading whitespace? If yes, record the *end* of the leading
       // whitespace if we've reached a non whitespace character. If no, record
@@ -800,7 +800,7 @@ DisplayLayer::UpdateResult DisplayLayer::updateSpatialIndex(double startBufferRo
         screenLineWidth += characterWidth;
         bufferRow = foldEnd->row;
         bufferColumn = foldEnd->column;
-        bufferLine = this->buffer->lineForRow(bufferRow);
+        bufferLine = this->buffer->lineSliceForRow(bufferRow);
         bufferLineLength = bufferLine.size();
       } else {
         // If there is no fold at this position, check if we need to handle
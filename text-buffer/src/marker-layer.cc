@@ -26,6 +26,8 @@ void MarkerLayer::clear() {
     delete marker.second;
   }
   this->markersById.clear();
+  this->markersWithChangeListeners.clear();
+  this->markerSnapshots.reset();
   delete this->index;
   this->index = new MarkerIndex();
 }
@@ -193,16 +195,33 @@ void MarkerLayer::splice(const Point &start, const Point &oldExtent, const Point
   // TODO: destroy invalidated markers
 }
 
-void MarkerLayer::restoreFromSnapshot(const Snapshot &snapshots, bool alwaysCreate) {
+void MarkerLayer::spliceBatch(const std::vector<MarkerIndex::Splice> &splices) {
+  this->index->splice_batch(splices);
+}
+
+void MarkerLayer::restoreFromSnapshot(const Snapshot &layerSnapshot, bool alwaysCreate) {
+  if (!layerSnapshot.markers) return;
+
+  // When no marker was added, destroyed or had its properties changed since
+  // the snapshot, only the ranges differ and the index can take them over.
+  if (layerSnapshot.markers == this->markerSnapshots) {
+    this->index->restore_snapshot(layerSnapshot.index);
+    this->emitChangeEvents();
+    return;
+  }
+
+  const MarkerSnapshots &snapshots = *layerSnapshot.markers;
+  auto ranges = layerSnapshot.index.dump();
   auto existingMarkerIds = keys(this->markersById);
-  for (const auto &snapshot : snapshots) {
+  for (auto &snapshot : snapshots) {
     const unsigned id = snapshot.first;
+    const Range range = ranges[id];
     /*if (alwaysCreate) {
       this.createMarker(snapshot.range, snapshot, true);
       continue;
     }*/
     if (Marker *marker = get(this->markersById, id)) {
-      marker->update(marker->getRange(), {snapshot.second.range, snapshot.second.reversed, snapshot.second.tailed}, true, true);
+      marker->update(marker->getRange(), {range, snapshot.second.reversed, snapshot.second.tailed}, true, true);
     } else {
       //Marker *marker = snapshot.marker;
       /* if (marker) {
@@ -214,7 +233,7 @@ void MarkerLayer::restoreFromSnapshot(const Snapshot &snapshots, bool alwaysCrea
           this.emitter.emit('did-create-marker', marker);
         }
       } else */ {
-        this->createMarker(snapshot.second.range, {snapshot.second.range, snapshot.second.reversed, snapshot.second.tailed}, true);
+        this->createMarker(range, {range, snapshot.second.reversed, snapshot.second.tailed}, true);
       }
     }
   }
@@ -227,19 +246,23 @@ void MarkerLayer::restoreFromSnapshot(const Snapshot &snapshots, bool alwaysCrea
 }
 
 MarkerLayer::Snapshot MarkerLayer::createSnapshot() {
-  Snapshot result;
-  auto ranges = this->index->dump();
-  for (auto &marker : this->markersById) {
-    const unsigned id = marker.first;
-    result[id] = marker.second->getSnapshot(ranges[id]);
+  if (!this->markerSnapshots) {
+    auto markers = std::make_shared<MarkerSnapshots>();
+    markers->reserve(this->markersById.size());
+    for (auto &marker : this->markersById) {
+      (*markers)[marker.first] = marker.second->getSnapshot(Range());
+    }
+    this->markerSnapshots = std::move(markers);
   }
-  return result;
+  return Snapshot{this->index->create_snapshot(), this->markerSnapshots};
 }
 
-void MarkerLayer::emitChangeEvents(Snapshot &snapshot) {
-  // TODO: markersWithChangeListeners
-  for (auto &marker : this->markersById) {
-    marker.second->emitChangeEvent(snapshot[marker.second->id].range, true, false);
+void MarkerLayer::emitChangeEvents() {
+  std::vector<Marker *> markers(this->markersWithChangeListeners.begin(), this->markersWithChangeListeners.end());
+  for (Marker *marker : markers) {
+    if (this->markersWithChangeListeners.count(marker)) { // event handlers could destroy markers
+      marker->emitChangeEvent(marker->getRange(), true, false);
+    }
   }
 }
 
@@ -255,7 +278,8 @@ void MarkerLayer::destroyMarker(Marker *marker, bool suppressMarkerLayerUpdateEv
   if (this->markersById.count(marker->id)) {
     this->markersById.erase(marker->id);
     this->index->remove(marker->id);
-    //this.markersWithChangeListeners.delete(marker);
+    this->markersWithChangeListeners.erase(marker);
+    this->markerSnapshots.reset();
     //this.markersWithDestroyListeners.delete(marker);
     for (DisplayMarkerLayer *displayMarkerLayer : this->displayMarkerLayers) {
       displayMarkerLayer->destroyMarker(marker->id);
@@ -320,6 +344,7 @@ Section: Internal
 
 Marker *MarkerLayer::addMarker(unsigned id, const Range &range, const Marker::Params &params) {
   this->index->insert(id, range.start, range.end);
+  this->markerSnapshots.reset();
   return this->markersById[id] = new Marker(id, this, range, params);
 }
 
@@ -6,6 +6,7 @@
 #include "event-kit.h"
 #include "helpers.h"
 #include <marker-index.h>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -15,7 +16,14 @@ struct TextBuffer;
 struct DisplayMarkerLayer;
 
 struct MarkerLayer {
-  using Snapshot = std::unordered_map<unsigned, Marker::Snapshot>;
+  using MarkerSnapshots = std::unordered_map<unsigned, Marker::Snapshot>;
+
+  // The ranges live in the index snapshot, which shares its nodes with the
+  // layer's index, so the ranges in `markers` are left unset.
+  struct Snapshot {
+    MarkerIndex::Snapshot index;
+    std::shared_ptr<const MarkerSnapshots> markers;
+  };
 
   TextBuffer *delegate;
   unsigned id;
@@ -25,6 +33,11 @@ struct MarkerLayer {
   MarkerIndex *index;
   std::unordered_map<unsigned, Marker *> markersById;
   std::unordered_set<DisplayMarkerLayer *> displayMarkerLayers;
+  std::unordered_set<Marker *> markersWithChangeListeners;
+
+  // Reused by snapshots until a marker is added, destroyed, or has its
+  // reversed or tailed state changed.
+  std::shared_ptr<const MarkerSnapshots> markerSnapshots;
 
   MarkerLayer(TextBuffer *, unsigned, bool = false);
   ~MarkerLayer();
@@ -40,9 +53,10 @@ struct MarkerLayer {
   void onDidUpdate(std::function<void()>);
   void onDidCreateMarker(std::function<void(Marker *)>);
   void splice(const Point &, const Point &, const Point &);
+  void spliceBatch(const std::vector<MarkerIndex::Splice> &);
   void restoreFromSnapshot(const Snapshot &, bool = false);
   Snapshot createSnapshot();
-  void emitChangeEvents(Snapshot &);
+  void emitChangeEvents();
   void markerUpdated();
   void destroyMarker(Marker *, bool = false);
   bool hasMarker(unsigned);
@@ -28,7 +28,7 @@ void Marker::onDidChange(std::function<void()> callback) {
   if (!this->hasChangeObservers) {
     this->previousEventState = this->getSnapshot(this->getRange());
     this->hasChangeObservers = true;
-    //this->layer->markersWithChangeListeners.add(this);
+    this->layer->markersWithChangeListeners.insert(this);
   }
   return this->didChangeEmitter.on(callback);
 }
@@ -187,10 +187,12 @@ bool Marker::update(const Range &oldRange, const Params &params, bool textChange
   }
   if (params.reversed && *params.reversed != this->reversed) {
     this->reversed = *params.reversed;
+    this->layer->markerSnapshots.reset();
     updated = true;
   }
   if (params.tailed && *params.tailed != this->tailed) {
     this->tailed = *params.tailed;
+    this->layer->markerSnapshots.reset();
     updated = true;
   }
   if (wasExclusive != this->isExclusive()) {
@@ -4,6 +4,8 @@
 #include "helpers.h"
 #include "point-helpers.h"
 #include "language-mode.h"
+#include <algorithm>
+#include <memory>
 
 TextBuffer::TextBuffer() {
   this->buffer = new NativeTextBuffer();
@@ -152,6 +154,10 @@ std::u16string TextBuffer::lineForRow(double row) {
   return *this->buffer->line_for_row(row);
 }
 
+TextSlice TextBuffer::lineSliceForRow(double row) {
+  return this->buffer->line_slice_for_row(row);
+}
+
 const char16_t *TextBuffer::lineEndingForRow(double row) {
   return this->buffer->line_ending_for_row(row);
 }
@@ -161,7 +167,8 @@ double TextBuffer::lineLengthForRow(double row) {
 }
 
 bool TextBuffer::isRowBlank(double row) {
-  return !Regex(u"\\S").match(this->lineForRow(row));
+  static const Regex NON_WHITESPACE_REGEX = Regex(u"\\S");
+  return !NON_WHITESPACE_REGEX.match(this->lineForRow(row));
 }
 
 optional<double> TextBuffer::previousNonBlankRow(double startRow) {
@@ -214,6 +221,96 @@ Range TextBuffer::setTextInRange(const Range &range, const std::u16string &newTe
   return newRange;
 }
 
+std::vector<Range> TextBuffer::setTextInRanges(const std::vector<std::pair<Range, std::u16string>> &edits) {
+  if (edits.empty()) return {};
+
+  // Apply the edits in buffer order. Insertions at the same position keep
+  // the order they were given in, ahead of a range that starts there.
+  const size_t editCount = edits.size();
+  std::vector<Range> oldRanges;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < editCount; i++) {
+    oldRanges.push_back(this->clipRange(edits[i].first));
+    order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&oldRanges](size_t a, size_t b) {
+    if (oldRanges[a].start == oldRanges[b].start) return oldRanges[a].end < oldRanges[b].end;
+    return oldRanges[a].start < oldRanges[b].start;
+  });
+  for (size_t i = 1; i < editCount; i++) {
+    if (oldRanges[order[i]].start < oldRanges[order[i - 1]].end) return {};
+  }
+
+  if (this->transactCallDepth == 0) {
+    std::vector<Range> newRanges;
+    this->transact([&]() { newRanges = this->applyEdits(edits, oldRanges, order); });
+    return newRanges;
+  }
+  return this->applyEdits(edits, oldRanges, order);
+}
+
+std::vector<Range> TextBuffer::applyEdits(const std::vector<std::pair<Range, std::u16string>> &edits, const std::vector<Range> &oldRanges, const std::vector<size_t> &order) {
+  const size_t editCount = edits.size();
+
+  // Observers see a single change spanning all of the edits. Its text is
+  // assembled from the edited text and the text between the edits.
+  std::vector<std::u16string> oldTexts(editCount);
+  std::u16string oldText, newText;
+  std::vector<std::pair<NativeRange, std::u16string>> nativeEdits;
+  std::vector<MarkerIndex::Splice> splices;
+  for (size_t i = 0; i < editCount; i++) {
+    const size_t index = order[i];
+    if (i > 0) {
+      const std::u16string textBetween = this->getTextInRange(Range(oldRanges[order[i - 1]].end, oldRanges[index].start));
+      oldText += textBetween;
+      newText += textBetween;
+    }
+    oldTexts[index] = this->getTextInRange(oldRanges[index]);
+    oldText += oldTexts[index];
+    newText += edits[index].second;
+    nativeEdits.push_back({oldRanges[index], edits[index].second});
+    splices.push_back({
+      oldRanges[index].start,
+      traversal(oldRanges[index].end, oldRanges[index].start),
+      extentForText(edits[index].second)
+    });
+  }
+
+  const Range oldRange = Range(oldRanges[order.front()].start, oldRanges[order.back()].end);
+  for (auto &displayLayer : this->displayLayers) {
+    displayLayer.second->bufferWillChange(oldRange);
+  }
+
+  this->buffer->set_text_in_ranges(std::move(nativeEdits));
+
+  // The edits are recorded from last to first, so that the start of each
+  // one is still in the buffer's original coordinates.
+  for (size_t i = editCount; i-- > 0;) {
+    const MarkerIndex::Splice &splice = splices[i];
+    const size_t index = order[i];
+    this->historyProvider->pushChange(splice.start, splice.old_extent, splice.new_extent, oldTexts[index], edits[index].second);
+  }
+  for (auto &markerLayer : this->markerLayers) {
+    markerLayer.second->spliceBatch(splices);
+    this->markerLayersWithPendingUpdateEvents.insert(markerLayer.second);
+  }
+
+  std::vector<Range> newRanges(editCount);
+  Point previousOldEnd = Point(0, 0);
+  Point previousNewEnd = Point(0, 0);
+  for (size_t i = 0; i < editCount; i++) {
+    const size_t index = order[i];
+    const Point newStart = traverse(previousNewEnd, traversal(oldRanges[index].start, previousOldEnd));
+    newRanges[index] = Range(newStart, traverse(newStart, Point(splices[i].new_extent)));
+    previousOldEnd = oldRanges[index].end;
+    previousNewEnd = newRanges[index].end;
+  }
+
+  const Range newRange = Range(oldRange.start, previousNewEnd);
+  this->emitDidChangeEvent(oldRange, newRange, oldText, newText);
+  return newRanges;
+}
+
 Range TextBuffer::insert(const Point &position, const std::u16string &text) {
   return this->setTextInRange(Range(position, position), text);
 }
@@ -356,7 +453,7 @@ bool TextBuffer::undo(DisplayMarkerLayer *selectionsMarkerLayer) {
   this->transactCallDepth--;
   this->restoreFromMarkerSnapshot(pop.markers, selectionsMarkerLayer);
   this->emitDidChangeTextEvent();
-  this->emitMarkerChangeEvents(pop.markers);
+  this->emitMarkerChangeEvents();
   return true;
 }
 
@@ -371,7 +468,7 @@ bool TextBuffer::redo(DisplayMarkerLayer *selectionsMarkerLayer) {
   this->transactCallDepth--;
   this->restoreFromMarkerSnapshot(pop.markers, selectionsMarkerLayer);
   this->emitDidChangeTextEvent();
-  this->emitMarkerChangeEvents(pop.markers);
+  this->emitMarkerChangeEvents();
   return true;
 }
 
@@ -393,7 +490,7 @@ void TextBuffer::transact(double groupingInterval, DisplayMarkerLayer *selection
   this->historyProvider->applyGroupingInterval(groupingInterval);
   this->historyProvider->enforceUndoStackSizeLimit();
   this->emitDidChangeTextEvent();
-  this->emitMarkerChangeEvents(endMarkerSnapshot);
+  this->emitMarkerChangeEvents();
 }
 
 void TextBuffer::transact(std::function<void()> fn) {
@@ -430,21 +527,12 @@ void TextBuffer::scanInRange(const Regex &regex, Range range, /* options = {}, *
   }*/
 
   range = this->clipRange(range);
-  const auto matchRanges = this->findAllInRangeSync(regex, range);
-  double startIndex = 0;
-  double endIndex = matchRanges.size();
-  double increment = 1;
   double previousRow = -1;
   double replacementColumnDelta = 0;
-  if (reverse) {
-    startIndex = matchRanges.size() - 1;
-    endIndex = -1;
-    increment = -1;
-  }
 
-  for (double i = startIndex; i != endIndex; i += increment) {
-    Range matchRange = matchRanges[i];
-    if (range.end.isEqual(matchRange.start) && (range.end.column > 0)) continue;
+  // Returns true once the callback has stopped the scan.
+  auto visitMatch = [&](Range matchRange) -> bool {
+    if (range.end.isEqual(matchRange.start) && (range.end.column > 0)) return false;
     if (matchRange.start.row != previousRow) {
       replacementColumnDelta = 0;
     }
@@ -454,13 +542,26 @@ void TextBuffer::scanInRange(const Regex &regex, Range range, /* options = {}, *
 
     SearchCallbackArgument argument = SearchCallbackArgument(this, matchRange, regex /* , options*/);
     callback(argument);
-    if (argument.stopped /* || !regex.global */) break;
+    if (argument.stopped /* || !regex.global */) return true;
 
     if (!reverse && argument.replacementText) {
       replacementColumnDelta +=
         (matchRange.start.column + argument.replacementText->size()) -
         matchRange.end.column;
     }
+    return false;
+  };
+
+  if (reverse) {
+    const auto matchRanges = this->findAllInRangeSync(regex, range);
+    for (auto i = matchRanges.rbegin(); i != matchRanges.rend(); ++i) {
+      if (visitMatch(*i)) break;
+    }
+  } else {
+    // Search a snapshot so that replacements made by the callback don't
+    // disturb the matches that are still to come.
+    std::unique_ptr<NativeTextBuffer::Snapshot> snapshot{this->buffer->create_snapshot()};
+    snapshot->scan(regex, range, visitMatch);
   }
 }
 
@@ -709,7 +810,7 @@ void TextBuffer::restoreFromMarkerSnapshot(const MarkerSnapshot &snapshot, Displ
   }
 }
 
-void TextBuffer::emitMarkerChangeEvents(MarkerSnapshot &snapshot) {
+void TextBuffer::emitMarkerChangeEvents() {
   if (this->transactCallDepth == 0) {
     while (this->markerLayersWithPendingUpdateEvents.size() > 0) {
       std::vector<MarkerLayer *> updatedMarkerLayers(this->markerLayersWithPendingUpdateEvents.begin(), this->markerLayersWithPendingUpdateEvents.end());
@@ -724,8 +825,7 @@ void TextBuffer::emitMarkerChangeEvents(MarkerSnapshot &snapshot) {
   }
 
   for (auto &markerLayer : this->markerLayers) {
-    const unsigned markerLayerId = markerLayer.first;
-    markerLayer.second->emitChangeEvents(snapshot[markerLayerId]);
+    markerLayer.second->emitChangeEvents();
   }
 }
 
@@ -72,6 +72,7 @@ struct TextBuffer {
   std::vector<std::u16string> getLines();
   std::u16string getLastLine();
   std::u16string lineForRow(double);
+  TextSlice lineSliceForRow(double);
   const char16_t *lineEndingForRow(double);
   double lineLengthForRow(double);
   bool isRowBlank(double);
@@ -79,9 +80,15 @@ struct TextBuffer {
   optional<double> nextNonBlankRow(double);
   Range setText(const std::u16string &);
   Range setTextInRange(const Range &, const std::u16string &);
+  // Replaces each range with its text as a single change, and returns the
+  // new range of each edit. The ranges may come in any order and all refer
+  // to the text from before any of the edits. If any two of them overlap,
+  // nothing is changed and no ranges are returned.
+  std::vector<Range> setTextInRanges(const std::vector<std::pair<Range, std::u16string>> &);
   Range insert(const Point &, const std::u16string &);
   Range append(const std::u16string &);
   Range applyChange(const Point &, const Point &, const Point &, const Point &, const std::u16string &, const std::u16string &, bool = false);
+  std::vector<Range> applyEdits(const std::vector<std::pair<Range, std::u16string>> &, const std::vector<Range> &, const std::vector<size_t> &);
   Range delete_(const Range &);
   Range deleteRow(double);
   Range deleteRows(double, double);
@@ -131,7 +138,7 @@ struct TextBuffer {
   TextBuffer *loadSync();
   MarkerSnapshot createMarkerSnapshot(DisplayMarkerLayer *);
   void restoreFromMarkerSnapshot(const MarkerSnapshot &, DisplayMarkerLayer *);
-  void emitMarkerChangeEvents(MarkerSnapshot &);
+  void emitMarkerChangeEvents();
   void emitDidChangeTextEvent();
   void emitDidStopChangingEvent();
   void emitModifiedStatusChanged(bool);
@@ -0,0 +1,103 @@
+#include <catch.hpp>
+#include <regex.h>
+#include "text-buffer.h"
+
+using std::u16string;
+using std::vector;
+
+TEST_CASE("TextBuffer::scan - stopping early") {
+  TextBuffer buffer{u"a1 a2\na3 a4"};
+  vector<u16string> matches;
+  buffer.scan(Regex(u"a\\d", nullptr), [&](TextBuffer::SearchCallbackArgument &argument) {
+    matches.push_back(argument.getMatchText());
+    if (matches.size() == 3) argument.stop();
+  });
+  REQUIRE(matches == vector<u16string>({u"a1", u"a2", u"a3"}));
+}
+
+TEST_CASE("TextBuffer::scan - replacing matches") {
+  TextBuffer buffer{u"ab ab ab\nab ab"};
+  vector<Range> ranges;
+  buffer.transact([&]() {
+    buffer.scan(Regex(u"ab", nullptr), [&](TextBuffer::SearchCallbackArgument &argument) {
+      ranges.push_back(argument.range);
+      argument.replace(ranges.size() % 2 ? u"xyz" : u"");
+    });
+  });
+
+  // Each match is reported where earlier replacements on its row moved it.
+  REQUIRE(buffer.getText() == u"xyz  xyz\n xyz");
+  REQUIRE(ranges == vector<Range>({
+    Range(Point(0, 0), Point(0, 2)),
+    Range(Point(0, 4), Point(0, 6)),
+    Range(Point(0, 5), Point(0, 7)),
+    Range(Point(1, 0), Point(1, 2)),
+    Range(Point(1, 1), Point(1, 3)),
+  }));
+
+  REQUIRE(buffer.undo());
+  REQUIRE(buffer.getText() == u"ab ab ab\nab ab");
+}
+
+TEST_CASE("TextBuffer::setTextInRanges - edits in any order") {
+  TextBuffer buffer{u"abc def\nghi jkl"};
+  Marker *marker1 = buffer.markRange(Range(Point(0, 4), Point(1, 2)));
+  Marker *marker2 = buffer.markRange(Range(Point(1, 4), Point(1, 7)));
+
+  TextBuffer expectedBuffer{u"abc def\nghi jkl"};
+  Marker *expectedMarker1 = expectedBuffer.markRange(Range(Point(0, 4), Point(1, 2)));
+  Marker *expectedMarker2 = expectedBuffer.markRange(Range(Point(1, 4), Point(1, 7)));
+
+  vector<Range> newRanges = buffer.setTextInRanges({
+    {Range(Point(1, 3), Point(1, 4)), u"\n"},
+    {Range(Point(0, 0), Point(0, 3)), u"x"},
+    {Range(Point(0, 5), Point(1, 1)), u"yy\nzz"},
+    {Range(Point(0, 0), Point(0, 0)), u"w"},
+  });
+
+  // Applying the same edits one at a time from last to first.
+  expectedBuffer.transact([&]() {
+    expectedBuffer.setTextInRange(Range(Point(1, 3), Point(1, 4)), u"\n");
+    expectedBuffer.setTextInRange(Range(Point(0, 5), Point(1, 1)), u"yy\nzz");
+    expectedBuffer.setTextInRange(Range(Point(0, 0), Point(0, 3)), u"x");
+    expectedBuffer.setTextInRange(Range(Point(0, 0), Point(0, 0)), u"w");
+  });
+
+  REQUIRE(buffer.getText() == u"wx dyy\nzzhi\njkl");
+  REQUIRE(buffer.getText() == expectedBuffer.getText());
+  REQUIRE(newRanges == vector<Range>({
+    Range(Point(1, 4), Point(2, 0)),
+    Range(Point(0, 1), Point(0, 2)),
+    Range(Point(0, 4), Point(1, 2)),
+    Range(Point(0, 0), Point(0, 1)),
+  }));
+  REQUIRE(marker1->getRange() == expectedMarker1->getRange());
+  REQUIRE(marker2->getRange() == expectedMarker2->getRange());
+
+  REQUIRE(buffer.undo());
+  REQUIRE(buffer.getText() == u"abc def\nghi jkl");
+  REQUIRE(marker1->getRange() == Range(Point(0, 4), Point(1, 2)));
+  REQUIRE(marker2->getRange() == Range(Point(1, 4), Point(1, 7)));
+
+  REQUIRE(buffer.redo());
+  REQUIRE(buffer.getText() == u"wx dyy\nzzhi\njkl");
+  REQUIRE(marker1->getRange() == expectedMarker1->getRange());
+  REQUIRE(buffer.undo());
+  REQUIRE(!buffer.undo());
+}
+
+TEST_CASE("TextBuffer::setTextInRanges - overlapping edits") {
+  TextBuffer buffer{u"abc def\nghi jkl"};
+  Marker *marker = buffer.markRange(Range(Point(0, 4), Point(1, 2)));
+
+  vector<Range> newRanges = buffer.setTextInRanges({
+    {Range(Point(1, 0), Point(1, 5)), u"x"},
+    {Range(Point(0, 2), Point(0, 6)), u"y"},
+    {Range(Point(0, 5), Point(1, 1)), u"z"},
+  });
+
+  REQUIRE(newRanges.empty());
+  REQUIRE(buffer.getText() == u"abc def\nghi jkl");
+  REQUIRE(marker->getRange() == Range(Point(0, 4), Point(1, 2)));
+  REQUIRE(!buffer.undo());
+}